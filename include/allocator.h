@@ -23,6 +23,42 @@
 #define MMAP_THRESHOLD ((size_t)(128 * 1024)) /* 128KB threshold for mmap vs sbrk */
 #define MIN_ALLOC_SIZE (sizeof(void *) * 2)   /* Minimum allocation size */
 #define MAX_THREAD_CACHE_SIZE (64 * 1024)     /* Thread-local cache limit */
+#define DEFERRED_FREE_CAPACITY 64             /* Per-thread frees batched per lock */
+#define RECLAIM_QUEUE_DEPTH 64                /* Pending jobs for the reclaimer thread */
+#define RECLAIM_PURGE_THRESHOLD ((size_t)(1024 * 1024)) /* Free runs worth a madvise */
+#define ZERO_POOL_MIN_SIZE ((size_t)(16 * 1024))      /* Smallest calloc served pre-zeroed */
+#define ZERO_POOL_MAX_SIZE ((size_t)(1024 * 1024))    /* Largest calloc served pre-zeroed */
+#define ZERO_POOL_DEPTH 4                             /* Ready chunks kept per size class */
+#define MEMOPS_REP_THRESHOLD ((size_t)2048)           /* Smallest copy/zero using rep movsb */
+#define MEMOPS_NONTEMPORAL_THRESHOLD ((size_t)(4 * 1024 * 1024)) /* Streaming stores */
+#define SMALL_OBJECT_MAX 1024                            /* Largest object served from segments */
+#define SEGMENT_SIZE ((size_t)(4 * 1024 * 1024))        /* Segment size and alignment */
+#define SEGMENT_PAGE_SIZE ((size_t)(64 * 1024))         /* Per-size-class page in a segment */
+#define SEGMENT_ARENA_SIZE ((size_t)1024 * 1024 * 1024) /* Address space reserved for segments */
+#define ARENA_MAX 16                                    /* Explicit arenas, including arena 0 */
+#define ARENA_CHUNK_SIZE ((size_t)(1024 * 1024))        /* Chunk size and alignment in arenas */
+#define LIFETIME_SAMPLE_INTERVAL 64                     /* Allocations per lifetime sample */
+#define LIFETIME_SHORT_ALLOCATIONS 8192                 /* Lifetime limit for short-lived */
+#define HANDLE_HEAP_SIZE ((size_t)256 * 1024 * 1024)     /* Address space for movable objects */
+#define SLAB_SPAN_SIZE ((size_t)4096)                    /* Meshable slab, one page */
+#define SLAB_ARENA_SIZE ((size_t)256 * 1024 * 1024)      /* Address space for meshable slabs */
+#define HEAP_ITERATE_SLICE 64                            /* Blocks visited per lock hold */
+#define VERIFY_TICK_BLOCKS 1024                          /* Blocks checked per verifier tick */
+#define VERIFY_INTERVAL_MS 100                           /* Period of the background verifier */
+#define SIGNAL_RESERVE_SIZE ((size_t)(64 * 1024))        /* Per-thread signal-safe reserve */
+#define STACK_MIN_SIZE ((size_t)(16 * 1024))             /* Smallest coroutine stack */
+#define STACK_MAX_SIZE ((size_t)(8 * 1024 * 1024))       /* Largest coroutine stack */
+#define STACK_CLASS_RESERVE ((size_t)64 << 30)           /* Address space per stack size */
+#define STACK_CACHE_BYTES ((size_t)(1024 * 1024))        /* Stacks cached per thread and size */
+#define IO_BUFFER_MIN_SIZE ((size_t)4096)                /* Smallest page-aligned I/O buffer */
+#define IO_BUFFER_MAX_SIZE ((size_t)(1024 * 1024))       /* Largest page-aligned I/O buffer */
+#define IO_BUFFER_CHUNK_SIZE ((size_t)(4 * 1024 * 1024)) /* Chunk size and alignment of buffers */
+#define IO_BUFFER_CACHE_BYTES ((size_t)(2 * 1024 * 1024)) /* Buffers cached per thread and size */
+#define ALLOC_TAG_MAX 256                                /* Tags 1 to 255; 0 is untagged */
+#define ALLOC_TAG_DEPTH 16                               /* Nesting of alloc_tag_push() */
+#define HEAP_SNAPSHOT_CLASSES 48                         /* Power-of-two size classes counted */
+#define PRESSURE_CHECK_MS 250                            /* Period of memory pressure checks */
+#define PRESSURE_STALL_US 10000                          /* PSI stall per check that is pressure */
 
 /* Alignment Macros */
 #define ALIGN_SIZE(size) (((size) + ALIGNMENT - 1) & ~(ALIGNMENT - 1))
@@ -30,16 +66,20 @@
 
 /* Block Header Structure
  *
- * Layout for allocated blocks (16 bytes):
+ * Layout for allocated blocks (32 bytes):
  * +--------+--------+--------+--------+
- * |     size (8 bytes)      | is_free|
+ * |     size (8 bytes)      |free|flg|
  * +--------+--------+--------+--------+
  * |  magic (4 bytes) |     unused     |
  * +--------+--------+--------+--------+
+ * |      mapped_size (8 bytes)        |
+ * +--------+--------+--------+--------+
+ * | map_offset (4)  |arena|flags| tag  |
+ * +--------+--------+--------+--------+
  *
  * Layout for free blocks (32 bytes):
  * +--------+--------+--------+--------+
- * |     size (8 bytes)      | is_free|
+ * |     size (8 bytes)      |free|flg|
  * +--------+--------+--------+--------+
  * |  magic (4 bytes) |     unused     |
  * +--------+--------+--------+--------+
@@ -49,15 +89,36 @@
  * +--------+--------+--------+--------+
  */
 typedef struct block {
-    size_t size;      /* Size of user data area (excluding header) */
-    uint32_t is_free; /* 0 = allocated, 1 = free */
-    uint32_t magic;   /* Magic number for corruption detection */
-
-    /* Free list pointers - only valid when is_free == 1 */
-    struct block *prev_free;
-    struct block *next_free;
+    size_t size;         /* Size of user data area (excluding header) */
+    uint16_t is_free;    /* 0 = allocated, 1 = free */
+    uint16_t free_flags; /* FREE_FLAG_*, only valid when is_free == 1 */
+    uint32_t magic;      /* Magic number for corruption detection */
+
+    union {
+        /* Free list pointers - only valid when is_free == 1 */
+        struct {
+            struct block *prev_free;
+            struct block *next_free;
+        };
+
+        /* Allocation metadata - only valid when is_free == 0 */
+        struct {
+            size_t mapped_size;  /* Length of a dedicated mmap, 0 for heap blocks */
+            uint32_t map_offset; /* Distance from the start of that mmap to the header */
+            uint8_t arena_id;    /* Explicit arena the block came from, 0 for the heap */
+            uint8_t flags;       /* BLOCK_FLAG_* */
+            uint16_t tag;        /* alloc_tag_push() tag, with the snapshot counting bit */
+        };
+    };
 } block_t;
 
+/* Block Flags */
+#define BLOCK_FLAG_NO_TCACHE 0x01 /* Allocated with MALLOCX_TCACHE_NONE */
+#define BLOCK_FLAG_SAMPLED 0x02   /* Tracked by lifetime prediction */
+
+/* Free Block Flags */
+#define FREE_FLAG_PURGED 0x01 /* Whole pages released; cleared when the block is taken */
+
 /* Heap Management Structure */
 typedef struct heap_info {
     void *heap_start;    /* Start of heap region */
@@ -84,6 +145,7 @@ typedef struct thread_cache {
     cache_entry_t *free_lists[8]; /* Size classes: 16, 32, 64, 128, 256, 512, 1024 */
     size_t cache_size;            /* Total cached memory */
     bool enabled;                 /* Cache enabled for this thread */
+    unsigned pressure_epoch;      /* Memory pressure epoch at the last drain */
 } thread_cache_t;
 
 /* Error Codes */
@@ -117,12 +179,384 @@ void free(void *ptr);
 
 /* Extended Interface */
 void *aligned_alloc(size_t alignment, size_t size);
+int posix_memalign(void **memptr, size_t alignment, size_t size);
 size_t malloc_usable_size(void *ptr);
+int malloc_trim(size_t pad); /* Releases free pages, keeping pad bytes at the heap top */
+
+/* Flag-Based Interface
+ *
+ * mallocx() and rallocx() take a combination of the MALLOCX_* flags below,
+ * following the jemalloc API:
+ * - MALLOCX_ALIGN(a) / MALLOCX_LG_ALIGN(la): power-of-two alignment, which
+ *   is kept when rallocx() has to move the object
+ * - MALLOCX_ZERO: new bytes read as zero, including bytes gained by growth
+ * - MALLOCX_TCACHE_NONE: bypass the per-thread paths (segments, the zero
+ *   pool and the deferred free buffer) when allocating and freeing
+ * - MALLOCX_ARENA(a): allocate from an arena made with allocator_arena_create()
+ * - ALLOC_HINT_*: expected lifetime or hotness, see Allocation Hints below
+ * xallocx() only ever resizes in place: it tries to make the object at least
+ * size and at most size + extra bytes and returns the resulting usable size,
+ * which is below size when the object could not grow. Realloc-style moves
+ * are left to the caller.
+ */
+#define MALLOCX_LG_ALIGN(la) ((int)(la))
+#define MALLOCX_ALIGN(a) ((int)__builtin_ctzl((unsigned long)(a)))
+#define MALLOCX_ZERO ((int)0x40)
+#define MALLOCX_TCACHE_NONE ((int)0x100)
+#define MALLOCX_ARENA(a) ((int)(((unsigned)(a) + 1) << 20))
+#define ALLOC_HINT_SHORT_LIVED ((int)(1 << 12))
+#define ALLOC_HINT_LONG_LIVED ((int)(2 << 12))
+#define ALLOC_HINT_COLD ((int)(3 << 12))
+
+void *mallocx(size_t size, int flags);
+void *rallocx(void *ptr, size_t size, int flags);
+size_t xallocx(void *ptr, size_t size, size_t extra, int flags);
+void dallocx(void *ptr, int flags);
+
+/* Explicit Arenas
+ *
+ * An arena is a separate set of ARENA_CHUNK_SIZE chunks with its own lock,
+ * so objects allocated with MALLOCX_ARENA(a) never share pages with the
+ * main heap or with other arenas. Requests that do not fit in a chunk get a
+ * dedicated mapping as usual. Arena 0 is the main heap.
+ */
+typedef struct arena_stats {
+    size_t chunks;       /* Chunks currently mapped */
+    size_t allocated;    /* Bytes in live objects */
+    size_t live_objects; /* Objects currently allocated */
+    size_t cold_advised; /* Bytes handed to madvise(MADV_COLD) */
+} arena_stats_t;
+
+int allocator_arena_create(void); /* Returns the arena index, or -1 */
+int allocator_arena_stats(unsigned arena, arena_stats_t *stats);
+
+/* Allocation Hints
+ *
+ * An ALLOC_HINT_* flag passed to mallocx() places the object in an arena
+ * shared by all objects with the same hint, created on first use, so
+ * survivors do not pin memory that temporaries keep churning through:
+ * - ALLOC_HINT_SHORT_LIVED: per-request temporaries; their chunks empty
+ *   out and start over as a whole
+ * - ALLOC_HINT_LONG_LIVED: caches and other survivors, packed densely
+ * - ALLOC_HINT_COLD: rarely touched objects; filled chunks are handed to
+ *   madvise(MADV_COLD) so the kernel reclaims them first under pressure
+ * An explicit MALLOCX_ARENA() takes precedence over a hint.
+ */
+int allocator_hint_arena(int hint); /* Arena serving a hint, or -1 */
+size_t allocator_advise_cold(void);  /* Advise all cold chunks now; returns bytes */
+
+/* Lifetime Prediction
+ *
+ * When enabled, malloc() and mallocx() without flags sample one allocation
+ * in LIFETIME_SAMPLE_INTERVAL, learn per call site (return address) how
+ * long its objects live, and place allocations from sites that turn out to
+ * be short-lived in the ALLOC_HINT_SHORT_LIVED arena, the nursery.
+ */
+typedef struct lifetime_stats {
+    size_t sampled;             /* Allocations sampled */
+    size_t sites;               /* Call sites seen in samples */
+    size_t short_lived_sites;   /* Sites currently predicted short-lived */
+    size_t nursery_allocations; /* Allocations placed in the nursery */
+    size_t predictions;         /* Sampled objects whose site had a prediction */
+    size_t correct;             /* ... for which the prediction held */
+} lifetime_stats_t;
+
+int allocator_set_lifetime_prediction(bool enabled); /* Disabled by default */
+void allocator_lifetime_stats(lifetime_stats_t *stats);
+
+/* Movable Handles
+ *
+ * Objects from handle_alloc() live in a separate heap and are reached only
+ * through handle_lock(), which returns their current address and pins them
+ * until the matching handle_unlock(). heap_compact() slides unpinned
+ * objects together, at most about budget bytes of work per call, and
+ * releases the pages freed at the top once a pass completes. It returns 1
+ * when the pass has finished and 0 while work remains.
+ */
+typedef uint32_t handle_t;
+#define HANDLE_NULL ((handle_t)0)
+
+typedef struct handle_stats {
+    size_t live_objects;  /* Objects currently allocated */
+    size_t live_bytes;    /* Payload bytes of those objects */
+    size_t heap_bytes;    /* Extent of the handle heap, headers and holes included */
+    size_t passes;        /* Completed compaction passes */
+    size_t bytes_moved;   /* Bytes relocated by compaction */
+    size_t bytes_trimmed; /* Bytes released with madvise() after passes */
+} handle_stats_t;
+
+handle_t handle_alloc(size_t size);
+void *handle_lock(handle_t handle);
+void handle_unlock(handle_t handle);
+void handle_free(handle_t handle);
+int heap_compact(size_t budget);
+void allocator_handle_stats(handle_stats_t *stats);
 
 /* Allocator Management */
 int allocator_init(void);
 void allocator_cleanup(void);
 void allocator_stats(void);
+bool allocator_single_threaded(void); /* True while locking is still bypassed */
+
+/* Deferred Free */
+void allocator_flush_deferred_frees(void);     /* Return this thread's pending frees */
+void allocator_set_deferred_free(bool enabled); /* Enabled by default */
+
+/* Background Reclaimer
+ *
+ * When enabled, munmap() of freed dedicated mappings and madvise() purges of
+ * large free runs are handed to a background thread. The queue holds at most
+ * RECLAIM_QUEUE_DEPTH jobs; when it is full the freeing thread does the work
+ * itself, so retained memory stays bounded.
+ */
+typedef struct reclaim_stats {
+    size_t queued;         /* Jobs handed to the reclaimer thread */
+    size_t completed;      /* Jobs finished by the reclaimer thread */
+    size_t inline_jobs;    /* Jobs left to the caller because the queue was full */
+    size_t bytes_unmapped; /* Bytes returned with munmap() */
+    size_t bytes_purged;   /* Bytes released with madvise() */
+} reclaim_stats_t;
+
+int allocator_set_background_reclaim(bool enabled); /* Disabled by default */
+void allocator_reclaim_stats(reclaim_stats_t *stats);
+
+/* Memory Pressure Monitor
+ *
+ * allocator_set_pressure_monitor() has the reclaimer thread, started if it
+ * is not running, check every PRESSURE_CHECK_MS for memory pressure: a PSI
+ * "some" stall of PRESSURE_STALL_US or more since the last check, or a new
+ * "high", "max", "oom" or "oom_kill" event of the cgroup. On pressure it
+ * empties the pre-zeroed pool, releases free memory as malloc_trim() does,
+ * and has each thread flush its deferred frees and thread cache the next
+ * time it frees or uses the cache; idle threads keep theirs, so this is
+ * best-effort. The sources default to /proc/pressure/memory and the
+ * memory.events file of the process's cgroup;
+ * allocator_set_pressure_paths() replaces them, NULL restoring a default
+ * and "" turning a source off. Enabling returns -1 with errno ENOENT when
+ * neither source can be read.
+ */
+typedef struct pressure_stats {
+    size_t checks;         /* Times the sources were read */
+    size_t psi_events;     /* Checks that found a PSI stall */
+    size_t cgroup_events;  /* Checks that found new cgroup events */
+    size_t bytes_released; /* Bytes given back in response */
+} pressure_stats_t;
+
+int allocator_set_pressure_monitor(bool enabled); /* Disabled by default */
+int allocator_set_pressure_paths(const char *psi_path, const char *events_path);
+void allocator_pressure_stats(pressure_stats_t *stats);
+
+/* Pre-Zeroed Pool
+ *
+ * When enabled, a low-priority thread keeps cleared chunks ready for
+ * calloc() requests between ZERO_POOL_MIN_SIZE and ZERO_POOL_MAX_SIZE.
+ */
+typedef struct zero_pool_stats {
+    size_t hits;         /* calloc() calls served from the pool */
+    size_t misses;       /* Eligible calloc() calls that found the pool empty */
+    size_t refills;      /* Chunks cleared by the background thread */
+    size_t bytes_zeroed; /* Bytes cleared by the background thread */
+} zero_pool_stats_t;
+
+int allocator_set_zero_pool(bool enabled); /* Disabled by default */
+void allocator_zero_pool_stats(zero_pool_stats_t *stats);
+
+/* Copy and Zero Kernels
+ *
+ * realloc() and calloc() move and clear memory with size-tuned kernels
+ * chosen from cpuid: rep movsb/stosb for medium sizes and non-temporal
+ * AVX2/SSE2 stores from MEMOPS_NONTEMPORAL_THRESHOLD up, falling back to
+ * memcpy()/memset(). MEMOPS_LIBC forces the fallback for comparison.
+ */
+typedef enum { MEMOPS_TUNED, MEMOPS_LIBC } memops_mode_t;
+
+void allocator_set_memops_mode(memops_mode_t mode); /* MEMOPS_TUNED by default */
+const char *allocator_memops_kernels(void);         /* e.g. "erms+avx2-nt" */
+void allocator_copy(void *dst, const void *src, size_t size);
+void allocator_zero(void *dst, size_t size);
+
+/* Small-Object Segments
+ *
+ * When enabled, objects up to SMALL_OBJECT_MAX bytes come from
+ * SEGMENT_SIZE-aligned segments whose pages each hold one size class.
+ * free() finds the class by masking the pointer instead of reading a block
+ * header. Each page belongs to one thread and keeps separate lists for the
+ * owner's frees and other threads' frees, so neither path takes a lock.
+ * Segment objects have no header and no double-free detection.
+ */
+typedef struct small_stats {
+    size_t segments;     /* Segments committed from the reserved range */
+    size_t pages_in_use; /* Pages currently assigned to a size class */
+    size_t live_objects; /* Objects currently allocated from segments */
+} small_stats_t;
+
+int allocator_set_small_segments(bool enabled); /* Disabled by default */
+void allocator_small_stats(small_stats_t *stats);
+
+/* Meshable Slabs
+ *
+ * When enabled, objects up to SMALL_OBJECT_MAX bytes come from memfd-backed
+ * slabs of SLAB_SPAN_SIZE, ahead of segments. allocator_mesh_slabs() looks
+ * for slabs of one size class and tag whose live objects occupy disjoint slots,
+ * copies one into the other's physical page and maps both virtual pages
+ * onto it, so the second page is released while every object keeps its
+ * address. A pass compares at most budget pairs of slabs and returns the
+ * bytes it released. Background meshing runs such passes on a thread.
+ *
+ * Allocation prefers the fullest partial slab of a class, so sparse slabs
+ * drain and are released. allocator_slab_utilization() reports the slab
+ * behind a slab object, or returns -1 for any other pointer; a program can
+ * move objects out of sparse slabs to help them drain.
+ */
+typedef struct slab_stats {
+    size_t virtual_pages;  /* Pages holding slab objects, as seen by the program */
+    size_t physical_pages; /* File pages behind them */
+    size_t live_objects;   /* Objects currently allocated from slabs */
+    size_t meshes;         /* Slabs merged into another */
+    size_t bytes_released; /* Bytes released by meshing */
+} slab_stats_t;
+
+typedef struct slab_utilization {
+    size_t used;       /* Live objects in the slab, meshed pages included */
+    size_t capacity;   /* Objects the slab holds when full */
+    size_t block_size; /* Object size of the slab's class */
+} slab_utilization_t;
+
+int allocator_set_meshable_slabs(bool enabled);     /* Disabled by default */
+int allocator_set_background_meshing(bool enabled); /* Disabled by default */
+size_t allocator_mesh_slabs(size_t budget);
+int allocator_slab_utilization(const void *ptr, slab_utilization_t *utilization);
+void allocator_slab_stats(slab_stats_t *stats);
+
+/* Async-Signal-Safe Allocation
+ *
+ * signal_safe_alloc() and signal_safe_free() may be called from a signal
+ * handler, including one that interrupted malloc() or either of them. A
+ * thread calls signal_safe_init() first, outside any handler, to map its
+ * reserve of SIGNAL_RESERVE_SIZE bytes; allocation then never takes a lock
+ * or makes a system call, and returns NULL when the thread has no reserve,
+ * the reserve is used up or size exceeds 1024 bytes. Freed objects keep
+ * their size class, so a reserve suits handlers with a few recurring sizes.
+ * Objects may be freed by any thread, but only with signal_safe_free().
+ */
+typedef struct signal_safe_stats {
+    size_t reserves;    /* Reserves mapped, including those of exited threads */
+    size_t allocations; /* Objects handed out */
+    size_t failures;    /* Requests that returned NULL */
+} signal_safe_stats_t;
+
+int signal_safe_init(void); /* Map this thread's reserve; 0 or -1 */
+void *signal_safe_alloc(size_t size);
+void signal_safe_free(void *ptr);
+void allocator_signal_safe_stats(signal_safe_stats_t *stats);
+
+/* Real-Time Heap
+ *
+ * allocator_realtime_init() maps a pool of pool_size bytes, faults it in
+ * and mlock()s it; it returns 0, or -1 with errno set, e.g. when the pool
+ * exceeds RLIMIT_MEMLOCK, and can succeed only once. rt_alloc() and
+ * rt_free() then serve objects from that pool alone, with a two-level
+ * segregated fit whose operations take a bounded number of steps, and
+ * never make a system call unless the pool's lock is contended. rt_alloc()
+ * returns NULL when the pool cannot hold size bytes. Threads with deadlines
+ * should also mlockall() so that their code and stacks cannot fault.
+ */
+typedef struct realtime_stats {
+    size_t pool_size;   /* Bytes mapped and locked */
+    size_t used;        /* Bytes in live objects, headers included */
+    size_t peak_used;   /* Highest value of used */
+    size_t allocations; /* Successful rt_alloc() calls */
+    size_t failures;    /* rt_alloc() calls the pool could not serve */
+} realtime_stats_t;
+
+int allocator_realtime_init(size_t pool_size);
+void *rt_alloc(size_t size);
+void rt_free(void *ptr);
+void allocator_realtime_stats(realtime_stats_t *stats);
+
+/* Coroutine Stacks
+ *
+ * stack_alloc() returns the lowest address of a writable stack of at least
+ * size bytes, rounded up to a power of two from STACK_MIN_SIZE, with a
+ * PROT_NONE guard page just below it; stacks grow down, so overflowing one
+ * faults. stack_usable_size() gives the rounded size for makecontext() and
+ * the like. Stacks freed with stack_free() are cached by the freeing thread
+ * and reused without a system call; stacks that fall out of the cache have
+ * their pages released. NULL comes back for size 0 or above STACK_MAX_SIZE.
+ * A double stack_free() aborts.
+ */
+typedef struct stack_stats {
+    size_t reserved;       /* Address space reserved for stacks */
+    size_t carved;         /* Stacks made writable, each once */
+    size_t pool_reuses;    /* Stacks taken from the shared pool */
+    size_t bytes_released; /* Bytes handed to madvise(MADV_DONTNEED) */
+} stack_stats_t;
+
+void *stack_alloc(size_t size);
+void stack_free(void *stack);
+size_t stack_usable_size(const void *stack); /* 0 for anything else */
+void allocator_stack_stats(stack_stats_t *stats);
+
+/* I/O Buffer Pool
+ *
+ * io_buffer_alloc() returns a page-aligned buffer of at least size bytes,
+ * rounded up to a power of two from IO_BUFFER_MIN_SIZE to
+ * IO_BUFFER_MAX_SIZE, for O_DIRECT or registered-buffer I/O. Buffers are
+ * reused through per-thread caches and their memory is never unmapped, so
+ * an address stays valid, and safe to keep registered with the kernel,
+ * after io_buffer_free(), which aborts on a double free and ignores
+ * addresses that are not the start of a buffer, setting last_error to
+ * ALLOC_ERROR_INVALID_POINTER. allocator_set_io_buffer_mlock() locks every
+ * chunk of the pool into memory, present and future, or unlocks it; it
+ * returns 0, or -1 with errno set and nothing locked.
+ */
+typedef struct io_buffer_stats {
+    size_t chunks;        /* IO_BUFFER_CHUNK_SIZE chunks carved into buffers */
+    size_t bytes_mapped;  /* Address space behind them, alignment slack included */
+    size_t bytes_locked;  /* Chunk bytes held by mlock() */
+    size_t carved;        /* Buffers handed out for the first time */
+    size_t shared_reuses; /* Buffers reused through the shared lists */
+} io_buffer_stats_t;
+
+void *io_buffer_alloc(size_t size);
+void io_buffer_free(void *buf);
+size_t io_buffer_size(const void *buf); /* 0 for anything else */
+int allocator_set_io_buffer_mlock(bool enabled); /* Disabled by default */
+void allocator_io_buffer_stats(io_buffer_stats_t *stats);
+
+/* Per-Thread Byte Counters
+ *
+ * Pointers to the calling thread's cumulative count of usable bytes
+ * allocated and freed through malloc(), calloc(), realloc(), free() and the
+ * extended interface, like jemalloc's thread.allocatedp. The pointers stay
+ * valid for the life of the thread, so a request handler can read them at
+ * start and finish and charge the difference to the request without any
+ * further call. The counters are updated without atomics and never reset.
+ */
+const uint64_t *allocator_thread_allocatedp(void);
+const uint64_t *allocator_thread_deallocatedp(void);
+
+/* Allocation Tags
+ *
+ * alloc_tag_push() makes tag the calling thread's current tag until the
+ * matching alloc_tag_pop(); blocks allocated meanwhile through the malloc()
+ * family are charged to it until they are freed, by any thread. Pushes nest
+ * up to ALLOC_TAG_DEPTH deep. A push returns 0, or -1 with errno EINVAL for
+ * a tag of ALLOC_TAG_MAX or more and ENOSPC when the nesting is full. Small
+ * segment pages and meshable slabs hold objects of a single tag, so tagged
+ * allocations keep their fast paths. allocator_tag_stats() sums the
+ * per-thread counters of one tag; tag 0 is never counted.
+ */
+typedef struct alloc_tag_stats {
+    size_t live_bytes;   /* Usable bytes of live blocks with the tag */
+    size_t live_objects; /* Live blocks with the tag */
+    size_t allocations;  /* Blocks ever allocated with the tag */
+} alloc_tag_stats_t;
+
+int alloc_tag_push(uint16_t tag);
+void alloc_tag_pop(void);
+uint16_t alloc_tag_get(void); /* Current tag, 0 outside any push */
+int allocator_tag_stats(uint16_t tag, alloc_tag_stats_t *stats);
 
 /* Memory Sourcing */
 void *acquire_memory_sbrk(size_t size);
@@ -168,12 +602,144 @@ void cleanup_thread_cache(void);
 void *cache_alloc(size_t size);
 void cache_free(void *ptr, size_t size);
 
-/* Debugging and Validation */
+/* Debugging and Validation
+ *
+ * heap_iterate() calls callback for every block in the sbrk heap, in
+ * address order, and then for every block with a dedicated mapping. It
+ * holds the allocator's locks for at most HEAP_ITERATE_SLICE blocks at a
+ * time and calls back with no lock held, so the callback may allocate and
+ * other threads keep running; a block that changes between slices may be
+ * reported in either state. A non-zero return from callback ends the walk
+ * and is passed back. Otherwise heap_iterate() returns 0, or -1 with
+ * last_error set to ALLOC_ERROR_CORRUPTION when it met a damaged header,
+ * which it reports as a corrupt block and skips the rest of its region
+ * after. Arena, segment, slab and handle objects are not visited.
+ */
+typedef struct heap_block_info {
+    void *ptr;    /* User pointer */
+    size_t size;  /* Usable bytes, 0 for a corrupt block */
+    bool free;    /* Freed, whether listed or still pending */
+    bool mapped;  /* Has a dedicated mapping */
+    bool corrupt; /* Header failed validation */
+} heap_block_info_t;
+
+typedef int (*heap_iterate_fn)(const heap_block_info_t *block, void *ctx);
+
+int heap_iterate(heap_iterate_fn callback, void *ctx);
 bool is_valid_heap_pointer(const void *ptr);
 void heap_consistency_check(void);
 void print_heap_layout(void);
 void print_free_list(void);
 
+/* Incremental Verification
+ *
+ * heap_verify_step() checks up to budget blocks and resumes where the
+ * previous call stopped, so a large heap can be verified a little at a
+ * time. Each block's header must be sound (magic, size alignment, free
+ * state), its size must lead to a valid neighbour or to the end of its
+ * region, and a block on the free list must be linked back by its list
+ * neighbours. Faults go to the error handler as ALLOC_ERROR_CORRUPTION.
+ * Returns 1 when the call completed a pass over the heap, else 0.
+ *
+ * The background verifier calls heap_verify_step() from an idle-priority
+ * thread, blocks_per_tick blocks every interval_ms milliseconds; a zero
+ * passed for either restores its default.
+ */
+typedef struct verify_stats {
+    size_t passes;         /* Complete passes over the heap */
+    size_t blocks_checked; /* Blocks examined by all steps */
+    size_t errors;         /* Faults found, reported or not */
+} verify_stats_t;
+
+int heap_verify_step(size_t budget);
+int allocator_set_background_verify(bool enabled); /* Disabled by default */
+void allocator_set_verify_rate(size_t blocks_per_tick, unsigned interval_ms);
+void allocator_verify_stats(verify_stats_t *stats);
+
+/* Heap Dump
+ *
+ * heap_dump() writes the allocator's metadata, never the payloads, to path
+ * for offline analysis with tools/heapview: a heap_dump_header_t followed
+ * by fixed-size records in host byte order. All region records come first,
+ * then one record per block as heap_iterate() visits them, then the free
+ * list in list order, and a HEAP_DUMP_END record last. Like heap_iterate()
+ * the dump runs alongside other threads, so it is a close approximation of
+ * one moment rather than an exact one. Returns 0, or -1 with errno set
+ * when the file cannot be written.
+ */
+#define HEAP_DUMP_MAGIC "HEAPDUMP"
+#define HEAP_DUMP_VERSION 1
+
+enum {
+    HEAP_DUMP_REGION = 1, /* address/size: range obtained from the system */
+    HEAP_DUMP_BLOCK,      /* address/size: user pointer and usable bytes */
+    HEAP_DUMP_FREE_LIST,  /* address/size: next block on the free list */
+    HEAP_DUMP_END
+};
+
+#define HEAP_DUMP_FLAG_FREE 0x01    /* Block is free */
+#define HEAP_DUMP_FLAG_MAPPED 0x02  /* Region or block is a dedicated mapping */
+#define HEAP_DUMP_FLAG_CORRUPT 0x04 /* Block header failed validation */
+
+typedef struct heap_dump_header {
+    char magic[8];            /* HEAP_DUMP_MAGIC, not NUL-terminated */
+    uint32_t version;         /* HEAP_DUMP_VERSION */
+    uint32_t record_size;     /* sizeof(heap_dump_record_t) */
+    uint64_t timestamp;       /* Seconds since the epoch */
+    uint64_t total_allocated; /* Heap statistics when the dump started */
+    uint64_t total_free;
+    uint64_t allocation_count;
+} heap_dump_header_t;
+
+typedef struct heap_dump_record {
+    uint64_t address;
+    uint64_t size;
+    uint32_t type;  /* HEAP_DUMP_* */
+    uint32_t flags; /* HEAP_DUMP_FLAG_* */
+} heap_dump_record_t;
+
+int heap_dump(const char *path);
+
+/* Heap Snapshots
+ *
+ * heap_snapshot() records the live bytes and objects of every power-of-two
+ * size class and every allocation tag, summed from per-thread counters the
+ * malloc() family keeps: no heap walk and no allocation, so it can run
+ * every minute in production. Class c holds objects of up to 1 << c usable
+ * bytes; tag 0, untagged, is never counted. Size classes only count objects
+ * allocated while allocator_set_heap_snapshots() has counting enabled,
+ * which costs each malloc() and free() a few counter updates; objects
+ * allocated while it was off stay uncounted even when freed later.
+ * heap_snapshot_diff() lists the classes and tags whose live bytes grew
+ * from a to b, largest growth first, writes at most max_entries of them to
+ * growth and returns how many it wrote.
+ */
+typedef struct heap_snapshot {
+    uint64_t timestamp_ns; /* CLOCK_MONOTONIC */
+    size_t live_bytes;     /* Sum over the size classes */
+    size_t live_objects;
+    size_t class_bytes[HEAP_SNAPSHOT_CLASSES];
+    size_t class_objects[HEAP_SNAPSHOT_CLASSES];
+    size_t tag_bytes[ALLOC_TAG_MAX];
+    size_t tag_objects[ALLOC_TAG_MAX];
+} heap_snapshot_t;
+
+typedef enum { HEAP_GROWTH_SIZE_CLASS, HEAP_GROWTH_TAG } heap_growth_kind_t;
+
+typedef struct heap_growth {
+    heap_growth_kind_t kind;
+    unsigned index;  /* Size class or tag */
+    int64_t bytes;   /* Live bytes in b minus live bytes in a */
+    int64_t objects; /* Live objects in b minus live objects in a */
+} heap_growth_t;
+
+void allocator_set_heap_snapshots(bool enabled); /* Disabled by default */
+void heap_snapshot(heap_snapshot_t *snapshot);
+size_t heap_snapshot_diff(const heap_snapshot_t *a,
+                          const heap_snapshot_t *b,
+                          heap_growth_t *growth,
+                          size_t max_entries);
+
 /* Error Handling */
 extern alloc_error_t last_error;
 const char *get_error_string(alloc_error_t error);
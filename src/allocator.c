@@ -9,10 +9,13 @@
  * - Thread safety via global mutex with thread-local cache optimization
  */
 
-#include "allocator.h"
+#define _GNU_SOURCE
+
+#include "allocator_internal.h"
 
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -41,21 +44,29 @@ heap_info_t heap = {0};
 bool allocator_initialized = false;
 alloc_error_t last_error = ALLOC_SUCCESS;
 __thread thread_cache_t *thread_cache = NULL;
+atomic_bool heap_multithreaded = false;
+
+/* is_free of a header absorbed by a merge into the block in front of it */
+#define BLOCK_MERGED 2
 
 /* Memory region tracking */
 typedef struct memory_region {
     void *start;
     size_t size;
+    size_t used;         /* sbrk: bytes carved into blocks once the pool has moved on */
+    size_t block_offset; /* mmap: where the block header sits in the mapping */
     bool is_mmap;
     struct memory_region *next;
 } memory_region_t;
 
 static memory_region_t *memory_regions = NULL;
+static memory_region_t *region_node_free = NULL; /* Recycled region descriptors */
 static pthread_mutex_t region_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 /* Memory sourcing pool for sbrk optimization */
 static void *heap_extension_pool = NULL;
 static size_t pool_remaining = 0;
+static memory_region_t *pool_region = NULL; /* sbrk region the pool lies in */
 static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 /* Memory statistics */
@@ -69,13 +80,16 @@ typedef struct {
 static memory_stats_t mem_stats = {0};
 
 /* Function prototypes for internal functions */
-static void register_memory_region(void *start, size_t size, bool is_mmap);
+static memory_region_t *register_memory_region(void *start, size_t size, bool is_mmap);
 static memory_region_t *find_memory_region(const void *ptr);
-static void unregister_memory_region(const void *start);
+static size_t unregister_memory_region(const void *start);
 static bool should_use_mmap_for_small_allocation(size_t size);
 static void handle_memory_acquisition_failure(void);
 static void trigger_emergency_cleanup(void);
 static bool validate_free_request(const block_t *block, const void *ptr);
+static void register_atfork_handlers(void);
+
+static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
 
 /* Allocator Initialization */
 int allocator_init(void)
@@ -104,6 +118,9 @@ int allocator_init(void)
     heap.heap_end = heap.program_break;
 
     allocator_initialized = true;
+
+    /* After initialization, as registering may allocate */
+    pthread_once(&atfork_once, register_atfork_handlers);
     return 0;
 }
 
@@ -112,16 +129,22 @@ void initialize_allocated_block(block_t *block, size_t size)
 {
     block->size = size;
     block->is_free = 0;
+    block->free_flags = 0;
     block->magic = MAGIC_NUMBER;
 
-    /* Free list pointers are undefined in allocated blocks */
-    /* They may be overwritten by user data */
+    /* Free list pointers share storage with the allocation metadata */
+    block->mapped_size = 0;
+    block->map_offset = 0;
+    block->arena_id = 0;
+    block->flags = 0;
+    block->tag = 0;
 }
 
 void initialize_free_block(block_t *block, size_t size)
 {
     block->size = size;
     block->is_free = 1;
+    block->free_flags = 0;
     block->magic = MAGIC_NUMBER;
 
     /* Initialize free list pointers to NULL */
@@ -180,14 +203,14 @@ bool blocks_are_adjacent(const block_t *first, const block_t *second)
     return expected_next == second;
 }
 
-/* Free List Management */
-void add_to_free_list(block_t *block)
+/* Free List Management
+ *
+ * The *_locked variants expect heap.heap_mutex to be held by the caller so
+ * that malloc() and batched frees can do all their list work in a single
+ * critical section.
+ */
+static void add_to_free_list_locked(block_t *block)
 {
-    if (!block || !block->is_free)
-        return;
-
-    pthread_mutex_lock(&heap.heap_mutex);
-
     /* Add to head of free list */
     block->prev_free = NULL;
     block->next_free = heap.free_head;
@@ -198,17 +221,10 @@ void add_to_free_list(block_t *block)
 
     heap.free_head = block;
     heap.total_free += block->size;
-
-    pthread_mutex_unlock(&heap.heap_mutex);
 }
 
-void remove_from_free_list(block_t *block)
+static void remove_from_free_list_locked(block_t *block)
 {
-    if (!block || !block->is_free)
-        return;
-
-    pthread_mutex_lock(&heap.heap_mutex);
-
     /* Update previous block's next pointer */
     if (block->prev_free) {
         block->prev_free->next_free = block->next_free;
@@ -227,28 +243,88 @@ void remove_from_free_list(block_t *block)
     /* Clear pointers */
     block->prev_free = NULL;
     block->next_free = NULL;
-
-    pthread_mutex_unlock(&heap.heap_mutex);
+    block->free_flags = 0;
 }
 
-block_t *find_free_block(size_t size)
+static block_t *find_free_block_locked(size_t size)
 {
-    pthread_mutex_lock(&heap.heap_mutex);
-
     /* First-fit search through free list */
     block_t *current = heap.free_head;
     while (current) {
         if (current->size >= size) {
-            pthread_mutex_unlock(&heap.heap_mutex);
             return current;
         }
         current = current->next_free;
     }
 
-    pthread_mutex_unlock(&heap.heap_mutex);
     return NULL;
 }
 
+void add_to_free_list(block_t *block)
+{
+    if (!block || !block->is_free)
+        return;
+
+    lock_mutex(&heap.heap_mutex);
+    add_to_free_list_locked(block);
+    unlock_mutex(&heap.heap_mutex);
+}
+
+void remove_from_free_list(block_t *block)
+{
+    if (!block || !block->is_free)
+        return;
+
+    lock_mutex(&heap.heap_mutex);
+    remove_from_free_list_locked(block);
+    unlock_mutex(&heap.heap_mutex);
+}
+
+block_t *find_free_block(size_t size)
+{
+    lock_mutex(&heap.heap_mutex);
+    block_t *block = find_free_block_locked(size);
+    unlock_mutex(&heap.heap_mutex);
+    return block;
+}
+
+/* Take up to max listed blocks whose pages have not been purged off the
+ * free list, so the caller can purge them without the heap lock. Blocks
+ * too small to hold a whole page are only marked. */
+size_t take_unpurged_free_blocks(block_t **blocks, size_t max)
+{
+    size_t count = 0;
+
+    lock_mutex(&heap.heap_mutex);
+    block_t *block = heap.free_head;
+    while (block && count < max) {
+        block_t *next = block->next_free;
+        if (block->free_flags & FREE_FLAG_PURGED) {
+            /* Already released */
+        } else if (block->size < ALLOC_PAGE_SIZE) {
+            block->free_flags |= FREE_FLAG_PURGED;
+        } else {
+            remove_from_free_list_locked(block);
+            blocks[count++] = block;
+        }
+        block = next;
+    }
+    unlock_mutex(&heap.heap_mutex);
+    return count;
+}
+
+/* Put purged blocks back on the free list, marked so they are skipped
+ * until they are allocated again */
+void list_purged_free_blocks(block_t **blocks, size_t count)
+{
+    lock_mutex(&heap.heap_mutex);
+    for (size_t i = 0; i < count; i++) {
+        add_to_free_list_locked(blocks[i]);
+        blocks[i]->free_flags |= FREE_FLAG_PURGED;
+    }
+    unlock_mutex(&heap.heap_mutex);
+}
+
 /* Block Splitting */
 bool can_split_block(const block_t *block, size_t needed_size)
 {
@@ -282,26 +358,249 @@ block_t *split_block(block_t *block, size_t size)
     return new_block;
 }
 
+/* Take a first-fit block off the free list, split off any excess and
+ * account it as allocated. Caller must hold heap.heap_mutex. */
+static block_t *take_free_block_locked(size_t size)
+{
+    block_t *block = find_free_block_locked(size);
+    if (!block)
+        return NULL;
+
+    uint16_t purged = block->free_flags & FREE_FLAG_PURGED;
+    remove_from_free_list_locked(block);
+
+    /* Split block if it's significantly larger */
+    if (can_split_block(block, size)) {
+        block_t *new_free_block = split_block(block, size);
+        if (new_free_block) {
+            /* Only its header page is written, which a purge keeps anyway */
+            new_free_block->free_flags = purged;
+            add_to_free_list_locked(new_free_block);
+        }
+    }
+
+    /* Initialize as allocated block */
+    initialize_allocated_block(block, block->size);
+    heap.total_allocated += block->size;
+    heap.allocation_count++;
+
+    return block;
+}
+
+/* Deferred Free Buffer
+ *
+ * free() of a small block only marks it free and appends it to a per-thread
+ * buffer. The buffer is returned to the heap under a single acquisition of
+ * heap.heap_mutex when it fills up, when malloc() misses on the free list, or
+ * when the thread exits. Entries are sorted by address first so physically
+ * adjacent blocks can be merged and the free list stays in address order.
+ *
+ * Blocks are marked free as soon as they enter the buffer so double frees are
+ * still caught immediately; statistics are updated at flush time.
+ */
+typedef struct deferred_free {
+    block_t *blocks[DEFERRED_FREE_CAPACITY];
+    int count;
+    unsigned epoch; /* pressure_epoch at the last flush */
+} deferred_free_t;
+
+static __thread deferred_free_t deferred_frees;
+static atomic_bool deferred_free_enabled = true;
+static pthread_key_t deferred_free_key;
+static pthread_once_t deferred_free_once = PTHREAD_ONCE_INIT;
+
+static void sort_blocks_by_address(block_t **blocks, int count)
+{
+    /* Bottom-up merge sort through a stack buffer; already ordered bursts,
+     * the common teardown case, are detected up front */
+    bool sorted = true;
+    for (int i = 1; i < count && sorted; i++) {
+        sorted = blocks[i - 1] < blocks[i];
+    }
+    if (sorted)
+        return;
+
+    block_t *buffer[DEFERRED_FREE_CAPACITY];
+    block_t **src = blocks;
+    block_t **dst = buffer;
+
+    for (int width = 1; width < count; width *= 2) {
+        for (int lo = 0; lo < count; lo += 2 * width) {
+            int mid = (lo + width < count) ? lo + width : count;
+            int hi = (lo + 2 * width < count) ? lo + 2 * width : count;
+            int i = lo;
+            int j = mid;
+            int k = lo;
+
+            while (i < mid && j < hi) {
+                dst[k++] = (src[j] < src[i]) ? src[j++] : src[i++];
+            }
+            while (i < mid) {
+                dst[k++] = src[i++];
+            }
+            while (j < hi) {
+                dst[k++] = src[j++];
+            }
+        }
+
+        block_t **tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+
+    if (src != blocks) {
+        memcpy(blocks, src, (size_t)count * sizeof(block_t *));
+    }
+}
+
+/* Large coalesced runs go to the reclaimer to have their pages purged; it
+ * puts them on the free list afterwards. Caller must hold heap.heap_mutex. */
+static void release_free_run_locked(block_t *run)
+{
+    initialize_free_block(run, run->size);
+
+    if (run->size >= RECLAIM_PURGE_THRESHOLD && reclaim_submit_purge(run)) {
+        return;
+    }
+
+    add_to_free_list_locked(run);
+}
+
+static void flush_deferred_frees(deferred_free_t *buffer)
+{
+    int count = buffer->count;
+    if (count == 0)
+        return;
+    buffer->count = 0;
+
+    sort_blocks_by_address(buffer->blocks, count);
+
+    lock_mutex(&heap.heap_mutex);
+
+    /* Only sbrk memory is contiguous, so merges are limited to the sbrk heap */
+    const char *sbrk_start = (const char *)heap.heap_start;
+    const char *sbrk_end = (const char *)heap.heap_end;
+
+    /* Walk from the highest address down, so the lowest address ends up at
+     * the head of the free list and first-fit prefers low memory */
+    block_t *run = buffer->blocks[count - 1];
+    heap.total_allocated -= run->size;
+    heap.allocation_count--;
+
+    for (int i = count - 2; i >= 0; i--) {
+        block_t *block = buffer->blocks[i];
+        heap.total_allocated -= block->size;
+        heap.allocation_count--;
+
+        if (get_next_block(block) == run && (const char *)block >= sbrk_start &&
+            (const char *)run < sbrk_end) {
+            block->size += HEADER_SIZE + run->size;
+            run->is_free = BLOCK_MERGED;
+        } else {
+            release_free_run_locked(run);
+        }
+        run = block;
+    }
+    release_free_run_locked(run);
+
+    unlock_mutex(&heap.heap_mutex);
+}
+
+static void deferred_free_thread_exit(void *arg)
+{
+    flush_deferred_frees((deferred_free_t *)arg);
+}
+
+static void deferred_free_key_init(void)
+{
+    pthread_key_create(&deferred_free_key, deferred_free_thread_exit);
+}
+
+static void defer_free(block_t *block)
+{
+    deferred_free_t *buffer = &deferred_frees;
+
+    if (UNLIKELY(buffer->count == 0)) {
+        /* Register the exit hook so a thread never leaks its pending frees */
+        pthread_once(&deferred_free_once, deferred_free_key_init);
+        pthread_setspecific(deferred_free_key, buffer);
+    }
+
+    block->is_free = 1;
+    buffer->blocks[buffer->count++] = block;
+
+    /* Under memory pressure, pending frees go back right away */
+    unsigned epoch = atomic_load_explicit(&pressure_epoch, memory_order_relaxed);
+    if (buffer->count == DEFERRED_FREE_CAPACITY || UNLIKELY(epoch != buffer->epoch)) {
+        buffer->epoch = epoch;
+        flush_deferred_frees(buffer);
+    }
+}
+
+// cppcheck-suppress unusedFunction
+void allocator_flush_deferred_frees(void)
+{
+    flush_deferred_frees(&deferred_frees);
+}
+
+// cppcheck-suppress unusedFunction
+void allocator_set_deferred_free(bool enabled)
+{
+    if (!enabled) {
+        flush_deferred_frees(&deferred_frees);
+    }
+    atomic_store_explicit(&deferred_free_enabled, enabled, memory_order_relaxed);
+}
+
 /* Memory Region Tracking */
-static void register_memory_region(void *start, size_t size, bool is_mmap)
+
+/* Region descriptors are carved from dedicated pages rather than malloc(),
+ * since registration happens in the middle of an allocation.
+ * Caller must hold region_mutex. */
+static memory_region_t *alloc_region_node(void)
+{
+    if (!region_node_free) {
+        size_t page_size = 4096;
+        memory_region_t *page = mmap(
+            NULL, page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (page == MAP_FAILED)
+            return NULL;
+
+        for (size_t i = 0; i < page_size / sizeof(memory_region_t); i++) {
+            page[i].next = region_node_free;
+            region_node_free = &page[i];
+        }
+    }
+
+    memory_region_t *node = region_node_free;
+    region_node_free = node->next;
+    return node;
+}
+
+static memory_region_t *register_memory_region(void *start, size_t size, bool is_mmap)
 {
-    memory_region_t *region = malloc(sizeof(memory_region_t));
-    if (!region)
-        return; /* Best effort tracking */
+    lock_mutex(&region_mutex);
+
+    memory_region_t *region = alloc_region_node();
+    if (!region) {
+        unlock_mutex(&region_mutex);
+        return NULL; /* Best effort tracking */
+    }
 
     region->start = start;
     region->size = size;
+    region->used = size;
+    region->block_offset = 0;
     region->is_mmap = is_mmap;
-
-    pthread_mutex_lock(&region_mutex);
     region->next = memory_regions;
     memory_regions = region;
-    pthread_mutex_unlock(&region_mutex);
+    unlock_mutex(&region_mutex);
+    return region;
 }
 
 static memory_region_t *find_memory_region(const void *ptr)
 {
-    pthread_mutex_lock(&region_mutex);
+    lock_mutex(&region_mutex);
 
     memory_region_t *current = memory_regions;
     while (current) {
@@ -309,47 +608,77 @@ static memory_region_t *find_memory_region(const void *ptr)
         char *end = start + current->size;
 
         if (ptr >= current->start && ptr < (void *)end) {
-            pthread_mutex_unlock(&region_mutex);
+            unlock_mutex(&region_mutex);
             return current;
         }
         current = current->next;
     }
 
-    pthread_mutex_unlock(&region_mutex);
+    unlock_mutex(&region_mutex);
     return NULL;
 }
 
-static void unregister_memory_region(const void *start)
+/* Record where the header of the block in a dedicated mapping went */
+static void set_mapped_block_offset(const void *start, size_t offset)
+{
+    lock_mutex(&region_mutex);
+    for (memory_region_t *region = memory_regions; region; region = region->next) {
+        if (region->start == start && region->is_mmap) {
+            region->block_offset = offset;
+            break;
+        }
+    }
+    unlock_mutex(&region_mutex);
+}
+
+/* Unlink the mmap region starting at start; returns its size or 0 */
+static size_t unregister_memory_region(const void *start)
 {
-    pthread_mutex_lock(&region_mutex);
+    size_t size = 0;
+
+    lock_mutex(&region_mutex);
 
     memory_region_t **current = &memory_regions;
     while (*current) {
-        if ((*current)->start == start) {
+        if ((*current)->start == start && (*current)->is_mmap) {
             memory_region_t *to_remove = *current;
+            size = to_remove->size;
             *current = (*current)->next;
-            free(to_remove);
+            to_remove->next = region_node_free;
+            region_node_free = to_remove;
             break;
         }
         current = &(*current)->next;
     }
 
-    pthread_mutex_unlock(&region_mutex);
+    unlock_mutex(&region_mutex);
+    return size;
 }
 
 /* Memory Sourcing Implementation */
+
+/* New memory carries a block header before anyone else can see it, so
+ * heap_iterate() never reads one that is not yet written */
+static void write_provisional_header(void *memory, size_t size)
+{
+    if (size >= HEADER_SIZE) {
+        initialize_allocated_block((block_t *)memory, size - HEADER_SIZE);
+    }
+}
+
 void *acquire_memory_sbrk(size_t size)
 {
     size_t aligned_size = ALIGN_SIZE(size);
 
-    pthread_mutex_lock(&pool_mutex);
+    lock_mutex(&pool_mutex);
 
     /* Try to satisfy request from existing pool */
     if (heap_extension_pool && pool_remaining >= aligned_size) {
         void *result = heap_extension_pool;
         heap_extension_pool = (char *)heap_extension_pool + aligned_size;
         pool_remaining -= aligned_size;
-        pthread_mutex_unlock(&pool_mutex);
+        write_provisional_header(result, aligned_size);
+        unlock_mutex(&pool_mutex);
         return result;
     }
 
@@ -364,36 +693,56 @@ void *acquire_memory_sbrk(size_t size)
 #endif
     /* NOLINTNEXTLINE(performance-no-int-to-ptr) - sbrk returns (void *)-1 on error */
     if (new_memory == (void *)(intptr_t)-1) {
-        pthread_mutex_unlock(&pool_mutex);
+        unlock_mutex(&pool_mutex);
         last_error = ALLOC_ERROR_OUT_OF_MEMORY;
         handle_memory_acquisition_failure();
         return NULL;
     }
 
     /* Update global heap information */
-    pthread_mutex_lock(&heap.heap_mutex);
+    lock_mutex(&heap.heap_mutex);
     if (heap.heap_start == NULL) {
         heap.heap_start = new_memory;
     }
     heap.heap_end = (char *)new_memory + extension_size;
-    pthread_mutex_unlock(&heap.heap_mutex);
+    unlock_mutex(&heap.heap_mutex);
+
+    void *result;
+    if (pool_region && (char *)heap_extension_pool + pool_remaining == (char *)new_memory) {
+        /* The break moved on from the end of the pool: keep carving from
+         * the pool, so the region stays one unbroken run of blocks */
+        result = heap_extension_pool;
+        heap_extension_pool = (char *)heap_extension_pool + aligned_size;
+        pool_remaining += extension_size - aligned_size;
 
-    /* Initialize pool with remaining memory */
-    void *result = new_memory;
-    heap_extension_pool = (char *)new_memory + aligned_size;
-    pool_remaining = extension_size - aligned_size;
+        lock_mutex(&region_mutex);
+        pool_region->size += extension_size;
+        pool_region->used = pool_region->size;
+        unlock_mutex(&region_mutex);
+    } else {
+        /* Blocks in the abandoned pool's region end where the pool began */
+        if (pool_region) {
+            lock_mutex(&region_mutex);
+            pool_region->used = (size_t)((char *)heap_extension_pool - (char *)pool_region->start);
+            unlock_mutex(&region_mutex);
+        }
 
-    register_memory_region(new_memory, extension_size, false);
+        /* Initialize pool with remaining memory */
+        result = new_memory;
+        heap_extension_pool = (char *)new_memory + aligned_size;
+        pool_remaining = extension_size - aligned_size;
+        pool_region = register_memory_region(new_memory, extension_size, false);
+    }
+    write_provisional_header(result, aligned_size);
 
-    pthread_mutex_unlock(&pool_mutex);
+    unlock_mutex(&pool_mutex);
     return result;
 }
 
 void *acquire_memory_mmap(size_t size)
 {
     /* Round up to page boundary for mmap efficiency */
-    size_t page_size = 4096; /* Assume 4KB pages */
-    size_t page_aligned_size = ((size + page_size - 1) / page_size) * page_size;
+    size_t page_aligned_size = PAGE_ALIGN(size);
 
     /* Create anonymous memory mapping */
     void *ptr =
@@ -414,6 +763,8 @@ void *acquire_memory_mmap(size_t size)
         return NULL;
     }
 
+    write_provisional_header(ptr, page_aligned_size);
+    ((block_t *)ptr)->mapped_size = page_aligned_size;
     register_memory_region(ptr, page_aligned_size, true);
     return ptr;
 }
@@ -425,41 +776,46 @@ int release_memory_mmap(void *ptr, size_t size)
     if (!ptr)
         return -1;
 
-    memory_region_t *region = find_memory_region(ptr);
-    if (!region || !region->is_mmap) {
+    /* Stop tracking first, so a new mapping that reuses this address
+     * range cannot be unregistered by mistake */
+    size_t region_size = unregister_memory_region(ptr);
+    if (region_size == 0) {
         last_error = ALLOC_ERROR_INVALID_POINTER;
         return -1;
     }
 
-    if (munmap(ptr, region->size) == -1) {
+    if (munmap(ptr, region_size) == -1) {
         return -1;
     }
 
-    unregister_memory_region(ptr);
     return 0;
 }
 
 static bool should_use_mmap_for_small_allocation(size_t size)
 {
     (void)size; /* Suppress unused parameter warning */
-    pthread_mutex_lock(&heap.heap_mutex);
+    lock_mutex(&heap.heap_mutex);
 
     /* Check fragmentation ratio */
     if (heap.total_free > 0) {
         double fragmentation_ratio =
             (double)heap.total_free / (double)(heap.total_allocated + heap.total_free);
         if (fragmentation_ratio > 0.3) { /* >30% fragmentation */
-            pthread_mutex_unlock(&heap.heap_mutex);
+            unlock_mutex(&heap.heap_mutex);
             return true;
         }
     }
 
-    pthread_mutex_unlock(&heap.heap_mutex);
+    unlock_mutex(&heap.heap_mutex);
     return false;
 }
 
-void *acquire_memory(size_t size)
+/* Returns new memory for a block; *mapped_size is set to the mapping length
+ * when the block gets a dedicated mmap, or 0 when it comes from sbrk */
+static void *acquire_memory(size_t size, size_t *mapped_size)
 {
+    *mapped_size = 0;
+
     if (size == 0) {
         last_error = ALLOC_ERROR_INVALID_SIZE;
         return NULL;
@@ -467,26 +823,101 @@ void *acquire_memory(size_t size)
 
     size_t aligned_size = ALIGN_SIZE(size);
 
-#ifdef __APPLE__
-    /* On macOS, use mmap for all allocations due to sbrk deprecation */
-    return acquire_memory_mmap(aligned_size);
-#else
-    /* Large allocations use mmap */
-    if (aligned_size >= MMAP_THRESHOLD) {
-        return acquire_memory_mmap(aligned_size);
+#ifndef __APPLE__
+    /* Small allocations use sbrk unless the heap is badly fragmented */
+    if (aligned_size < MMAP_THRESHOLD && !should_use_mmap_for_small_allocation(aligned_size)) {
+        return acquire_memory_sbrk(aligned_size);
     }
+#endif
 
-    /* Check if we should use mmap for small allocation */
-    if (should_use_mmap_for_small_allocation(aligned_size)) {
-        return acquire_memory_mmap(aligned_size);
+    /* Large allocations use mmap (as does everything on macOS, where sbrk
+     * is deprecated) */
+    void *memory = acquire_memory_mmap(aligned_size);
+    if (memory) {
+        *mapped_size = PAGE_ALIGN(aligned_size);
     }
+    return memory;
+}
 
-    return acquire_memory_sbrk(aligned_size);
-#endif
+/* Return a block with a dedicated mapping to the kernel, through the
+ * reclaimer thread when it is running. Aligned blocks may start past the
+ * beginning of their mapping; map_offset leads back to it. */
+static void release_mapped_block(block_t *block)
+{
+    size_t mapped_size = block->mapped_size;
+    char *start = (char *)block - block->map_offset;
+
+    lock_mutex(&heap.heap_mutex);
+    heap.total_allocated -= block->size;
+    heap.allocation_count--;
+    unlock_mutex(&heap.heap_mutex);
+
+    /* Keep double frees detectable until the pages are actually gone */
+    block->is_free = 1;
+
+    if (!reclaim_submit_unmap(start, mapped_size)) {
+        release_memory_mmap(start, mapped_size);
+    }
+}
+
+/* Per-Thread Byte Counters
+ *
+ * Cumulative usable bytes the calling thread has allocated and freed through
+ * the malloc() family, read through allocator_thread_allocatedp() and
+ * allocator_thread_deallocatedp(). Only the owning thread writes them, so
+ * they are plain increments; other threads may read a slightly stale value.
+ * In-place resizing counts as freeing the old size and allocating the new.
+ * Initial-exec TLS keeps the update to one add at a fixed offset from the
+ * thread pointer, even when the allocator is a shared object.
+ */
+static __thread uint64_t thread_allocated __attribute__((tls_model("initial-exec")));
+static __thread uint64_t thread_deallocated __attribute__((tls_model("initial-exec")));
+
+/* Charge a new object to the calling thread, its size class and its tag */
+static inline void *count_allocation(void *ptr)
+{
+    if (!ptr)
+        return NULL;
+
+    size_t size;
+    uint16_t tag;
+    if (is_headerless(ptr)) {
+        size = headerless_usable_size(ptr);
+        tag = headerless_tag(ptr);
+    } else {
+        block_t *block = get_block_from_ptr(ptr);
+        size = block->size;
+        tag = tag_for_allocation();
+        block->tag = tag;
+    }
+    thread_allocated += size;
+    tag_record_alloc(tag, size);
+    return ptr;
+}
+
+static inline void count_free(uint16_t tag, size_t size)
+{
+    thread_deallocated += size;
+    tag_record_free(tag, size);
+}
+
+// cppcheck-suppress unusedFunction
+const uint64_t *allocator_thread_allocatedp(void)
+{
+    return &thread_allocated;
+}
+
+// cppcheck-suppress unusedFunction
+const uint64_t *allocator_thread_deallocatedp(void)
+{
+    return &thread_deallocated;
 }
 
 /* Standard Allocator Interface */
-void *malloc(size_t size)
+
+/* malloc() proper, returning the block so internal callers can inspect its
+ * header without going back through the user pointer */
+block_t *allocate_block(size_t size)
 {
     /* Initialize allocator on first use */
     if (!allocator_initialized) {
@@ -499,39 +930,38 @@ void *malloc(size_t size)
         return NULL; /* Standard behavior */
     }
 
+    /* Reject sizes that would wrap around once aligned and given a header */
+    if (size > SIZE_MAX - HEADER_SIZE - ALIGNMENT) {
+        last_error = ALLOC_ERROR_INVALID_SIZE;
+        return NULL;
+    }
+
     /* Ensure minimum allocation size */
     size_t actual_size = (size < MIN_ALLOC_SIZE) ? MIN_ALLOC_SIZE : size;
     size_t aligned_size = ALIGN_SIZE(actual_size);
 
     /* Try to find suitable free block */
-    block_t *block = find_free_block(aligned_size);
-
-    if (block) {
-        /* Remove from free list */
-        remove_from_free_list(block);
-
-        /* Split block if it's significantly larger */
-        if (can_split_block(block, aligned_size)) {
-            block_t *new_free_block = split_block(block, aligned_size);
-            if (new_free_block) {
-                add_to_free_list(new_free_block);
-            }
-        }
+    lock_mutex(&heap.heap_mutex);
+    block_t *block = take_free_block_locked(aligned_size);
+    unlock_mutex(&heap.heap_mutex);
 
-        /* Initialize as allocated block */
-        initialize_allocated_block(block, aligned_size);
+    /* Slow path: return this thread's pending frees and search again */
+    if (!block && deferred_frees.count > 0) {
+        flush_deferred_frees(&deferred_frees);
 
-        pthread_mutex_lock(&heap.heap_mutex);
-        heap.total_allocated += aligned_size;
-        heap.allocation_count++;
-        pthread_mutex_unlock(&heap.heap_mutex);
+        lock_mutex(&heap.heap_mutex);
+        block = take_free_block_locked(aligned_size);
+        unlock_mutex(&heap.heap_mutex);
+    }
 
-        return get_ptr_from_block(block);
+    if (block) {
+        return block;
     }
 
     /* No suitable free block - acquire new memory */
     size_t total_size = HEADER_SIZE + aligned_size;
-    void *memory = acquire_memory(total_size);
+    size_t mapped_size;
+    void *memory = acquire_memory(total_size, &mapped_size);
 
     if (!memory) {
         return NULL;
@@ -540,20 +970,51 @@ void *malloc(size_t size)
     /* Initialize block in new memory */
     block = (block_t *)memory;
     initialize_allocated_block(block, aligned_size);
+    block->mapped_size = mapped_size;
 
-    pthread_mutex_lock(&heap.heap_mutex);
+    lock_mutex(&heap.heap_mutex);
     heap.total_allocated += aligned_size;
     heap.allocation_count++;
-    pthread_mutex_unlock(&heap.heap_mutex);
+    unlock_mutex(&heap.heap_mutex);
 
-    return get_ptr_from_block(block);
+    return block;
 }
 
-void free(void *ptr)
+void *malloc(size_t size)
+{
+    if (UNLIKELY(lifetime_prediction_active())) {
+        return count_allocation(lifetime_malloc(size, __builtin_return_address(0)));
+    }
+
+    void *ptr = headerless_alloc(size);
+    if (!ptr) {
+        ptr = get_ptr_from_block(allocate_block(size));
+    }
+    return count_allocation(ptr);
+}
+
+/* free(), counting the bytes against the calling thread when counted is set */
+static inline void release_object(void *ptr, bool counted)
 {
     if (!ptr)
         return;
 
+    /* Segment and slab objects have no header; the address alone locates them */
+    if (segment_owns(ptr)) {
+        if (counted) {
+            count_free(segment_tag(ptr), segment_usable_size(ptr));
+        }
+        segment_free(ptr);
+        return;
+    }
+    if (slab_owns(ptr)) {
+        if (counted) {
+            count_free(slab_tag(ptr), slab_usable_size(ptr));
+        }
+        slab_free(ptr);
+        return;
+    }
+
     /* Get block header */
     block_t *block = get_block_from_ptr(ptr);
 
@@ -572,16 +1033,55 @@ void free(void *ptr)
     if (!validate_free_request(block, ptr)) {
         return;
     }
+    if (counted) {
+        count_free(block->tag, block->size);
+    }
+
+    if (UNLIKELY(block->flags & BLOCK_FLAG_SAMPLED)) {
+        lifetime_record_free(block);
+    }
+
+    /* Arena objects go back to their chunk */
+    if (block->arena_id != 0) {
+        arena_free_block(block);
+        return;
+    }
+
+    /* Dedicated mappings go back to the kernel instead of the free list */
+    if (block->mapped_size != 0) {
+        release_mapped_block(block);
+        return;
+    }
+
+    /* Small blocks are batched; large ones and blocks allocated with
+     * MALLOCX_TCACHE_NONE go straight back to the heap */
+    if (block->size < MMAP_THRESHOLD && !(block->flags & BLOCK_FLAG_NO_TCACHE) &&
+        atomic_load_explicit(&deferred_free_enabled, memory_order_relaxed)) {
+        defer_free(block);
+        return;
+    }
+
+    lock_mutex(&heap.heap_mutex);
 
     /* Update statistics */
-    pthread_mutex_lock(&heap.heap_mutex);
     heap.total_allocated -= block->size;
     heap.allocation_count--;
-    pthread_mutex_unlock(&heap.heap_mutex);
 
     /* Convert to free block and add to free list */
     initialize_free_block(block, block->size);
-    add_to_free_list(block);
+    add_to_free_list_locked(block);
+
+    unlock_mutex(&heap.heap_mutex);
+}
+
+void free(void *ptr)
+{
+    release_object(ptr, true);
+}
+
+void free_uncounted(void *ptr)
+{
+    release_object(ptr, false);
 }
 
 // cppcheck-suppress unusedFunction
@@ -594,13 +1094,31 @@ void *calloc(size_t nmemb, size_t size)
     }
 
     size_t total_size = nmemb * size;
-    void *ptr = malloc(total_size);
 
+    /* Large requests may find a chunk the background thread already cleared */
+    void *ptr = zero_pool_take(total_size);
     if (ptr) {
-        memset(ptr, 0, total_size);
+        return count_allocation(ptr);
     }
 
-    return ptr;
+    ptr = headerless_alloc(total_size);
+    if (ptr) {
+        allocator_zero(ptr, total_size);
+        return count_allocation(ptr);
+    }
+
+    block_t *block = allocate_block(total_size);
+    if (!block) {
+        return NULL;
+    }
+
+    /* Dedicated mappings are never reused, so they are still zero-filled */
+    ptr = get_ptr_from_block(block);
+    if (block->mapped_size == 0) {
+        allocator_zero(ptr, total_size);
+    }
+
+    return count_allocation(ptr);
 }
 
 // cppcheck-suppress unusedFunction
@@ -615,13 +1133,19 @@ void *realloc(void *ptr, size_t size)
         return NULL;
     }
 
-    block_t *block = get_block_from_ptr(ptr);
-    if (verify_block_integrity(block) != BLOCK_VALID) {
-        last_error = ALLOC_ERROR_CORRUPTION;
-        return NULL;
+    size_t current_size;
+    unsigned arena = 0;
+    if (is_headerless(ptr)) {
+        current_size = headerless_usable_size(ptr);
+    } else {
+        block_t *block = get_block_from_ptr(ptr);
+        if (verify_block_integrity(block) != BLOCK_VALID) {
+            last_error = ALLOC_ERROR_CORRUPTION;
+            return NULL;
+        }
+        current_size = block->size;
+        arena = block->arena_id;
     }
-
-    size_t current_size = block->size;
     size_t new_size = ALIGN_SIZE(size);
 
     /* If new size fits in current block, just return */
@@ -629,19 +1153,478 @@ void *realloc(void *ptr, size_t size)
         return ptr;
     }
 
-    /* Need to allocate new block */
-    void *new_ptr = malloc(size);
+    /* Need to allocate new block, from the same arena if there was one */
+    void *new_ptr = arena ? mallocx(size, MALLOCX_ARENA(arena)) : malloc(size);
     if (!new_ptr) {
         return NULL;
     }
 
     /* Copy data and free old block */
-    memcpy(new_ptr, ptr, current_size);
+    allocator_copy(new_ptr, ptr, current_size);
     free(ptr);
 
     return new_ptr;
 }
 
+/* Extended Interface */
+
+#define MALLOCX_LG_ALIGN_MASK 0x3f
+#define MALLOCX_LG_ALIGN_MAX 30 /* map_offset is 32 bits wide */
+#define MALLOCX_ARENA_SHIFT 20
+
+/* Returns the requested alignment, or 0 when it is not supported */
+static size_t mallocx_alignment(int flags)
+{
+    int lg_align = flags & MALLOCX_LG_ALIGN_MASK;
+    if (lg_align > MALLOCX_LG_ALIGN_MAX)
+        return 0;
+    return ((size_t)1 << lg_align) < ALIGNMENT ? ALIGNMENT : (size_t)1 << lg_align;
+}
+
+/* Returns the requested arena, or -1 when the flags name none */
+static int mallocx_arena(int flags)
+{
+    return (int)((unsigned)flags >> MALLOCX_ARENA_SHIFT) - 1;
+}
+
+/* Split a heap block down to size bytes and free the remainder */
+static void shrink_heap_block(block_t *block, size_t size)
+{
+    /* Headers only change under the heap lock, for heap_iterate() */
+    lock_mutex(&heap.heap_mutex);
+    block_t *rest = split_block(block, size);
+    if (rest) {
+        /* The remainder is accounted as an allocation of its own so free()
+         * can take it through the normal path */
+        initialize_allocated_block(rest, rest->size);
+        heap.total_allocated -= HEADER_SIZE;
+        heap.allocation_count++;
+    }
+    unlock_mutex(&heap.heap_mutex);
+
+    if (rest) {
+        free_uncounted(get_ptr_from_block(rest));
+    }
+}
+
+/* allocate_block() for alignments above ALIGNMENT: over-allocate, then give
+ * back the padding in front of the aligned address and any excess behind */
+static block_t *allocate_aligned_block(size_t size, size_t alignment)
+{
+    if (alignment <= ALIGNMENT)
+        return allocate_block(size);
+
+    if (size > SIZE_MAX - HEADER_SIZE - 2 * ALIGNMENT - alignment - MIN_BLOCK_SIZE) {
+        last_error = ALLOC_ERROR_INVALID_SIZE;
+        return NULL;
+    }
+
+    size_t actual_size = (size < MIN_ALLOC_SIZE) ? MIN_ALLOC_SIZE : size;
+    size_t aligned_size = ALIGN_SIZE(actual_size);
+    block_t *block = allocate_block(aligned_size + alignment + MIN_BLOCK_SIZE);
+    if (!block)
+        return NULL;
+
+    /* The padding must be large enough to become a block of its own */
+    uintptr_t user = (uintptr_t)get_ptr_from_block(block);
+    uintptr_t aligned = (user + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    if (aligned != user && aligned - user < MIN_BLOCK_SIZE) {
+        aligned += alignment;
+    }
+
+    if (aligned != user) {
+        block_t *front = block;
+        block = get_block_from_ptr((void *)aligned);
+        size_t front_size = (size_t)((char *)block - (char *)front) - HEADER_SIZE;
+        size_t old_size = front->size;
+
+        lock_mutex(&heap.heap_mutex);
+        initialize_allocated_block(block, old_size - front_size - HEADER_SIZE);
+
+        if (front->mapped_size != 0) {
+            /* A mapping is released whole, so only the header moves */
+            block->mapped_size = front->mapped_size;
+            block->map_offset = (uint32_t)((char *)block - (char *)front);
+            heap.total_allocated -= old_size - block->size;
+            unlock_mutex(&heap.heap_mutex);
+
+            set_mapped_block_offset(front, block->map_offset);
+            return block;
+        }
+
+        front->size = front_size;
+        heap.total_allocated -= HEADER_SIZE;
+        heap.allocation_count++;
+        unlock_mutex(&heap.heap_mutex);
+        free_uncounted(get_ptr_from_block(front));
+    }
+
+    if (block->mapped_size == 0) {
+        shrink_heap_block(block, aligned_size);
+    }
+    return block;
+}
+
+/* A free block that is on the free list, as opposed to one waiting in a
+ * deferred free buffer or in the reclaimer's queue. Caller must hold
+ * heap.heap_mutex. */
+static bool is_listed_free_block_locked(const block_t *block)
+{
+    if (block->magic != MAGIC_NUMBER || block->is_free != 1)
+        return false;
+    return block->prev_free ? block->prev_free->next_free == block : heap.free_head == block;
+}
+
+/* Grow a heap block in place into the free block or unused sbrk pool space
+ * right behind it, taking up to max_size bytes in total. Returns true when
+ * the block ends up with at least min_size bytes. */
+static bool grow_heap_block(block_t *block, size_t min_size, size_t max_size)
+{
+    /* Only look behind the block when a whole header there is ours to read */
+    char *next_addr = (char *)get_next_block(block);
+    const memory_region_t *region = find_memory_region(next_addr);
+    if (!region || region->is_mmap ||
+        next_addr + HEADER_SIZE > (char *)region->start + region->size) {
+        return false;
+    }
+
+    lock_mutex(&pool_mutex);
+    lock_mutex(&heap.heap_mutex);
+
+    size_t old_size = block->size;
+    block_t *next = (block_t *)next_addr;
+
+    if (next_addr == (char *)heap_extension_pool) {
+        /* Last block before the pool: extend it with fresh pool space */
+        size_t take = max_size - old_size;
+        if (take > pool_remaining) {
+            take = pool_remaining;
+        }
+        if (old_size + take >= min_size) {
+            heap_extension_pool = (char *)heap_extension_pool + take;
+            pool_remaining -= take;
+            block->size += take;
+        }
+    } else if (is_listed_free_block_locked(next) &&
+               old_size + HEADER_SIZE + next->size >= min_size) {
+        remove_from_free_list_locked(next);
+        block->size += HEADER_SIZE + next->size;
+        next->is_free = BLOCK_MERGED;
+
+        block_t *rest = split_block(block, max_size);
+        if (rest) {
+            add_to_free_list_locked(rest);
+        }
+    }
+
+    heap.total_allocated += block->size - old_size;
+
+    unlock_mutex(&heap.heap_mutex);
+    unlock_mutex(&pool_mutex);
+
+    return block->size >= min_size;
+}
+
+// cppcheck-suppress unusedFunction
+void *mallocx(size_t size, int flags)
+{
+    size_t alignment = mallocx_alignment(flags);
+    int arena = mallocx_arena(flags);
+    bool tcache = !(flags & MALLOCX_TCACHE_NONE);
+
+    if (size == 0 || alignment == 0 || (arena > 0 && !arena_exists((unsigned)arena))) {
+        last_error = ALLOC_ERROR_INVALID_SIZE;
+        return NULL;
+    }
+
+    if (flags == 0 && UNLIKELY(lifetime_prediction_active())) {
+        return count_allocation(lifetime_malloc(size, __builtin_return_address(0)));
+    }
+
+    /* Hinted objects share an arena per hint; without one, use the heap */
+    if (arena < 0 && (flags & ALLOC_HINT_COLD)) {
+        arena = allocator_hint_arena(flags & ALLOC_HINT_COLD);
+        if (arena < 0) {
+            arena = 0;
+        }
+    }
+
+    void *ptr = NULL;
+    bool zeroed = false;
+
+    /* The per-thread and headerless paths serve the default arena only. Segment
+     * and slab classes are powers of two, objects aligned to the class size. */
+    if (arena < 0 && tcache) {
+        if ((flags & MALLOCX_ZERO) && alignment == ALIGNMENT) {
+            ptr = zero_pool_take(size);
+            zeroed = ptr != NULL;
+        }
+        if (!ptr && alignment <= SMALL_OBJECT_MAX) {
+            ptr = headerless_alloc(size < alignment ? alignment : size);
+        }
+    }
+
+    if (!ptr) {
+        block_t *block = NULL;
+        if (arena > 0) {
+            block = arena_allocate_block((unsigned)arena, size, alignment);
+        }
+        if (!block) {
+            block = allocate_aligned_block(size, alignment);
+        }
+        if (!block)
+            return NULL;
+
+        if (!tcache) {
+            block->flags |= BLOCK_FLAG_NO_TCACHE;
+        }
+        ptr = get_ptr_from_block(block);
+
+        /* Dedicated mappings are never reused, so they are still zero-filled */
+        zeroed = block->mapped_size != 0;
+    }
+
+    /* Zero the whole usable size so later in-place growth stays zeroed */
+    if ((flags & MALLOCX_ZERO) && !zeroed) {
+        allocator_zero(ptr, malloc_usable_size(ptr));
+    }
+    return count_allocation(ptr);
+}
+
+// cppcheck-suppress unusedFunction
+void *rallocx(void *ptr, size_t size, int flags)
+{
+    if (!ptr) {
+        return mallocx(size, flags);
+    }
+
+    size_t alignment = mallocx_alignment(flags);
+    int arena = mallocx_arena(flags);
+    if (size == 0 || alignment == 0) {
+        last_error = ALLOC_ERROR_INVALID_SIZE;
+        return NULL;
+    }
+
+    size_t old_size = malloc_usable_size(ptr);
+    if (old_size == 0) {
+        last_error = ALLOC_ERROR_INVALID_POINTER;
+        return NULL;
+    }
+
+    /* Stay in place when the object already satisfies the flags */
+    int current_arena = is_headerless(ptr) ? 0 : get_block_from_ptr(ptr)->arena_id;
+    if ((uintptr_t)ptr % alignment == 0 && (arena < 0 || arena == current_arena) &&
+        xallocx(ptr, size, 0, flags) >= size) {
+        return ptr;
+    }
+
+    /* Moving keeps the arena unless the flags name another one */
+    if (arena < 0 && current_arena > 0) {
+        flags |= MALLOCX_ARENA(current_arena);
+    }
+    void *new_ptr = mallocx(size, flags);
+    if (!new_ptr) {
+        return NULL;
+    }
+
+    allocator_copy(new_ptr, ptr, old_size < size ? old_size : size);
+    free(ptr);
+    return new_ptr;
+}
+
+// cppcheck-suppress unusedFunction
+size_t xallocx(void *ptr, size_t size, size_t extra, int flags)
+{
+    if (!ptr)
+        return 0;
+
+    /* Segment and slab objects are stuck with their size class */
+    if (is_headerless(ptr)) {
+        return headerless_usable_size(ptr);
+    }
+
+    block_t *block = get_block_from_ptr(ptr);
+    if (verify_block_integrity(block) != BLOCK_VALID || block->is_free) {
+        last_error = ALLOC_ERROR_CORRUPTION;
+        return 0;
+    }
+
+    size_t old_size = block->size;
+    size_t limit = SIZE_MAX - HEADER_SIZE - 2 * ALIGNMENT;
+    if (size > limit) {
+        return old_size;
+    }
+    size_t target = (extra > limit - size) ? limit : size + extra;
+    size_t min_size = ALIGN_SIZE(size < MIN_ALLOC_SIZE ? MIN_ALLOC_SIZE : size);
+    size_t max_size = ALIGN_SIZE(target < MIN_ALLOC_SIZE ? MIN_ALLOC_SIZE : target);
+
+    if (max_size < old_size) {
+        if (block->arena_id != 0) {
+            arena_shrink_block(block, max_size);
+        } else if (block->mapped_size == 0) {
+            shrink_heap_block(block, max_size);
+        } else {
+            /* A mapping stays whole until it is freed, but whole pages past
+             * the new end are given back */
+            char *end = (char *)ptr + max_size;
+            char *tail = (char *)PAGE_ALIGN((uintptr_t)end);
+            char *old_end = (char *)ptr + old_size;
+            if (tail < old_end) {
+                madvise(tail, (size_t)(old_end - tail) & ~(ALLOC_PAGE_SIZE - 1), MADV_DONTNEED);
+            }
+            block->size = max_size;
+            lock_mutex(&heap.heap_mutex);
+            heap.total_allocated -= old_size - max_size;
+            unlock_mutex(&heap.heap_mutex);
+        }
+    } else if (min_size > old_size) {
+        if (block->mapped_size != 0) {
+            /* Grow into the unused tail of the mapping */
+            size_t room = block->mapped_size - block->map_offset - HEADER_SIZE;
+            if (room >= min_size) {
+                block->size = room < max_size ? room : max_size;
+                lock_mutex(&heap.heap_mutex);
+                heap.total_allocated += block->size - old_size;
+                unlock_mutex(&heap.heap_mutex);
+            }
+        } else if (block->arena_id == 0) {
+            grow_heap_block(block, min_size, max_size);
+        }
+
+        if ((flags & MALLOCX_ZERO) && block->size > old_size) {
+            allocator_zero((char *)ptr + old_size, block->size - old_size);
+        }
+    }
+
+    if (block->size != old_size) {
+        thread_deallocated += old_size;
+        thread_allocated += block->size;
+        tag_record_resize(block, old_size);
+    }
+    return block->size;
+}
+
+// cppcheck-suppress unusedFunction
+void dallocx(void *ptr, int flags)
+{
+    if (ptr && (flags & MALLOCX_TCACHE_NONE) && !is_headerless(ptr)) {
+        block_t *block = get_block_from_ptr(ptr);
+        if (verify_block_integrity(block) == BLOCK_VALID && !block->is_free) {
+            block->flags |= BLOCK_FLAG_NO_TCACHE;
+        }
+    }
+    free(ptr);
+}
+
+// cppcheck-suppress unusedFunction
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        last_error = ALLOC_ERROR_INVALID_SIZE;
+        errno = EINVAL;
+        return NULL;
+    }
+    return mallocx(size, MALLOCX_ALIGN(alignment));
+}
+
+// cppcheck-suppress unusedFunction
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    if (alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0) {
+        last_error = ALLOC_ERROR_INVALID_SIZE;
+        return EINVAL;
+    }
+
+    /* Left to libc, these would come from its heap and reach our free() */
+    void *ptr = size ? mallocx(size, MALLOCX_ALIGN(alignment)) : NULL;
+    if (size && !ptr)
+        return ENOMEM;
+    *memptr = ptr;
+    return 0;
+}
+
+/* Shrink the program break to the end of the last block plus pad bytes,
+ * when the pool still ends at the break. A listed free block in front of
+ * the pool joins it first. Returns bytes released. */
+static size_t trim_heap_top(size_t pad)
+{
+    size_t released = 0;
+
+    lock_mutex(&pool_mutex);
+    lock_mutex(&heap.heap_mutex);
+
+    char *pool_end = (char *)heap_extension_pool + pool_remaining;
+    if (pool_region && pool_end == (char *)sbrk(0)) {
+        for (block_t *block = heap.free_head; block; block = block->next_free) {
+            if ((char *)get_next_block(block) == (char *)heap_extension_pool &&
+                (char *)block >= (char *)pool_region->start) {
+                remove_from_free_list_locked(block);
+                block->is_free = BLOCK_MERGED;
+                heap_extension_pool = block;
+                pool_remaining = (size_t)(pool_end - (char *)block);
+                break;
+            }
+        }
+
+        size_t excess = pool_remaining > pad ? (pool_remaining - pad) & ~(ALLOC_PAGE_SIZE - 1) : 0;
+/* NOLINTNEXTLINE(bugprone-narrowing-conversions) - sbrk requires int/intptr_t */
+#ifdef __APPLE__
+        void *old_break = excess ? sbrk(-(int)excess) : (void *)(intptr_t)-1;
+#else
+        void *old_break = excess ? sbrk(-(intptr_t)excess) : (void *)(intptr_t)-1;
+#endif
+        /* NOLINTNEXTLINE(performance-no-int-to-ptr) - sbrk returns (void *)-1 on error */
+        if (old_break != (void *)(intptr_t)-1) {
+            pool_remaining -= excess;
+            heap.heap_end = pool_end - excess;
+            released = excess;
+
+            lock_mutex(&region_mutex);
+            pool_region->size -= excess;
+            pool_region->used = pool_region->size;
+            unlock_mutex(&region_mutex);
+        }
+    }
+
+    unlock_mutex(&heap.heap_mutex);
+    unlock_mutex(&pool_mutex);
+    return released;
+}
+
+size_t release_free_memory(size_t pad)
+{
+    flush_deferred_frees(&deferred_frees);
+
+    size_t released = trim_heap_top(pad);
+    released += reclaim_purge_free_list();
+    released += segment_purge_dirty_pages();
+    released += arena_purge_retained();
+    return released;
+}
+
+// cppcheck-suppress unusedFunction
+int malloc_trim(size_t pad)
+{
+    return release_free_memory(pad) > 0;
+}
+
+// cppcheck-suppress unusedFunction
+size_t malloc_usable_size(void *ptr)
+{
+    if (!ptr)
+        return 0;
+
+    if (is_headerless(ptr)) {
+        return headerless_usable_size(ptr);
+    }
+
+    block_t *block = get_block_from_ptr(ptr);
+    if (verify_block_integrity(block) != BLOCK_VALID || block->is_free) {
+        return 0;
+    }
+    return block->size;
+}
+
 /* Error Handling */
 static void handle_memory_acquisition_failure(void)
 {
@@ -661,6 +1644,793 @@ static void trigger_emergency_cleanup(void)
     /* Future implementation: aggressive cleanup strategies */
 }
 
+typedef void (*error_handler_fn)(alloc_error_t error, const char *message);
+
+static _Atomic(error_handler_fn) error_handler;
+
+// cppcheck-suppress unusedFunction
+void set_error_handler(void (*handler)(alloc_error_t, const char *))
+{
+    atomic_store_explicit(&error_handler, handler, memory_order_release);
+}
+
+void report_error(alloc_error_t error, const char *message)
+{
+    last_error = error;
+
+    error_handler_fn handler = atomic_load_explicit(&error_handler, memory_order_acquire);
+    if (handler) {
+        handler(error, message);
+    } else {
+        fprintf(stderr, "%s: %s\n", get_error_string(error), message);
+    }
+}
+
+/* Heap Walk
+ *
+ * heap_iterate() visits the sbrk regions in address order, block by block,
+ * and then the blocks with dedicated mappings. Each slice holds the locks
+ * for at most HEAP_ITERATE_SLICE blocks and the callbacks run with none
+ * held. Splits only ever add headers, but between slices the header at the
+ * cursor may have been merged into the block in front of it; merges mark
+ * such headers BLOCK_MERGED, and the walk then finds its place again from
+ * the start of the region.
+ */
+enum { WALK_HEAP, WALK_MAPPED, WALK_DONE };
+
+typedef struct heap_walk {
+    int phase;
+    const void *region;      /* Start of the sbrk region being walked */
+    char *cursor;            /* Next header to read in it */
+    const void *last_mapped; /* Start of the last mapping visited */
+} heap_walk_t;
+
+/* End of the blocks in an sbrk region; caller holds pool_mutex */
+static char *region_blocks_end(const memory_region_t *region)
+{
+    if (region == pool_region)
+        return (char *)heap_extension_pool;
+    return (char *)region->start + region->used;
+}
+
+/* The sbrk region with the lowest start above after (any, for NULL), or the
+ * mapping likewise; caller holds region_mutex */
+static const memory_region_t *next_region(const void *after, bool is_mmap)
+{
+    const memory_region_t *next = NULL;
+    for (const memory_region_t *region = memory_regions; region; region = region->next) {
+        if (region->is_mmap == is_mmap && (!after || region->start > after) &&
+            (!next || region->start < next->start)) {
+            next = region;
+        }
+    }
+    return next;
+}
+
+static bool block_fits(const block_t *block, const char *end)
+{
+    return (size_t)(end - (const char *)block) >= HEADER_SIZE &&
+           verify_block_integrity((block_t *)block) == BLOCK_VALID &&
+           block->size <= (size_t)(end - (const char *)block) - HEADER_SIZE;
+}
+
+static void describe_block(heap_block_info_t *info, block_t *block, bool valid)
+{
+    info->ptr = get_ptr_from_block(block);
+    info->size = valid ? block->size : 0;
+    info->free = valid && block->is_free;
+    info->mapped = valid && block->mapped_size != 0;
+    info->corrupt = !valid;
+}
+
+/* The sbrk region the walk is in, with the cursor moved to the next header
+ * if the one it was on has been merged away; caller holds pool_mutex,
+ * heap.heap_mutex and region_mutex */
+static const memory_region_t *resume_heap_walk(heap_walk_t *walk)
+{
+    const memory_region_t *region = NULL;
+    for (const memory_region_t *r = memory_regions; walk->region && r; r = r->next) {
+        if (r->start == walk->region && !r->is_mmap) {
+            region = r;
+        }
+    }
+
+    if (region && walk->cursor < region_blocks_end(region) &&
+        verify_block_integrity((block_t *)walk->cursor) != BLOCK_VALID) {
+        char *end = region_blocks_end(region);
+        char *at = (char *)region->start;
+        while (at < walk->cursor && block_fits((block_t *)at, end)) {
+            at = (char *)get_next_block((block_t *)at);
+        }
+        walk->cursor = at;
+    }
+    return region;
+}
+
+/* Move the walk on to the next sbrk region, or to the mapped phase */
+static const memory_region_t *advance_heap_walk(heap_walk_t *walk)
+{
+    const memory_region_t *region = next_region(walk->region, false);
+    if (!region) {
+        walk->phase = WALK_MAPPED;
+        return NULL;
+    }
+    walk->region = region->start;
+    walk->cursor = (char *)region->start;
+    return region;
+}
+
+static int walk_heap_slice(heap_walk_t *walk, heap_block_info_t *infos)
+{
+    int count = 0;
+
+    lock_mutex(&pool_mutex);
+    lock_mutex(&heap.heap_mutex);
+    lock_mutex(&region_mutex);
+
+    const memory_region_t *region = resume_heap_walk(walk);
+    while (count < HEAP_ITERATE_SLICE) {
+        if (!region) {
+            region = advance_heap_walk(walk);
+            if (!region)
+                break;
+        }
+
+        char *end = region_blocks_end(region);
+        while (count < HEAP_ITERATE_SLICE && walk->cursor < end) {
+            block_t *block = (block_t *)walk->cursor;
+            bool valid = block_fits(block, end);
+            describe_block(&infos[count++], block, valid);
+            /* Nothing behind a damaged header can be trusted */
+            walk->cursor = valid ? (char *)get_next_block(block) : end;
+        }
+        if (walk->cursor >= end) {
+            region = NULL;
+        }
+    }
+
+    unlock_mutex(&region_mutex);
+    unlock_mutex(&heap.heap_mutex);
+    unlock_mutex(&pool_mutex);
+    return count;
+}
+
+static int walk_mapped_slice(heap_walk_t *walk, heap_block_info_t *infos)
+{
+    int count = 0;
+
+    lock_mutex(&region_mutex);
+    while (count < HEAP_ITERATE_SLICE) {
+        const memory_region_t *region = next_region(walk->last_mapped, true);
+        if (!region) {
+            walk->phase = WALK_DONE;
+            break;
+        }
+        walk->last_mapped = region->start;
+
+        block_t *block = (block_t *)((char *)region->start + region->block_offset);
+        describe_block(&infos[count++],
+                       block,
+                       block_fits(block, (char *)region->start + region->size));
+    }
+    unlock_mutex(&region_mutex);
+    return count;
+}
+
+// cppcheck-suppress unusedFunction
+int heap_iterate(heap_iterate_fn callback, void *ctx)
+{
+    if (!callback)
+        return 0;
+
+    heap_walk_t walk = {.phase = WALK_HEAP};
+    heap_block_info_t infos[HEAP_ITERATE_SLICE];
+    bool corrupt = false;
+
+    while (walk.phase != WALK_DONE) {
+        int count = walk.phase == WALK_HEAP ? walk_heap_slice(&walk, infos)
+                                            : walk_mapped_slice(&walk, infos);
+        for (int i = 0; i < count; i++) {
+            corrupt |= infos[i].corrupt;
+            int result = callback(&infos[i], ctx);
+            if (result != 0)
+                return result;
+        }
+    }
+
+    if (corrupt) {
+        last_error = ALLOC_ERROR_CORRUPTION;
+        return -1;
+    }
+    return 0;
+}
+
+typedef struct heap_census {
+    size_t blocks;
+    size_t free_blocks;
+    size_t allocated_bytes;
+    size_t free_bytes;
+    size_t largest_free;
+    size_t corrupt;
+} heap_census_t;
+
+static void count_block(heap_census_t *census, const heap_block_info_t *block)
+{
+    census->blocks++;
+    if (block->corrupt) {
+        census->corrupt++;
+    } else if (block->free) {
+        census->free_blocks++;
+        census->free_bytes += block->size;
+        if (block->size > census->largest_free) {
+            census->largest_free = block->size;
+        }
+    } else {
+        census->allocated_bytes += block->size;
+    }
+}
+
+static int check_block(const heap_block_info_t *block, void *ctx)
+{
+    count_block(ctx, block);
+    if (block->corrupt) {
+        char message[64];
+        snprintf(message, sizeof(message), "damaged header before %p", block->ptr);
+        report_error(ALLOC_ERROR_CORRUPTION, message);
+    }
+    return 0;
+}
+
+// cppcheck-suppress unusedFunction
+void heap_consistency_check(void)
+{
+    heap_census_t census = {0};
+    heap_iterate(check_block, &census);
+
+    /* The free list must be doubly linked, hold only free blocks and add up
+     * to the free total */
+    size_t listed = 0;
+    size_t listed_bytes = 0;
+    size_t list_errors = 0;
+    char message[128];
+
+    lock_mutex(&heap.heap_mutex);
+    const block_t *prev = NULL;
+    for (const block_t *block = heap.free_head; block; block = block->next_free) {
+        if (verify_block_integrity((block_t *)block) != BLOCK_VALID || !block->is_free ||
+            block->prev_free != prev) {
+            snprintf(message, sizeof(message), "free list broken at block %p", (const void *)block);
+            list_errors++;
+            break;
+        }
+        listed++;
+        listed_bytes += block->size;
+        prev = block;
+    }
+    if (list_errors == 0 && listed_bytes != heap.total_free) {
+        snprintf(message,
+                 sizeof(message),
+                 "free list holds %zu bytes but %zu are accounted free",
+                 listed_bytes,
+                 heap.total_free);
+        list_errors++;
+    }
+    unlock_mutex(&heap.heap_mutex);
+
+    /* Reported with no lock held, as the error handler may allocate */
+    if (list_errors > 0) {
+        report_error(ALLOC_ERROR_CORRUPTION, message);
+    }
+    printf("Heap check: %zu blocks (%zu free), %zu on the free list, %zu errors\n",
+           census.blocks,
+           census.free_blocks,
+           listed,
+           census.corrupt + list_errors);
+}
+
+static int print_block(const heap_block_info_t *block, void *ctx)
+{
+    count_block(ctx, block);
+    printf("%p %10zu %s%s\n",
+           block->ptr,
+           block->size,
+           block->corrupt ? "CORRUPT" : (block->free ? "free" : "allocated"),
+           block->mapped ? " (mapped)" : "");
+    return 0;
+}
+
+// cppcheck-suppress unusedFunction
+void print_heap_layout(void)
+{
+    heap_census_t census = {0};
+
+    printf("=== Heap Layout ===\n");
+    heap_iterate(print_block, &census);
+    printf("%zu blocks: %zu bytes allocated, %zu bytes free in %zu blocks\n",
+           census.blocks,
+           census.allocated_bytes,
+           census.free_bytes,
+           census.free_blocks);
+}
+
+static int print_free_block(const heap_block_info_t *block, void *ctx)
+{
+    if (block->free) {
+        print_block(block, ctx);
+    }
+    return 0;
+}
+
+// cppcheck-suppress unusedFunction
+void print_free_list(void)
+{
+    heap_census_t census = {0};
+
+    /* Free blocks in address order, including those still in deferred
+     * free buffers and the reclaimer's queue */
+    printf("=== Free Blocks ===\n");
+    heap_iterate(print_free_block, &census);
+    printf("%zu free blocks, %zu bytes, largest %zu bytes\n",
+           census.free_blocks,
+           census.free_bytes,
+           census.largest_free);
+}
+
+/* Incremental Verification
+ *
+ * heap_verify_step() keeps one heap walk going across calls and checks the
+ * blocks it passes under the same locks and in the same slices as
+ * heap_iterate(). Faults are collected during a slice and reported once
+ * the locks are dropped, since the error handler may allocate. A fault in
+ * a header ends the walk of its region, as nothing behind it can be found.
+ */
+#define VERIFY_MAX_FAULTS 8 /* Faults reported per step; the rest are counted */
+
+typedef struct heap_fault {
+    const void *block;
+    const char *what;
+} heap_fault_t;
+
+typedef struct verify_step {
+    size_t checked;
+    size_t errors;
+    size_t reported;
+    heap_fault_t faults[VERIFY_MAX_FAULTS];
+} verify_step_t;
+
+static struct {
+    pthread_mutex_t mutex; /* One step at a time */
+    heap_walk_t walk;
+    verify_stats_t stats;
+} verifier = {.mutex = PTHREAD_MUTEX_INITIALIZER, .walk = {.phase = WALK_HEAP}};
+
+static void record_fault(verify_step_t *step, const void *block, const char *what)
+{
+    if (step->reported < VERIFY_MAX_FAULTS) {
+        step->faults[step->reported].block = block;
+        step->faults[step->reported].what = what;
+        step->reported++;
+    }
+    step->errors++;
+}
+
+/* A free-list link that can be followed: inside the sbrk heap and aligned;
+ * caller holds heap.heap_mutex */
+static bool plausible_link(const block_t *link)
+{
+    return !link || (IS_ALIGNED(link) && (const void *)link >= heap.heap_start &&
+                     (const char *)link + HEADER_SIZE <= (const char *)heap.heap_end);
+}
+
+static const char *header_fault(block_t *block)
+{
+    switch (verify_block_integrity(block)) {
+        case BLOCK_VALID:
+            return NULL;
+        case BLOCK_CORRUPT_MAGIC:
+            return "invalid magic number";
+        case BLOCK_INVALID_SIZE:
+            return "misaligned block size";
+        case BLOCK_INVALID_FREE_STATE:
+            return "invalid free state";
+        default:
+            return "invalid block header";
+    }
+}
+
+/* Check a block of an sbrk region ending at end; caller holds pool_mutex,
+ * heap.heap_mutex and region_mutex */
+static const char *heap_block_fault(block_t *block, const char *end)
+{
+    if ((size_t)(end - (const char *)block) < HEADER_SIZE)
+        return "truncated block header";
+
+    const char *fault = header_fault(block);
+    if (fault)
+        return fault;
+
+    if (block->size > (size_t)(end - (const char *)block) - HEADER_SIZE)
+        return "block size runs past its region";
+
+    block_t *next = get_next_block(block);
+    if ((const char *)next < end && !block_fits(next, end))
+        return "block size does not lead to its neighbour";
+
+    if (block->is_free && plausible_link(block->prev_free) &&
+        is_listed_free_block_locked(block)) {
+        const block_t *after = block->next_free;
+        if (!plausible_link(after) ||
+            (after && (after->magic != MAGIC_NUMBER || after->is_free != 1 ||
+                       after->prev_free != block)))
+            return "free list link broken";
+    } else if (block->is_free && !plausible_link(block->prev_free)) {
+        return "free list link broken";
+    }
+    return NULL;
+}
+
+static void verify_heap_slice(heap_walk_t *walk, size_t limit, verify_step_t *step)
+{
+    size_t count = 0;
+
+    lock_mutex(&pool_mutex);
+    lock_mutex(&heap.heap_mutex);
+    lock_mutex(&region_mutex);
+
+    const memory_region_t *region = resume_heap_walk(walk);
+    while (count < limit) {
+        if (!region) {
+            region = advance_heap_walk(walk);
+            if (!region)
+                break;
+        }
+
+        char *end = region_blocks_end(region);
+        while (count < limit && walk->cursor < end) {
+            block_t *block = (block_t *)walk->cursor;
+            const char *fault = heap_block_fault(block, end);
+            count++;
+            if (fault) {
+                record_fault(step, block, fault);
+                walk->cursor = end;
+            } else {
+                walk->cursor = (char *)get_next_block(block);
+            }
+        }
+        if (walk->cursor >= end) {
+            region = NULL;
+        }
+    }
+
+    unlock_mutex(&region_mutex);
+    unlock_mutex(&heap.heap_mutex);
+    unlock_mutex(&pool_mutex);
+    step->checked += count;
+}
+
+static void verify_mapped_slice(heap_walk_t *walk, size_t limit, verify_step_t *step)
+{
+    size_t count = 0;
+
+    lock_mutex(&region_mutex);
+    while (count < limit) {
+        const memory_region_t *region = next_region(walk->last_mapped, true);
+        if (!region) {
+            walk->phase = WALK_DONE;
+            break;
+        }
+        walk->last_mapped = region->start;
+        count++;
+
+        block_t *block = (block_t *)((char *)region->start + region->block_offset);
+        const char *fault = header_fault(block);
+        if (!fault && (block->mapped_size != region->size ||
+                       (char *)block - block->map_offset != (char *)region->start)) {
+            fault = "mapping does not match its block";
+        }
+        if (fault) {
+            record_fault(step, block, fault);
+        }
+    }
+    unlock_mutex(&region_mutex);
+    step->checked += count;
+}
+
+// cppcheck-suppress unusedFunction
+int heap_verify_step(size_t budget)
+{
+    verify_step_t step = {0};
+    int done = 0;
+
+    lock_mutex(&verifier.mutex);
+    while (step.checked < budget && !done) {
+        size_t limit = budget - step.checked;
+        if (limit > HEAP_ITERATE_SLICE) {
+            limit = HEAP_ITERATE_SLICE;
+        }
+
+        if (verifier.walk.phase == WALK_HEAP) {
+            verify_heap_slice(&verifier.walk, limit, &step);
+        } else {
+            verify_mapped_slice(&verifier.walk, limit, &step);
+        }
+
+        if (verifier.walk.phase == WALK_DONE) {
+            verifier.walk = (heap_walk_t){.phase = WALK_HEAP};
+            verifier.stats.passes++;
+            done = 1;
+        }
+    }
+    verifier.stats.blocks_checked += step.checked;
+    verifier.stats.errors += step.errors;
+    unlock_mutex(&verifier.mutex);
+
+    for (size_t i = 0; i < step.reported; i++) {
+        char message[128];
+        snprintf(message,
+                 sizeof(message),
+                 "%s at block %p",
+                 step.faults[i].what,
+                 step.faults[i].block);
+        report_error(ALLOC_ERROR_CORRUPTION, message);
+    }
+    return done;
+}
+
+// cppcheck-suppress unusedFunction
+void allocator_verify_stats(verify_stats_t *stats)
+{
+    if (!stats)
+        return;
+
+    lock_mutex(&verifier.mutex);
+    *stats = verifier.stats;
+    unlock_mutex(&verifier.mutex);
+}
+
+/* Heap Dump
+ *
+ * Records are gathered in a buffer mapped for the purpose, so the dump does
+ * not allocate from the heap it describes, and written out whenever it
+ * fills. Regions are copied HEAP_ITERATE_SLICE at a time and blocks come
+ * from heap_iterate(), both written with no lock held. The free list can
+ * only be followed in one go, so it is the one part written under
+ * heap.heap_mutex.
+ */
+#define HEAP_DUMP_BUFFER ((size_t)1 << 20) /* Bytes gathered per write() */
+
+typedef struct dump_writer {
+    int fd;
+    char *buffer;
+    size_t used;
+    size_t records;
+    bool failed;
+} dump_writer_t;
+
+static void dump_flush(dump_writer_t *writer)
+{
+    size_t done = 0;
+    while (!writer->failed && done < writer->used) {
+        ssize_t written = write(writer->fd, writer->buffer + done, writer->used - done);
+        if (written > 0) {
+            done += (size_t)written;
+        } else if (written == 0 || errno != EINTR) {
+            writer->failed = true;
+        }
+    }
+    writer->used = 0;
+}
+
+static void dump_bytes(dump_writer_t *writer, const void *data, size_t size)
+{
+    if (writer->used + size > HEAP_DUMP_BUFFER) {
+        dump_flush(writer);
+    }
+    memcpy(writer->buffer + writer->used, data, size);
+    writer->used += size;
+}
+
+static void dump_record(dump_writer_t *writer,
+                        uint32_t type,
+                        const void *address,
+                        size_t size,
+                        uint32_t flags)
+{
+    heap_dump_record_t record = {
+        .address = (uint64_t)(uintptr_t)address,
+        .size = size,
+        .type = type,
+        .flags = flags,
+    };
+    dump_bytes(writer, &record, sizeof(record));
+    writer->records++;
+}
+
+static void dump_regions(dump_writer_t *writer, bool is_mmap)
+{
+    heap_dump_record_t slice[HEAP_ITERATE_SLICE];
+    const void *last = NULL;
+    int count;
+
+    do {
+        count = 0;
+        lock_mutex(&region_mutex);
+        while (count < HEAP_ITERATE_SLICE) {
+            const memory_region_t *region = next_region(last, is_mmap);
+            if (!region)
+                break;
+            last = region->start;
+            slice[count++] = (heap_dump_record_t){
+                .address = (uint64_t)(uintptr_t)region->start,
+                .size = region->size,
+                .type = HEAP_DUMP_REGION,
+                .flags = is_mmap ? HEAP_DUMP_FLAG_MAPPED : 0,
+            };
+        }
+        unlock_mutex(&region_mutex);
+
+        dump_bytes(writer, slice, (size_t)count * sizeof(slice[0]));
+        writer->records += (size_t)count;
+    } while (count == HEAP_ITERATE_SLICE);
+}
+
+static int dump_block(const heap_block_info_t *block, void *ctx)
+{
+    uint32_t flags = (block->free ? HEAP_DUMP_FLAG_FREE : 0) |
+                     (block->mapped ? HEAP_DUMP_FLAG_MAPPED : 0) |
+                     (block->corrupt ? HEAP_DUMP_FLAG_CORRUPT : 0);
+    dump_record(ctx, HEAP_DUMP_BLOCK, block->ptr, block->size, flags);
+    return 0;
+}
+
+// cppcheck-suppress unusedFunction
+int heap_dump(const char *path)
+{
+    if (!path) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    dump_writer_t writer = {.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)};
+    if (writer.fd < 0)
+        return -1;
+
+    writer.buffer = mmap(NULL,
+                         HEAP_DUMP_BUFFER,
+                         PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS,
+                         -1,
+                         0);
+    if (writer.buffer == MAP_FAILED) {
+        int saved = errno;
+        close(writer.fd);
+        errno = saved;
+        return -1;
+    }
+
+    heap_dump_header_t header = {
+        .version = HEAP_DUMP_VERSION,
+        .record_size = sizeof(heap_dump_record_t),
+        .timestamp = (uint64_t)time(NULL),
+    };
+    memcpy(header.magic, HEAP_DUMP_MAGIC, sizeof(header.magic));
+    lock_mutex(&heap.heap_mutex);
+    header.total_allocated = heap.total_allocated;
+    header.total_free = heap.total_free;
+    header.allocation_count = heap.allocation_count;
+    unlock_mutex(&heap.heap_mutex);
+    dump_bytes(&writer, &header, sizeof(header));
+
+    dump_regions(&writer, false);
+    dump_regions(&writer, true);
+    heap_iterate(dump_block, &writer);
+
+    lock_mutex(&heap.heap_mutex);
+    for (block_t *block = heap.free_head; block; block = block->next_free) {
+        dump_record(&writer, HEAP_DUMP_FREE_LIST, get_ptr_from_block(block), block->size, 0);
+    }
+    unlock_mutex(&heap.heap_mutex);
+
+    /* The end record carries the number of records in front of it */
+    dump_record(&writer, HEAP_DUMP_END, NULL, writer.records, 0);
+    dump_flush(&writer);
+
+    int saved = errno;
+    munmap(writer.buffer, HEAP_DUMP_BUFFER);
+    if (close(writer.fd) != 0 && !writer.failed) {
+        saved = errno;
+        writer.failed = true;
+    }
+    errno = saved;
+    return writer.failed ? -1 : 0;
+}
+
+/* Fork Safety
+ *
+ * A thread holding an allocator lock when another thread calls fork() does
+ * not exist in the child, so without these handlers the child would block
+ * on that lock forever. Before fork() every lock is taken, outermost first
+ * (see allocator_internal.h); the parent then releases them in reverse.
+ * The child holds them all in a process with a single thread, so it simply
+ * initializes them afresh. It keeps locking: glibc does not mark a forked
+ * child single-threaded again, so a thread it creates would go unnoticed.
+ *
+ * State of the threads that are gone is dropped rather than recovered:
+ * blocks waiting in their deferred free buffers stay marked free without
+ * reaching the free list, and their segment heaps are forgotten (see
+ * segment_atfork_child()). Nothing in the child walks the heap.
+ */
+static void allocator_atfork_prepare(void)
+{
+    lock_mutex(&verifier.mutex);
+    signal_safe_atfork_prepare();
+    realtime_atfork_prepare();
+    stack_atfork_prepare();
+    io_buffer_atfork_prepare();
+    tag_atfork_prepare();
+    pressure_atfork_prepare();
+    arena_atfork_prepare();
+    lifetime_atfork_prepare();
+    handle_atfork_prepare();
+    slab_atfork_prepare();
+    segment_atfork_prepare();
+    zero_pool_atfork_prepare();
+    lock_mutex(&pool_mutex);
+    lock_mutex(&heap.heap_mutex);
+    reclaim_atfork_prepare();
+    lock_mutex(&region_mutex);
+}
+
+static void allocator_atfork_parent(void)
+{
+    unlock_mutex(&region_mutex);
+    reclaim_atfork_parent();
+    unlock_mutex(&heap.heap_mutex);
+    unlock_mutex(&pool_mutex);
+    zero_pool_atfork_parent();
+    segment_atfork_parent();
+    slab_atfork_parent();
+    handle_atfork_parent();
+    lifetime_atfork_parent();
+    arena_atfork_parent();
+    pressure_atfork_parent();
+    tag_atfork_parent();
+    io_buffer_atfork_parent();
+    stack_atfork_parent();
+    realtime_atfork_parent();
+    signal_safe_atfork_parent();
+    unlock_mutex(&verifier.mutex);
+}
+
+static void allocator_atfork_child(void)
+{
+    pthread_mutex_init(&region_mutex, NULL);
+    pthread_mutex_init(&heap.heap_mutex, NULL);
+    pthread_mutex_init(&pool_mutex, NULL);
+    pthread_mutex_init(&verifier.mutex, NULL);
+
+    /* Module hooks may use the heap again, e.g. to run reclaimer jobs */
+    reclaim_atfork_child();
+    zero_pool_atfork_child();
+    segment_atfork_child();
+    slab_atfork_child();
+    handle_atfork_child();
+    lifetime_atfork_child();
+    arena_atfork_child();
+    signal_safe_atfork_child();
+    realtime_atfork_child();
+    stack_atfork_child();
+    io_buffer_atfork_child();
+    tag_atfork_child();
+    pressure_atfork_child();
+    verify_atfork_child();
+}
+
+static void register_atfork_handlers(void)
+{
+    pthread_atfork(allocator_atfork_prepare, allocator_atfork_parent, allocator_atfork_child);
+}
+
 /* Utility Functions */
 // cppcheck-suppress unusedFunction
 bool is_valid_heap_pointer(const void *ptr)
@@ -696,10 +2466,23 @@ const char *get_error_string(alloc_error_t error)
     }
 }
 
+// cppcheck-suppress unusedFunction
+bool allocator_single_threaded(void)
+{
+    /* A query must not latch the switch the way lock_mutex() does */
+    if (atomic_load_explicit(&heap_multithreaded, memory_order_relaxed))
+        return false;
+#ifdef HAVE_LIBC_SINGLE_THREADED
+    return __libc_single_threaded;
+#else
+    return false;
+#endif
+}
+
 // cppcheck-suppress unusedFunction
 void allocator_stats(void)
 {
-    pthread_mutex_lock(&heap.heap_mutex);
+    lock_mutex(&heap.heap_mutex);
 
     printf("=== Memory Allocator Statistics ===\n");
     printf("Total allocated: %zu bytes\n", heap.total_allocated);
@@ -717,8 +2500,25 @@ void allocator_stats(void)
     printf("Emergency mode: %s\n", mem_stats.emergency_mode ? "YES" : "NO");
     printf("sbrk failures: %d\n", mem_stats.sbrk_failures);
     printf("mmap failures: %d\n", mem_stats.mmap_failures);
-
-    pthread_mutex_unlock(&heap.heap_mutex);
+    printf("Locking: %s\n",
+           allocator_single_threaded() ? "single-threaded fast mode" : "multi-threaded");
+
+    unlock_mutex(&heap.heap_mutex);
+
+    reclaim_print_stats();
+    zero_pool_print_stats();
+    segment_print_stats();
+    arena_print_stats();
+    lifetime_print_stats();
+    handle_print_stats();
+    slab_print_stats();
+    verify_print_stats();
+    signal_safe_print_stats();
+    realtime_print_stats();
+    stack_print_stats();
+    io_buffer_print_stats();
+    tag_print_stats();
+    pressure_print_stats();
 }
 
 // cppcheck-suppress unusedFunction
@@ -727,17 +2527,22 @@ void allocator_cleanup(void)
     if (!allocator_initialized)
         return;
 
+    flush_deferred_frees(&deferred_frees);
+
     pthread_mutex_destroy(&heap.heap_mutex);
     pthread_mutex_destroy(&pool_mutex);
     pthread_mutex_destroy(&region_mutex);
 
-    /* Free memory region tracking */
+    /* Recycle memory region tracking nodes */
     memory_region_t *current = memory_regions;
     while (current) {
         memory_region_t *next = current->next;
-        free(current);
+        current->next = region_node_free;
+        region_node_free = current;
         current = next;
     }
+    memory_regions = NULL;
+    pool_region = NULL;
 
     allocator_initialized = false;
 }
@@ -0,0 +1,488 @@
+#ifndef ALLOCATOR_INTERNAL_H
+#define ALLOCATOR_INTERNAL_H
+
+/*
+ * Memory Allocator - Internal Interfaces
+ *
+ * Declarations shared between the allocator's source files. This header is
+ * not installed and is not part of the public API.
+ */
+
+#include "allocator.h"
+
+#include <sched.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#if defined(__has_include)
+    #if __has_include(<sys/single_threaded.h>)
+        #include <sys/single_threaded.h>
+        #define HAVE_LIBC_SINGLE_THREADED 1
+    #endif
+#endif
+
+/* Page Helpers */
+#define ALLOC_PAGE_SIZE ((size_t)4096) /* Assume 4KB pages */
+#define PAGE_ALIGN(size) (((size) + ALLOC_PAGE_SIZE - 1) & ~(ALLOC_PAGE_SIZE - 1))
+
+/* Core Heap (allocator.c) */
+block_t *allocate_block(size_t size); /* malloc() returning the block header */
+void free_uncounted(void *ptr);       /* free() of memory never counted as allocated */
+
+/* malloc_trim() returning the bytes released, and the two halves of a
+ * free-list purge that runs without the heap lock */
+size_t release_free_memory(size_t pad);
+size_t take_unpurged_free_blocks(block_t **blocks, size_t max);
+void list_purged_free_blocks(block_t **blocks, size_t count);
+
+/* Single-Threaded Fast Mode
+ *
+ * While the process has only one thread nobody else can observe the heap, so
+ * the lock helpers below skip the pthread calls entirely, as glibc does with
+ * SINGLE_THREAD_P. libc clears __libc_single_threaded inside pthread_create()
+ * before the new thread starts running, so the creating thread takes every
+ * lock from then on and the new thread never sees an unprotected heap.
+ *
+ * The switch latches: once set it is never cleared, even if the extra threads
+ * exit, so a critical section entered with the lock held always releases it.
+ * The allocator never creates threads while holding one of its own locks.
+ * Without __libc_single_threaded the allocator always locks.
+ */
+extern atomic_bool heap_multithreaded;
+
+static inline bool allocator_is_multithreaded(void)
+{
+    if (LIKELY(atomic_load_explicit(&heap_multithreaded, memory_order_relaxed)))
+        return true;
+#ifdef HAVE_LIBC_SINGLE_THREADED
+    if (LIKELY(__libc_single_threaded))
+        return false;
+#endif
+    atomic_store_explicit(&heap_multithreaded, true, memory_order_relaxed);
+    return true;
+}
+
+static inline void lock_mutex(pthread_mutex_t *mutex)
+{
+    if (allocator_is_multithreaded())
+        pthread_mutex_lock(mutex);
+}
+
+static inline void unlock_mutex(pthread_mutex_t *mutex)
+{
+    if (atomic_load_explicit(&heap_multithreaded, memory_order_relaxed))
+        pthread_mutex_unlock(mutex);
+}
+
+/* Background Threads
+ *
+ * The heap verifier, the zero-pool refiller and the slab mesher only use
+ * otherwise idle CPU time. Background threads sleep on a condition variable
+ * with a timeout, which pthread_cond_timedwait() takes as a CLOCK_REALTIME
+ * deadline.
+ *
+ * Each module keeps the mutex and condition variable its thread waits on;
+ * background_thread_t holds the rest. stopping is read and written under
+ * the module's mutex.
+ */
+typedef struct background_thread {
+    pthread_mutex_t toggle_mutex; /* Held across a whole start or stop */
+    pthread_t id;
+    atomic_bool running;
+    bool stopping;
+} background_thread_t;
+
+#define BACKGROUND_THREAD_INITIALIZER {.toggle_mutex = PTHREAD_MUTEX_INITIALIZER}
+
+/* Start the thread running main, or stop and join it. Concurrent calls are
+ * serialized, so at most one thread is started and only a started thread
+ * is joined. The toggle lock is taken with pthread_mutex_lock() rather
+ * than lock_mutex(), since starting a thread ends single-threaded mode. */
+static inline int background_thread_toggle(background_thread_t *thread,
+                                           bool enabled,
+                                           void *(*main)(void *),
+                                           pthread_mutex_t *mutex,
+                                           pthread_cond_t *wake)
+{
+    int result = 0;
+
+    pthread_mutex_lock(&thread->toggle_mutex);
+    if (enabled == atomic_load_explicit(&thread->running, memory_order_acquire)) {
+        /* Already in the requested state */
+    } else if (enabled) {
+        thread->stopping = false;
+        if (pthread_create(&thread->id, NULL, main, NULL) == 0) {
+            atomic_store_explicit(&thread->running, true, memory_order_release);
+        } else {
+            result = -1;
+        }
+    } else {
+        atomic_store_explicit(&thread->running, false, memory_order_release);
+
+        pthread_mutex_lock(mutex);
+        thread->stopping = true;
+        pthread_cond_signal(wake);
+        pthread_mutex_unlock(mutex);
+
+        pthread_join(thread->id, NULL);
+    }
+    pthread_mutex_unlock(&thread->toggle_mutex);
+    return result;
+}
+
+/* The thread did not survive the fork */
+static inline void background_thread_atfork_child(background_thread_t *thread)
+{
+    pthread_mutex_init(&thread->toggle_mutex, NULL);
+    atomic_store_explicit(&thread->running, false, memory_order_relaxed);
+    thread->stopping = false;
+}
+
+static inline void background_thread_set_idle(void)
+{
+#ifdef SCHED_IDLE
+    struct sched_param param = {0};
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+#endif
+}
+
+/* Wait on cond for at most timeout_ns; caller holds mutex */
+static inline void background_thread_wait(pthread_cond_t *cond,
+                                          pthread_mutex_t *mutex,
+                                          uint64_t timeout_ns)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    timeout_ns += (uint64_t)deadline.tv_nsec;
+    deadline.tv_sec += (time_t)(timeout_ns / 1000000000u);
+    deadline.tv_nsec = (long)(timeout_ns % 1000000000u);
+    pthread_cond_timedwait(cond, mutex, &deadline);
+}
+
+/* Error Reporting
+ *
+ * Sets last_error and passes message to the handler installed with
+ * set_error_handler(), or prints it to stderr when there is none.
+ */
+void report_error(alloc_error_t error, const char *message);
+
+/* Background Verifier (verify.c) */
+void verify_print_stats(void);
+
+/* Async-Signal-Safe Allocation (signal_safe.c) */
+void signal_safe_print_stats(void);
+
+/* Real-Time Heap (realtime.c) */
+void realtime_print_stats(void);
+
+/* Coroutine Stacks (stack.c) */
+void stack_print_stats(void);
+
+/* I/O Buffer Pool (io_buffer.c) */
+void io_buffer_print_stats(void);
+
+/* Allocation Tags (tag.c)
+ *
+ * The malloc() family calls tag_record_alloc() with the final object's tag
+ * and usable size, and free() calls tag_record_free(). Heap blocks carry
+ * the tag in their header; segment pages and slabs carry it for all their
+ * objects, which is why headerless_alloc() takes the current tag. While
+ * heap snapshots are enabled, new objects get TAG_COUNTED on top of their
+ * tag, and only those are counted in their size class, so an object freed
+ * after the switch changed is still taken off the counts it was added to.
+ * Untagged objects allocated with snapshots off cost a single branch.
+ *
+ * Both run outside every allocator lock and are inline, as they run on
+ * every allocation and free: the thread's shard is one initial-exec TLS
+ * load away and its counters are updated with plain loads and stores. Only
+ * a thread's first call, which maps its shard, and calls after its exit
+ * hook, which update the retired totals under the lock, go through tag.c.
+ * tag_collect() fills the per-class and per-tag counts of a snapshot.
+ */
+#define TAG_COUNTED ALLOC_TAG_MAX /* Stored tag bit: counted in its size class */
+#define TAG_BYTES(tag) (tag)
+#define TAG_OBJECTS(tag) (ALLOC_TAG_MAX + (tag))
+#define TAG_ALLOCATIONS(tag) (2 * ALLOC_TAG_MAX + (tag))
+#define CLASS_BYTES(class) (3 * ALLOC_TAG_MAX + (class))
+#define CLASS_OBJECTS(class) (3 * ALLOC_TAG_MAX + HEAP_SNAPSHOT_CLASSES + (class))
+#define TAG_COUNTERS (3 * ALLOC_TAG_MAX + 2 * HEAP_SNAPSHOT_CLASSES)
+
+typedef struct tag_shard {
+    atomic_llong counters[TAG_COUNTERS]; /* Owner writes only */
+    struct tag_shard *next; /* On tags.shards or tags.spare, guarded by tags.mutex */
+} tag_shard_t;
+
+extern __thread uint16_t alloc_tag_current __attribute__((tls_model("initial-exec")));
+extern __thread tag_shard_t *tag_thread_shard __attribute__((tls_model("initial-exec")));
+extern atomic_bool heap_snapshots_enabled;
+tag_shard_t *tag_shard_acquire(void); /* NULL once the thread's exit hook has run */
+void tag_count_retired(int index, long long delta);
+void tag_record_resize(const block_t *block, size_t old_size);
+void tag_collect(heap_snapshot_t *snapshot);
+void tag_print_stats(void);
+
+/* Power-of-two class holding size: class c covers sizes up to 1 << c */
+static inline int tag_size_class(size_t size)
+{
+    int class = size > 1 ? 64 - __builtin_clzll((unsigned long long)size - 1) : 0;
+    return class < HEAP_SNAPSHOT_CLASSES ? class : HEAP_SNAPSHOT_CLASSES - 1;
+}
+
+static inline tag_shard_t *tag_shard(void)
+{
+    tag_shard_t *shard = tag_thread_shard;
+    return LIKELY(shard != NULL) ? shard : tag_shard_acquire();
+}
+
+/* Owner-only update, so no read-modify-write instruction is needed */
+static inline void tag_count(tag_shard_t *shard, int index, long long delta)
+{
+    if (LIKELY(shard != NULL)) {
+        long long value = atomic_load_explicit(&shard->counters[index], memory_order_relaxed);
+        atomic_store_explicit(&shard->counters[index], value + delta, memory_order_relaxed);
+        return;
+    }
+    tag_count_retired(index, delta);
+}
+
+/* The tag stored with a new object */
+static inline uint16_t tag_for_allocation(void)
+{
+    uint16_t tag = alloc_tag_current;
+    if (UNLIKELY(atomic_load_explicit(&heap_snapshots_enabled, memory_order_relaxed))) {
+        tag |= TAG_COUNTED;
+    }
+    return tag;
+}
+
+static inline void tag_record_alloc(uint16_t tag, size_t size)
+{
+    if (LIKELY(tag == 0))
+        return;
+
+    tag_shard_t *shard = tag_shard();
+    if (tag & TAG_COUNTED) {
+        int class = tag_size_class(size);
+        tag_count(shard, CLASS_BYTES(class), (long long)size);
+        tag_count(shard, CLASS_OBJECTS(class), 1);
+        tag &= ~TAG_COUNTED;
+    }
+
+    if (tag != 0) {
+        tag_count(shard, TAG_BYTES(tag), (long long)size);
+        tag_count(shard, TAG_OBJECTS(tag), 1);
+        tag_count(shard, TAG_ALLOCATIONS(tag), 1);
+    }
+}
+
+static inline void tag_record_free(uint16_t tag, size_t size)
+{
+    if (LIKELY(tag == 0))
+        return;
+
+    tag_shard_t *shard = tag_shard();
+    if (tag & TAG_COUNTED) {
+        int class = tag_size_class(size);
+        tag_count(shard, CLASS_BYTES(class), -(long long)size);
+        tag_count(shard, CLASS_OBJECTS(class), -1);
+        tag &= ~TAG_COUNTED;
+    }
+
+    if (tag != 0) {
+        tag_count(shard, TAG_BYTES(tag), -(long long)size);
+        tag_count(shard, TAG_OBJECTS(tag), -1);
+    }
+}
+
+/* Background Reclaimer (reclaim.c)
+ *
+ * Both return false when the work was not queued, either because the
+ * reclaimer is disabled or because its queue is full; the caller then
+ * handles the memory itself.
+ */
+bool reclaim_submit_unmap(void *start, size_t length);
+bool reclaim_submit_purge(block_t *block);
+size_t reclaim_purge_free_list(void); /* Bytes released from listed free blocks */
+int reclaim_set_monitor(bool enabled); /* Run pressure_check() in the thread */
+void reclaim_print_stats(void);
+
+/* Memory Pressure Monitor (pressure.c)
+ *
+ * pressure_epoch grows by one each time pressure is relieved; per-thread
+ * caches compare it with the value they last saw and flush on a change.
+ */
+extern atomic_uint pressure_epoch;
+void pressure_check(void);
+void pressure_print_stats(void);
+
+/* Pre-Zeroed Pool (zero_pool.c)
+ *
+ * Returns a cleared chunk of at least size bytes, or NULL when the pool is
+ * disabled, the size is not eligible or the matching class is empty.
+ */
+void *zero_pool_take(size_t size);
+void zero_pool_release(void); /* Frees every pooled chunk to the heap */
+void zero_pool_print_stats(void);
+
+/* Small-Object Segments (segment.c)
+ *
+ * segment_alloc() returns NULL when segments are disabled, the size is too
+ * large or the reserved range is exhausted; the caller then uses the heap.
+ * The range check below is all free() needs to route a pointer.
+ */
+extern atomic_uintptr_t segment_arena_start;
+extern atomic_size_t segment_arena_size;
+
+static inline bool segment_owns(const void *ptr)
+{
+    uintptr_t start = atomic_load_explicit(&segment_arena_start, memory_order_relaxed);
+    size_t size = atomic_load_explicit(&segment_arena_size, memory_order_relaxed);
+    return (uintptr_t)ptr - start < size;
+}
+
+void *segment_alloc(size_t size, uint16_t tag);
+void segment_free(void *ptr);
+size_t segment_usable_size(const void *ptr);
+uint16_t segment_tag(const void *ptr);
+size_t segment_purge_dirty_pages(void); /* Bytes released from pooled empty pages */
+void segment_print_stats(void);
+
+/* Meshable Slabs (slab.c)
+ *
+ * slab_alloc() returns NULL when slabs are disabled, the size is too large
+ * or the range is exhausted. Like segment objects, slab objects carry no
+ * header and are routed by address.
+ */
+extern atomic_bool slabs_enabled;
+extern atomic_uintptr_t slab_arena_start;
+extern atomic_size_t slab_arena_size;
+
+static inline bool slab_owns(const void *ptr)
+{
+    uintptr_t start = atomic_load_explicit(&slab_arena_start, memory_order_relaxed);
+    size_t size = atomic_load_explicit(&slab_arena_size, memory_order_relaxed);
+    return (uintptr_t)ptr - start < size;
+}
+
+void *slab_alloc(size_t size, uint16_t tag);
+void slab_free(void *ptr);
+size_t slab_usable_size(const void *ptr);
+uint16_t slab_tag(const void *ptr);
+void slab_print_stats(void);
+
+/* Segment and slab objects have no block header; their page or slab
+ * carries the current tag */
+static inline void *headerless_alloc(size_t size)
+{
+    uint16_t tag = tag_for_allocation();
+    if (UNLIKELY(atomic_load_explicit(&slabs_enabled, memory_order_relaxed))) {
+        void *ptr = slab_alloc(size, tag);
+        if (ptr)
+            return ptr;
+    }
+    return segment_alloc(size, tag);
+}
+
+static inline bool is_headerless(const void *ptr)
+{
+    return segment_owns(ptr) || slab_owns(ptr);
+}
+
+static inline size_t headerless_usable_size(const void *ptr)
+{
+    return segment_owns(ptr) ? segment_usable_size(ptr) : slab_usable_size(ptr);
+}
+
+static inline uint16_t headerless_tag(const void *ptr)
+{
+    return segment_owns(ptr) ? segment_tag(ptr) : slab_tag(ptr);
+}
+
+/* Explicit Arenas (arena.c)
+ *
+ * arena_allocate_block() returns NULL when the arena does not exist or the
+ * request is too large for a chunk; the caller then uses a dedicated
+ * mapping. Blocks it returns have arena_id set, which is how free() and
+ * realloc() recognise them.
+ */
+bool arena_exists(unsigned index);
+block_t *arena_allocate_block(unsigned index, size_t size, size_t alignment);
+void arena_free_block(block_t *block);
+void arena_shrink_block(block_t *block, size_t size);
+size_t arena_purge_retained(void); /* Bytes released from empty retained chunks */
+void arena_print_stats(void);
+
+/* Lifetime Prediction (lifetime.c)
+ *
+ * lifetime_malloc() is malloc() for a known call site; free() passes every
+ * block carrying BLOCK_FLAG_SAMPLED to lifetime_record_free().
+ */
+extern atomic_bool lifetime_prediction_enabled;
+
+static inline bool lifetime_prediction_active(void)
+{
+    return atomic_load_explicit(&lifetime_prediction_enabled, memory_order_relaxed);
+}
+
+void *lifetime_malloc(size_t size, const void *caller);
+void lifetime_record_free(block_t *block);
+void lifetime_print_stats(void);
+
+/* Movable Handles (handle.c) */
+void handle_print_stats(void);
+
+/* Copy and Zero Kernels (memops.c) */
+void memops_zero_nontemporal(void *dst, size_t size); /* Streaming stores at any size */
+
+/* Fork Handlers
+ *
+ * allocator.c registers a single set of pthread_atfork() handlers. Before
+ * fork() they take every allocator lock, module by module in the order
+ * below, which is the order in which the code nests them; afterwards the
+ * parent releases them in reverse. The child reinitializes the core locks
+ * first and then calls each module's child hook, which reinitializes the
+ * module's locks and forgets the threads that did not survive the fork.
+ */
+void verify_atfork_child(void);
+void signal_safe_atfork_prepare(void);
+void signal_safe_atfork_parent(void);
+void signal_safe_atfork_child(void);
+void realtime_atfork_prepare(void);
+void realtime_atfork_parent(void);
+void realtime_atfork_child(void);
+void stack_atfork_prepare(void);
+void stack_atfork_parent(void);
+void stack_atfork_child(void);
+void io_buffer_atfork_prepare(void);
+void io_buffer_atfork_parent(void);
+void io_buffer_atfork_child(void);
+void tag_atfork_prepare(void);
+void tag_atfork_parent(void);
+void tag_atfork_child(void);
+void pressure_atfork_prepare(void);
+void pressure_atfork_parent(void);
+void pressure_atfork_child(void);
+void arena_atfork_prepare(void);
+void arena_atfork_parent(void);
+void arena_atfork_child(void);
+void lifetime_atfork_prepare(void);
+void lifetime_atfork_parent(void);
+void lifetime_atfork_child(void);
+void handle_atfork_prepare(void);
+void handle_atfork_parent(void);
+void handle_atfork_child(void);
+void slab_atfork_prepare(void);
+void slab_atfork_parent(void);
+void slab_atfork_child(void);
+void segment_atfork_prepare(void);
+void segment_atfork_parent(void);
+void segment_atfork_child(void);
+void zero_pool_atfork_prepare(void);
+void zero_pool_atfork_parent(void);
+void zero_pool_atfork_child(void);
+/* Taken between heap.heap_mutex and region_mutex */
+void reclaim_atfork_prepare(void);
+void reclaim_atfork_parent(void);
+void reclaim_atfork_child(void);
+
+#endif /* ALLOCATOR_INTERNAL_H */
@@ -0,0 +1,527 @@
+/*
+ * Memory Allocator - Explicit Arenas
+ *
+ * mallocx(..., MALLOCX_ARENA(a)) allocates from a separate arena: a list of
+ * ARENA_CHUNK_SIZE chunks, aligned to their size, with a lock of its own.
+ * Objects keep the normal block header, tagged with the arena index, so
+ * free() routes them here and masking the header address finds the chunk:
+ *
+ *   chunk = block & ~(ARENA_CHUNK_SIZE - 1)
+ *
+ * Freed blocks of every chunk go into per-arena bins by power-of-two size,
+ * and allocation reuses them first: a bounded first-fit scan of the bin
+ * for the request, then the head of any larger non-empty bin. Otherwise
+ * the arena's current chunk hands out memory from its bump pointer, and
+ * only when that is exhausted are the other chunks scanned for bump room
+ * before a new chunk is mapped. Freed blocks are not coalesced; instead a
+ * chunk whose last object is freed starts over from an empty bump pointer,
+ * or is unmapped when the arena has other chunks. Objects placed in the
+ * same arena tend to die together, which keeps that cheap.
+ *
+ * The ALLOC_HINT_* flags map onto three arenas created on first use. The
+ * cold arena hands every chunk it fills up to madvise(MADV_COLD), so the
+ * kernel deactivates those pages ahead of the rest of the process.
+ */
+
+#define _GNU_SOURCE
+
+#include "allocator_internal.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#ifndef MADV_COLD
+    #define MADV_COLD 20 /* Linux 5.4+, missing from older headers */
+#endif
+
+typedef struct arena_chunk {
+    struct arena_chunk *prev;
+    struct arena_chunk *next;
+    char *bump;         /* Start of the never-used tail */
+    char *dirty_end;    /* End of the memory used since the chunk was purged */
+    size_t live;        /* Objects currently allocated from this chunk */
+    unsigned arena;
+} arena_chunk_t;
+
+#define ARENA_CHUNK_HEADER ALIGN_SIZE(sizeof(arena_chunk_t))
+#define ARENA_CHUNK_CAPACITY (ARENA_CHUNK_SIZE - ARENA_CHUNK_HEADER)
+#define ARENA_BINS 16    /* Free blocks from 16 bytes, the last bin from 512KB up */
+#define ARENA_BIN_SCAN 8 /* Blocks of the request's own bin tried for a fit */
+
+typedef struct alloc_arena {
+    pthread_mutex_t mutex;
+    arena_chunk_t *chunks;     /* Most recently mapped first */
+    arena_chunk_t *current;    /* Chunk bump allocations come from */
+    block_t *bins[ARENA_BINS]; /* Freed blocks, linked through prev/next_free */
+    uint32_t binned;           /* Bit per bin that is not empty */
+    arena_stats_t stats;
+    bool cold; /* Serves ALLOC_HINT_COLD */
+} alloc_arena_t;
+
+#define ALLOC_HINT_SHIFT 12
+#define ALLOC_HINT_KINDS 4 /* None, short-lived, long-lived, cold */
+
+static alloc_arena_t arenas[ARENA_MAX];
+static atomic_uint arena_count = 1; /* Arena 0 is the main heap */
+static pthread_mutex_t arena_create_mutex = PTHREAD_MUTEX_INITIALIZER;
+static atomic_int hint_arenas[ALLOC_HINT_KINDS]; /* 0 until created */
+
+static inline arena_chunk_t *chunk_of(const block_t *block)
+{
+    return (arena_chunk_t *)((uintptr_t)block & ~(ARENA_CHUNK_SIZE - 1));
+}
+
+static inline char *chunk_end(arena_chunk_t *chunk)
+{
+    return (char *)chunk + ARENA_CHUNK_SIZE;
+}
+
+/* Hand the used part of a chunk to MADV_COLD; caller holds the arena mutex */
+static size_t advise_chunk_cold(alloc_arena_t *arena, arena_chunk_t *chunk)
+{
+    size_t length = PAGE_ALIGN((size_t)(chunk->bump - (char *)chunk));
+    if (madvise(chunk, length, MADV_COLD) != 0)
+        return 0; /* Kernels before 5.4 reject the advice */
+
+    arena->stats.cold_advised += length;
+    return length;
+}
+
+/* Map a chunk aligned to its own size; caller holds the arena mutex */
+static arena_chunk_t *map_chunk(alloc_arena_t *arena, unsigned index)
+{
+    size_t length = 2 * ARENA_CHUNK_SIZE;
+    char *raw = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) {
+        last_error = ALLOC_ERROR_OUT_OF_MEMORY;
+        return NULL;
+    }
+
+    char *start = (char *)(((uintptr_t)raw + ARENA_CHUNK_SIZE - 1) & ~(ARENA_CHUNK_SIZE - 1));
+    size_t lead = (size_t)(start - raw);
+    if (lead > 0) {
+        munmap(raw, lead);
+    }
+    munmap(start + ARENA_CHUNK_SIZE, ARENA_CHUNK_SIZE - lead);
+
+    /* A new chunk means the previous one filled up; cold data there is
+     * not going to be touched again soon */
+    if (arena->cold && arena->chunks) {
+        advise_chunk_cold(arena, arena->chunks);
+    }
+
+    arena_chunk_t *chunk = (arena_chunk_t *)start;
+    chunk->prev = NULL;
+    chunk->next = arena->chunks;
+    chunk->bump = start + ARENA_CHUNK_HEADER;
+    chunk->dirty_end = chunk->bump;
+    chunk->live = 0;
+    chunk->arena = index;
+
+    if (arena->chunks) {
+        arena->chunks->prev = chunk;
+    }
+    arena->chunks = chunk;
+    arena->current = chunk;
+    arena->stats.chunks++;
+    return chunk;
+}
+
+static void unlink_chunk(alloc_arena_t *arena, arena_chunk_t *chunk)
+{
+    if (chunk->prev) {
+        chunk->prev->next = chunk->next;
+    } else {
+        arena->chunks = chunk->next;
+    }
+    if (chunk->next) {
+        chunk->next->prev = chunk->prev;
+    }
+    if (arena->current == chunk) {
+        arena->current = NULL;
+    }
+    arena->stats.chunks--;
+}
+
+static inline unsigned bin_of(size_t size)
+{
+    unsigned log2 = 63u - (unsigned)__builtin_clzll((unsigned long long)size);
+    unsigned bin = log2 < 4 ? 0 : log2 - 4;
+    return bin < ARENA_BINS ? bin : ARENA_BINS - 1;
+}
+
+/* Caller holds the arena mutex, as for every bin operation */
+static void bin_insert(alloc_arena_t *arena, block_t *block)
+{
+    unsigned bin = bin_of(block->size);
+    block->prev_free = NULL;
+    block->next_free = arena->bins[bin];
+    if (block->next_free) {
+        block->next_free->prev_free = block;
+    }
+    arena->bins[bin] = block;
+    arena->binned |= 1u << bin;
+}
+
+static void bin_remove(alloc_arena_t *arena, block_t *block)
+{
+    unsigned bin = bin_of(block->size);
+    if (block->prev_free) {
+        block->prev_free->next_free = block->next_free;
+    } else {
+        arena->bins[bin] = block->next_free;
+        if (!block->next_free) {
+            arena->binned &= ~(1u << bin);
+        }
+    }
+    if (block->next_free) {
+        block->next_free->prev_free = block->prev_free;
+    }
+}
+
+/* A freed block of at least needed bytes, from any chunk of the arena */
+static block_t *bin_take(alloc_arena_t *arena, size_t needed)
+{
+    unsigned bin = bin_of(needed);
+    block_t *block = arena->bins[bin];
+    for (int scanned = 0; block && scanned < ARENA_BIN_SCAN; scanned++) {
+        if (block->size >= needed) {
+            bin_remove(arena, block);
+            return block;
+        }
+        block = block->next_free;
+    }
+
+    /* Every block in a larger bin fits */
+    uint32_t larger = arena->binned & ~((2u << bin) - 1);
+    if (!larger)
+        return NULL;
+    block = arena->bins[__builtin_ctz(larger)];
+    bin_remove(arena, block);
+    return block;
+}
+
+/* Take every block of a chunk with no live objects out of the bins. Blocks
+ * are never coalesced, so they tile the chunk up to the bump pointer. */
+static void unbin_chunk(alloc_arena_t *arena, arena_chunk_t *chunk)
+{
+    char *cursor = (char *)chunk + ARENA_CHUNK_HEADER;
+    while (cursor < chunk->bump) {
+        block_t *block = (block_t *)cursor;
+        bin_remove(arena, block);
+        cursor += HEADER_SIZE + block->size;
+    }
+}
+
+static block_t *bump_take(arena_chunk_t *chunk, size_t needed)
+{
+    if ((size_t)(chunk_end(chunk) - chunk->bump) < HEADER_SIZE + needed)
+        return NULL;
+    block_t *block = (block_t *)chunk->bump;
+    block->size = needed;
+    chunk->bump += HEADER_SIZE + needed;
+    return block;
+}
+
+/* Return the tail of a block beyond size to the bins */
+static void trim_block(alloc_arena_t *arena, block_t *block, size_t size)
+{
+    block_t *rest = split_block(block, size);
+    if (rest) {
+        bin_insert(arena, rest);
+    }
+}
+
+/* Turn a block of at least needed bytes into an allocated block whose user
+ * data is aligned to alignment; caller holds the arena mutex */
+static block_t *carve_block(alloc_arena_t *arena, block_t *block, size_t size, size_t alignment)
+{
+    arena_chunk_t *chunk = chunk_of(block);
+
+    if (alignment > ALIGNMENT) {
+        uintptr_t user = (uintptr_t)get_ptr_from_block(block);
+        uintptr_t aligned = (user + alignment - 1) & ~(alignment - 1);
+        if (aligned != user && aligned - user < MIN_BLOCK_SIZE) {
+            aligned += alignment;
+        }
+        if (aligned != user) {
+            /* The padding becomes a free block in front of the object */
+            block_t *front = block;
+            block = get_block_from_ptr((void *)aligned);
+            size_t front_size = (size_t)((char *)block - (char *)front) - HEADER_SIZE;
+            size_t block_size = front->size - front_size - HEADER_SIZE;
+
+            initialize_free_block(front, front_size);
+            bin_insert(arena, front);
+            block->size = block_size;
+        }
+    }
+
+    trim_block(arena, block, size);
+    initialize_allocated_block(block, block->size);
+    block->arena_id = (uint8_t)chunk->arena;
+    chunk->live++;
+    return block;
+}
+
+/* Caller holds arena_create_mutex */
+static int create_arena_locked(bool cold)
+{
+    unsigned index = atomic_load_explicit(&arena_count, memory_order_relaxed);
+    if (index >= ARENA_MAX)
+        return -1;
+
+    alloc_arena_t *arena = &arenas[index];
+    if (pthread_mutex_init(&arena->mutex, NULL) != 0)
+        return -1;
+    arena->chunks = NULL;
+    arena->current = NULL;
+    memset(arena->bins, 0, sizeof(arena->bins));
+    arena->binned = 0;
+    arena->stats = (arena_stats_t){0};
+    arena->cold = cold;
+    atomic_store_explicit(&arena_count, index + 1, memory_order_release);
+    return (int)index;
+}
+
+// cppcheck-suppress unusedFunction
+int allocator_arena_create(void)
+{
+    lock_mutex(&arena_create_mutex);
+    int index = create_arena_locked(false);
+    unlock_mutex(&arena_create_mutex);
+    return index;
+}
+
+// cppcheck-suppress unusedFunction
+int allocator_hint_arena(int hint)
+{
+    int kind = (int)(((unsigned)hint >> ALLOC_HINT_SHIFT) & (ALLOC_HINT_KINDS - 1));
+    if (kind == 0)
+        return -1;
+
+    int index = atomic_load_explicit(&hint_arenas[kind], memory_order_acquire);
+    if (index > 0)
+        return index;
+
+    lock_mutex(&arena_create_mutex);
+    index = atomic_load_explicit(&hint_arenas[kind], memory_order_relaxed);
+    if (index == 0) {
+        index = create_arena_locked(hint == ALLOC_HINT_COLD);
+        if (index > 0) {
+            atomic_store_explicit(&hint_arenas[kind], index, memory_order_release);
+        }
+    }
+    unlock_mutex(&arena_create_mutex);
+    return index;
+}
+
+// cppcheck-suppress unusedFunction
+size_t allocator_advise_cold(void)
+{
+    int index = atomic_load_explicit(
+        &hint_arenas[ALLOC_HINT_COLD >> ALLOC_HINT_SHIFT], memory_order_acquire);
+    if (index <= 0)
+        return 0;
+
+    alloc_arena_t *arena = &arenas[index];
+    size_t advised = 0;
+
+    lock_mutex(&arena->mutex);
+    for (arena_chunk_t *chunk = arena->chunks; chunk; chunk = chunk->next) {
+        advised += advise_chunk_cold(arena, chunk);
+    }
+    unlock_mutex(&arena->mutex);
+    return advised;
+}
+
+void arena_atfork_prepare(void)
+{
+    lock_mutex(&arena_create_mutex);
+    unsigned count = atomic_load_explicit(&arena_count, memory_order_acquire);
+    for (unsigned i = 1; i < count; i++) {
+        lock_mutex(&arenas[i].mutex);
+    }
+}
+
+void arena_atfork_parent(void)
+{
+    unsigned count = atomic_load_explicit(&arena_count, memory_order_relaxed);
+    for (unsigned i = count; i-- > 1;) {
+        unlock_mutex(&arenas[i].mutex);
+    }
+    unlock_mutex(&arena_create_mutex);
+}
+
+void arena_atfork_child(void)
+{
+    unsigned count = atomic_load_explicit(&arena_count, memory_order_relaxed);
+    for (unsigned i = 1; i < count; i++) {
+        pthread_mutex_init(&arenas[i].mutex, NULL);
+    }
+    pthread_mutex_init(&arena_create_mutex, NULL);
+}
+
+bool arena_exists(unsigned index)
+{
+    return index > 0 && index < atomic_load_explicit(&arena_count, memory_order_acquire);
+}
+
+block_t *arena_allocate_block(unsigned index, size_t size, size_t alignment)
+{
+    if (!arena_exists(index))
+        return NULL;
+
+    size_t actual_size = (size < MIN_ALLOC_SIZE) ? MIN_ALLOC_SIZE : size;
+    size_t aligned_size = ALIGN_SIZE(actual_size);
+
+    /* Too big to share a chunk: the caller falls back to a dedicated mapping */
+    if (aligned_size > ARENA_CHUNK_CAPACITY / 2 ||
+        alignment > ARENA_CHUNK_CAPACITY / 2 - aligned_size) {
+        return NULL;
+    }
+
+    /* Aligned requests over-allocate so that the padding in front can be
+     * left behind as a free block of its own */
+    size_t needed = aligned_size;
+    if (alignment > ALIGNMENT) {
+        needed += alignment + MIN_BLOCK_SIZE;
+    }
+
+    alloc_arena_t *arena = &arenas[index];
+
+    lock_mutex(&arena->mutex);
+    block_t *block = bin_take(arena, needed);
+    if (!block && arena->current) {
+        block = bump_take(arena->current, needed);
+    }
+    if (!block) {
+        /* Only on a miss: an older chunk may still have room at its tail */
+        for (arena_chunk_t *chunk = arena->chunks; chunk && !block; chunk = chunk->next) {
+            if (chunk != arena->current) {
+                block = bump_take(chunk, needed);
+                if (block) {
+                    arena->current = chunk;
+                }
+            }
+        }
+    }
+    if (!block) {
+        arena_chunk_t *chunk = map_chunk(arena, index);
+        if (chunk) {
+            block = bump_take(chunk, needed);
+        }
+    }
+    if (block) {
+        block = carve_block(arena, block, aligned_size, alignment);
+        arena->stats.allocated += block->size;
+        arena->stats.live_objects++;
+    }
+    unlock_mutex(&arena->mutex);
+
+    return block;
+}
+
+void arena_free_block(block_t *block)
+{
+    arena_chunk_t *chunk = chunk_of(block);
+    alloc_arena_t *arena = &arenas[chunk->arena];
+    arena_chunk_t *unmap = NULL;
+
+    lock_mutex(&arena->mutex);
+    arena->stats.allocated -= block->size;
+    arena->stats.live_objects--;
+
+    initialize_free_block(block, block->size);
+    bin_insert(arena, block);
+
+    if (--chunk->live == 0) {
+        unbin_chunk(arena, chunk);
+        if (arena->chunks == chunk && !chunk->next) {
+            /* Keep the arena's last chunk, but start it over */
+            if (chunk->bump > chunk->dirty_end) {
+                chunk->dirty_end = chunk->bump;
+            }
+            chunk->bump = (char *)chunk + ARENA_CHUNK_HEADER;
+        } else {
+            unlink_chunk(arena, chunk);
+            unmap = chunk;
+        }
+    }
+    unlock_mutex(&arena->mutex);
+
+    if (unmap) {
+        munmap(unmap, ARENA_CHUNK_SIZE);
+    }
+}
+
+/* Shrink an arena block in place to at least size bytes */
+void arena_shrink_block(block_t *block, size_t size)
+{
+    arena_chunk_t *chunk = chunk_of(block);
+    alloc_arena_t *arena = &arenas[chunk->arena];
+    size_t old_size = block->size;
+
+    lock_mutex(&arena->mutex);
+    trim_block(arena, block, size);
+    arena->stats.allocated -= old_size - block->size;
+    unlock_mutex(&arena->mutex);
+}
+
+/* Release the pages an empty arena's retained chunk has used. The chunk
+ * holds no objects, so the one madvise() per arena under its own lock
+ * stalls nothing but an allocation in that arena. */
+size_t arena_purge_retained(void)
+{
+    size_t purged = 0;
+    unsigned count = atomic_load_explicit(&arena_count, memory_order_acquire);
+
+    for (unsigned i = 1; i < count; i++) {
+        alloc_arena_t *arena = &arenas[i];
+        lock_mutex(&arena->mutex);
+        arena_chunk_t *chunk = arena->chunks;
+        if (chunk && chunk->live == 0) {
+            /* The first page holds the chunk header */
+            char *start = (char *)PAGE_ALIGN((uintptr_t)chunk + ARENA_CHUNK_HEADER);
+            char *end = (char *)PAGE_ALIGN((uintptr_t)chunk->dirty_end);
+            if (end > start && madvise(start, (size_t)(end - start), MADV_DONTNEED) == 0) {
+                purged += (size_t)(end - start);
+            }
+            chunk->dirty_end = chunk->bump;
+        }
+        unlock_mutex(&arena->mutex);
+    }
+    return purged;
+}
+
+// cppcheck-suppress unusedFunction
+int allocator_arena_stats(unsigned index, arena_stats_t *stats)
+{
+    if (!stats || !arena_exists(index))
+        return -1;
+
+    alloc_arena_t *arena = &arenas[index];
+    lock_mutex(&arena->mutex);
+    *stats = arena->stats;
+    unlock_mutex(&arena->mutex);
+    return 0;
+}
+
+void arena_print_stats(void)
+{
+    unsigned count = atomic_load_explicit(&arena_count, memory_order_acquire);
+    if (count <= 1)
+        return;
+
+    for (unsigned i = 1; i < count; i++) {
+        arena_stats_t stats;
+        allocator_arena_stats(i, &stats);
+        printf("Arena %u%s chunks/live objects/bytes: %zu/%zu/%zu\n",
+               i,
+               arenas[i].cold ? " (cold)" : "",
+               stats.chunks,
+               stats.live_objects,
+               stats.allocated);
+    }
+}
@@ -0,0 +1,370 @@
+/*
+ * Memory Allocator - Movable Handles and Online Compaction
+ *
+ * Blocks in the main heap are reached through raw pointers and can never
+ * move, so a long-running process slowly loses memory to holes. Objects
+ * allocated with handle_alloc() live in a separate handle heap instead and
+ * are reached through a handle that handle_lock() resolves. While no lock
+ * is held the allocator is free to move the object.
+ *
+ * The handle heap is one virtual range reserved up front, HANDLE_HEAP_SIZE
+ * long, in which objects sit back to back behind a 16-byte header naming
+ * their handle, so the range can be walked. heap_compact(budget) slides
+ * live, unlocked objects towards the start of the range. A pass keeps a
+ * scan cursor and a destination cursor and resumes where the previous call
+ * stopped, examining roughly budget bytes per call. Locked objects stay
+ * where they are and the gap in front of one becomes a hole. When the scan
+ * reaches the top, the top drops to the destination cursor and the pages
+ * above it are released with madvise().
+ *
+ * Between passes allocation reuses holes first-fit, then bumps the top.
+ * During a pass only holes below the destination cursor are reused, since
+ * everything above it may still be overwritten by moved objects.
+ */
+
+#define _GNU_SOURCE
+
+#include "allocator_internal.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define HANDLE_MAX ((uint32_t)1 << 20) /* Handles that can exist at once */
+#define HANDLE_MAGIC 0xC0FFEE11u
+
+typedef struct handle_object {
+    size_t size;     /* Payload bytes, a multiple of ALIGNMENT */
+    uint32_t handle; /* Owning handle, 0 for a hole */
+    uint32_t magic;
+} handle_object_t;
+
+/* Holes are linked through their first payload word */
+typedef struct handle_hole {
+    handle_object_t header;
+    struct handle_hole *next;
+} handle_hole_t;
+
+typedef struct handle_entry {
+    handle_object_t *object; /* NULL while the handle is unused */
+    uint32_t pins;           /* Outstanding handle_lock() calls */
+    uint32_t next_free;      /* Next unused handle, while unused */
+} handle_entry_t;
+
+#define HANDLE_HEADER sizeof(handle_object_t)
+#define HANDLE_MIN_HOLE (HANDLE_HEADER + MIN_ALLOC_SIZE)
+
+static struct {
+    pthread_mutex_t mutex;
+    char *start;      /* Reserved range */
+    char *top;        /* End of the last object */
+    char *mapped_top; /* Highest address touched since the last trim */
+    handle_hole_t *holes;
+
+    handle_entry_t *table;
+    uint32_t table_used; /* Handles handed out at least once, starting at 1 */
+    uint32_t free_handles;
+
+    bool compacting;
+    char *scan; /* Next object the current pass looks at */
+    char *dest; /* Where the next movable object goes */
+
+    handle_stats_t stats;
+} handles = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+/* Reserve the heap range and handle table; caller holds handles.mutex */
+static int init_handles_locked(void)
+{
+    if (handles.start)
+        return 0;
+
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+    size_t table_size = HANDLE_MAX * sizeof(handle_entry_t);
+    void *table = mmap(NULL, table_size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (table == MAP_FAILED)
+        return -1;
+
+    void *start = mmap(NULL, HANDLE_HEAP_SIZE, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (start == MAP_FAILED) {
+        munmap(table, table_size);
+        return -1;
+    }
+
+    handles.table = table;
+    handles.table_used = 1; /* Handle 0 is HANDLE_NULL */
+    handles.start = start;
+    handles.top = start;
+    handles.mapped_top = start;
+    return 0;
+}
+
+/* Resolve a handle that is in use; caller holds handles.mutex */
+static handle_entry_t *entry_of(handle_t handle)
+{
+    if (handle == HANDLE_NULL || handle >= handles.table_used || !handles.table[handle].object) {
+        last_error = ALLOC_ERROR_INVALID_POINTER;
+        return NULL;
+    }
+    return &handles.table[handle];
+}
+
+static void push_hole(handle_object_t *object)
+{
+    handle_hole_t *hole = (handle_hole_t *)object;
+    object->handle = 0;
+    hole->next = handles.holes;
+    handles.holes = hole;
+}
+
+/* First-fit from the hole list, splitting off what is left over */
+static handle_object_t *take_hole(size_t size)
+{
+    for (handle_hole_t **link = &handles.holes; *link; link = &(*link)->next) {
+        handle_hole_t *hole = *link;
+        if (hole->header.size < size)
+            continue;
+
+        *link = hole->next;
+        if (hole->header.size - size >= HANDLE_MIN_HOLE) {
+            handle_object_t *rest = (handle_object_t *)((char *)hole + HANDLE_HEADER + size);
+            rest->size = hole->header.size - size - HANDLE_HEADER;
+            rest->magic = HANDLE_MAGIC;
+            push_hole(rest);
+            hole->header.size = size;
+        }
+        return &hole->header;
+    }
+    return NULL;
+}
+
+// cppcheck-suppress unusedFunction
+handle_t handle_alloc(size_t size)
+{
+    if (size == 0 || size > HANDLE_HEAP_SIZE / 2) {
+        last_error = ALLOC_ERROR_INVALID_SIZE;
+        return HANDLE_NULL;
+    }
+    size_t payload = ALIGN_SIZE(size < MIN_ALLOC_SIZE ? MIN_ALLOC_SIZE : size);
+
+    lock_mutex(&handles.mutex);
+
+    if (init_handles_locked() != 0 ||
+        (handles.free_handles == 0 && handles.table_used == HANDLE_MAX)) {
+        unlock_mutex(&handles.mutex);
+        last_error = ALLOC_ERROR_OUT_OF_MEMORY;
+        return HANDLE_NULL;
+    }
+
+    handle_object_t *object = take_hole(payload);
+    if (!object) {
+        if ((size_t)(handles.start + HANDLE_HEAP_SIZE - handles.top) < HANDLE_HEADER + payload) {
+            unlock_mutex(&handles.mutex);
+            last_error = ALLOC_ERROR_OUT_OF_MEMORY;
+            return HANDLE_NULL;
+        }
+        object = (handle_object_t *)handles.top;
+        object->size = payload;
+        handles.top += HANDLE_HEADER + payload;
+        if (handles.top > handles.mapped_top) {
+            handles.mapped_top = handles.top;
+        }
+    }
+
+    handle_t handle = handles.free_handles;
+    if (handle != HANDLE_NULL) {
+        handles.free_handles = handles.table[handle].next_free;
+    } else {
+        handle = handles.table_used++;
+    }
+
+    object->handle = handle;
+    object->magic = HANDLE_MAGIC;
+    handles.table[handle].object = object;
+    handles.table[handle].pins = 0;
+    handles.stats.live_objects++;
+    handles.stats.live_bytes += object->size;
+
+    unlock_mutex(&handles.mutex);
+    return handle;
+}
+
+// cppcheck-suppress unusedFunction
+void *handle_lock(handle_t handle)
+{
+    lock_mutex(&handles.mutex);
+    handle_entry_t *entry = entry_of(handle);
+    void *ptr = NULL;
+    if (entry) {
+        entry->pins++;
+        ptr = (char *)entry->object + HANDLE_HEADER;
+    }
+    unlock_mutex(&handles.mutex);
+    return ptr;
+}
+
+// cppcheck-suppress unusedFunction
+void handle_unlock(handle_t handle)
+{
+    lock_mutex(&handles.mutex);
+    handle_entry_t *entry = entry_of(handle);
+    if (entry && entry->pins > 0) {
+        entry->pins--;
+    }
+    unlock_mutex(&handles.mutex);
+}
+
+// cppcheck-suppress unusedFunction
+void handle_free(handle_t handle)
+{
+    if (handle == HANDLE_NULL)
+        return;
+
+    lock_mutex(&handles.mutex);
+    handle_entry_t *entry = entry_of(handle);
+    if (!entry || entry->pins > 0) {
+        /* Freeing a locked object would pull it out from under its user */
+        last_error = ALLOC_ERROR_INVALID_POINTER;
+        unlock_mutex(&handles.mutex);
+        return;
+    }
+
+    handle_object_t *object = entry->object;
+    handles.stats.live_objects--;
+    handles.stats.live_bytes -= object->size;
+
+    entry->object = NULL;
+    entry->next_free = handles.free_handles;
+    handles.free_handles = handle;
+
+    char *end = (char *)object + HANDLE_HEADER + object->size;
+    if (end == handles.top) {
+        handles.top = (char *)object;
+    } else if (!handles.compacting || (char *)object < handles.dest) {
+        push_hole(object);
+    } else {
+        /* Not yet scanned: the running pass will slide over it */
+        object->handle = 0;
+    }
+    unlock_mutex(&handles.mutex);
+}
+
+/* Finish a pass: drop the top and give the pages above it back */
+static void finish_pass_locked(void)
+{
+    handles.top = handles.dest;
+    handles.compacting = false;
+    handles.stats.passes++;
+
+    char *keep = (char *)PAGE_ALIGN((uintptr_t)handles.top);
+    if (handles.mapped_top > keep) {
+        size_t length = (size_t)(handles.mapped_top - keep);
+        if (madvise(keep, length, MADV_DONTNEED) == 0) {
+            handles.stats.bytes_trimmed += length;
+        }
+        handles.mapped_top = keep;
+    }
+}
+
+// cppcheck-suppress unusedFunction
+int heap_compact(size_t budget)
+{
+    lock_mutex(&handles.mutex);
+
+    if (!handles.start) {
+        unlock_mutex(&handles.mutex);
+        return 1;
+    }
+
+    if (!handles.compacting) {
+        /* Every hole is at or above the destination cursor now, and the
+         * scan will find them all */
+        handles.compacting = true;
+        handles.scan = handles.start;
+        handles.dest = handles.start;
+        handles.holes = NULL;
+    }
+
+    size_t work = 0;
+    while (handles.scan < handles.top && work < budget) {
+        handle_object_t *object = (handle_object_t *)handles.scan;
+        size_t span = HANDLE_HEADER + object->size;
+        handles.scan += span;
+        work += HANDLE_HEADER;
+
+        if (object->handle == 0)
+            continue;
+
+        handle_entry_t *entry = &handles.table[object->handle];
+        if (entry->pins > 0) {
+            /* Locked objects stay put; the gap in front becomes a hole */
+            if ((char *)object > handles.dest) {
+                handle_object_t *gap = (handle_object_t *)handles.dest;
+                gap->size = (size_t)((char *)object - handles.dest) - HANDLE_HEADER;
+                gap->magic = HANDLE_MAGIC;
+                push_hole(gap);
+            }
+            handles.dest = (char *)object + span;
+            continue;
+        }
+
+        if ((char *)object != handles.dest) {
+            memmove(handles.dest, object, span);
+            entry->object = (handle_object_t *)handles.dest;
+            handles.stats.bytes_moved += span;
+            work += span;
+        }
+        handles.dest += span;
+    }
+
+    int done = handles.scan >= handles.top;
+    if (done) {
+        finish_pass_locked();
+    }
+
+    unlock_mutex(&handles.mutex);
+    return done;
+}
+
+void handle_atfork_prepare(void)
+{
+    lock_mutex(&handles.mutex);
+}
+
+void handle_atfork_parent(void)
+{
+    unlock_mutex(&handles.mutex);
+}
+
+void handle_atfork_child(void)
+{
+    pthread_mutex_init(&handles.mutex, NULL);
+}
+
+// cppcheck-suppress unusedFunction
+void allocator_handle_stats(handle_stats_t *stats)
+{
+    if (!stats)
+        return;
+
+    lock_mutex(&handles.mutex);
+    *stats = handles.stats;
+    stats->heap_bytes = (size_t)(handles.top - handles.start);
+    unlock_mutex(&handles.mutex);
+}
+
+void handle_print_stats(void)
+{
+    handle_stats_t stats;
+    allocator_handle_stats(&stats);
+    if (stats.passes == 0 && stats.live_objects == 0)
+        return;
+
+    printf("Handle objects/bytes/heap extent: %zu/%zu/%zu\n",
+           stats.live_objects,
+           stats.live_bytes,
+           stats.heap_bytes);
+    printf("Compaction passes/bytes moved/bytes trimmed: %zu/%zu/%zu\n",
+           stats.passes,
+           stats.bytes_moved,
+           stats.bytes_trimmed);
+}
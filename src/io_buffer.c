@@ -0,0 +1,350 @@
+/*
+ * Memory Allocator - I/O Buffer Pool
+ *
+ * O_DIRECT and registered-buffer io_uring need page-aligned buffers that a
+ * storage engine allocates and drops on every request. posix_memalign()
+ * pays for the alignment with a padded block each time, and a buffer that
+ * was registered with the kernel must not be unmapped while the
+ * registration lasts. io_buffer_alloc() serves power-of-two size classes
+ * from IO_BUFFER_MIN_SIZE to IO_BUFFER_MAX_SIZE out of chunks that are
+ * never unmapped, so a buffer's address stays valid for the life of the
+ * process and can be locked into memory with the rest of the pool.
+ *
+ * Chunks come from acquire_memory_mmap(), so the heap tracks them as live
+ * mapped blocks. Each mapping is twice IO_BUFFER_CHUNK_SIZE so that an
+ * aligned chunk fits inside it after the block header's page; the slack is
+ * never touched and costs only address space. A buffer finds its chunk by
+ * masking its address and the chunk's size class in a lock-free table,
+ * which only ever grows, like the pool. The page below each chunk holds a
+ * bit per IO_BUFFER_MIN_SIZE slot, set while the buffer there is handed
+ * out, so io_buffer_free() catches double frees.
+ *
+ * Freed buffers go to a per-thread cache, up to IO_BUFFER_CACHE_BYTES per
+ * class, and from there to a shared list per class, so the usual
+ * alloc/read/free cycle takes no lock.
+ */
+
+#define _GNU_SOURCE
+
+#include "allocator_internal.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#define IO_CLASSES 9 /* IO_BUFFER_MIN_SIZE << 0 ... IO_BUFFER_MIN_SIZE << 8 */
+#define IO_CACHE_DEPTH 32
+#define IO_CHUNK_SLOTS 4096 /* Chunk table size, power of two; at most half is used */
+
+_Static_assert(IO_BUFFER_MIN_SIZE << (IO_CLASSES - 1) == IO_BUFFER_MAX_SIZE, "I/O classes");
+
+typedef struct io_chunk {
+    atomic_uintptr_t start; /* Chunk address, 0 while the slot is unused */
+    uint32_t size_class;    /* Set before start is published */
+} io_chunk_t;
+
+/* Free buffers are linked through their first word */
+typedef struct io_free {
+    struct io_free *next;
+} io_free_t;
+
+typedef struct io_class {
+    char *carve;   /* Next unused buffer in the newest chunk */
+    char *end;     /* End of the newest chunk */
+    io_free_t *free_list;
+} io_class_t;
+
+typedef struct io_cache {
+    void *buffers[IO_CLASSES][IO_CACHE_DEPTH];
+    unsigned counts[IO_CLASSES];
+    bool registered;
+} io_cache_t;
+
+static struct {
+    pthread_mutex_t mutex;
+    io_class_t classes[IO_CLASSES];
+    io_chunk_t chunks[IO_CHUNK_SLOTS];
+    bool locked; /* Chunks are mlock()ed, new ones included */
+    io_buffer_stats_t stats;
+} pool = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+static __thread io_cache_t io_cache;
+static pthread_key_t io_exit_key;
+static pthread_once_t io_exit_once = PTHREAD_ONCE_INIT;
+
+static inline size_t class_buffer_size(int index)
+{
+    return IO_BUFFER_MIN_SIZE << index;
+}
+
+static inline unsigned class_cache_depth(int index)
+{
+    size_t depth = IO_BUFFER_CACHE_BYTES / class_buffer_size(index);
+    return depth < IO_CACHE_DEPTH ? (unsigned)depth : IO_CACHE_DEPTH;
+}
+
+static int io_class_of(size_t size)
+{
+    int index = 0;
+    while (index < IO_CLASSES && class_buffer_size(index) < size) {
+        index++;
+    }
+    return index;
+}
+
+static inline uint32_t hash_chunk(uintptr_t start)
+{
+    uint64_t x = (uint64_t)start / IO_BUFFER_CHUNK_SIZE;
+    x *= 0x9E3779B97F4A7C15ULL;
+    return (uint32_t)(x >> 40);
+}
+
+/* Chunk holding buf, or NULL for anything else */
+static const io_chunk_t *chunk_of(const void *buf)
+{
+    if (!buf || ((uintptr_t)buf & (ALLOC_PAGE_SIZE - 1)))
+        return NULL;
+
+    uintptr_t start = (uintptr_t)buf & ~(uintptr_t)(IO_BUFFER_CHUNK_SIZE - 1);
+    uint32_t slot = hash_chunk(start);
+    for (uint32_t probe = 0; probe < IO_CHUNK_SLOTS; probe++) {
+        const io_chunk_t *chunk = &pool.chunks[(slot + probe) & (IO_CHUNK_SLOTS - 1)];
+        uintptr_t key = atomic_load_explicit(&chunk->start, memory_order_acquire);
+        if (key == start)
+            return chunk;
+        if (key == 0)
+            return NULL;
+    }
+    return NULL;
+}
+
+/* Set or clear buf's bit in its chunk's live map; returns the old state */
+static bool mark_live(const void *buf, bool live)
+{
+    uintptr_t start = (uintptr_t)buf & ~(uintptr_t)(IO_BUFFER_CHUNK_SIZE - 1);
+    size_t slot = ((uintptr_t)buf - start) / IO_BUFFER_MIN_SIZE;
+    atomic_ullong *word = (atomic_ullong *)(start - ALLOC_PAGE_SIZE) + slot / 64;
+    unsigned long long bit = 1ULL << (slot % 64);
+
+    unsigned long long old = live ? atomic_fetch_or_explicit(word, bit, memory_order_relaxed)
+                                  : atomic_fetch_and_explicit(word, ~bit, memory_order_relaxed);
+    return (old & bit) != 0;
+}
+
+static int lock_chunk(uintptr_t start, bool locked)
+{
+    char *page = (char *)start - ALLOC_PAGE_SIZE;
+    size_t length = IO_BUFFER_CHUNK_SIZE + ALLOC_PAGE_SIZE;
+    return locked ? mlock(page, length) : munlock(page, length);
+}
+
+/* Map a chunk for a class; caller holds pool.mutex */
+static bool add_chunk(int index)
+{
+    if (pool.stats.chunks >= IO_CHUNK_SLOTS / 2) {
+        last_error = ALLOC_ERROR_OUT_OF_MEMORY;
+        return false;
+    }
+
+    size_t length = 2 * IO_BUFFER_CHUNK_SIZE;
+    char *mapping = acquire_memory_mmap(length);
+    if (!mapping)
+        return false;
+
+    /* The block header owns the mapping's first page */
+    uintptr_t start = ((uintptr_t)mapping + ALLOC_PAGE_SIZE + IO_BUFFER_CHUNK_SIZE - 1) &
+                      ~(uintptr_t)(IO_BUFFER_CHUNK_SIZE - 1);
+    if (pool.locked && lock_chunk(start, true) != 0) {
+        pool.locked = false;
+    }
+
+    uint32_t slot = hash_chunk(start);
+    io_chunk_t *chunk = &pool.chunks[slot & (IO_CHUNK_SLOTS - 1)];
+    while (atomic_load_explicit(&chunk->start, memory_order_relaxed) != 0) {
+        chunk = &pool.chunks[++slot & (IO_CHUNK_SLOTS - 1)];
+    }
+    chunk->size_class = (uint32_t)index;
+    atomic_store_explicit(&chunk->start, start, memory_order_release);
+
+    pool.classes[index].carve = (char *)start;
+    pool.classes[index].end = (char *)start + IO_BUFFER_CHUNK_SIZE;
+    pool.stats.chunks++;
+    pool.stats.bytes_mapped += length;
+    return true;
+}
+
+static void *take_shared(int index)
+{
+    io_class_t *class = &pool.classes[index];
+    void *buf = NULL;
+
+    lock_mutex(&pool.mutex);
+    if (class->free_list) {
+        buf = class->free_list;
+        class->free_list = class->free_list->next;
+        pool.stats.shared_reuses++;
+    } else if (class->carve != class->end || add_chunk(index)) {
+        buf = class->carve;
+        class->carve += class_buffer_size(index);
+        pool.stats.carved++;
+    }
+    unlock_mutex(&pool.mutex);
+    return buf;
+}
+
+static void give_shared(void *buf, int index)
+{
+    io_free_t *node = buf;
+
+    lock_mutex(&pool.mutex);
+    node->next = pool.classes[index].free_list;
+    pool.classes[index].free_list = node;
+    unlock_mutex(&pool.mutex);
+}
+
+static void io_thread_exit(void *arg)
+{
+    io_cache_t *cache = arg;
+
+    for (int i = 0; i < IO_CLASSES; i++) {
+        while (cache->counts[i] > 0) {
+            give_shared(cache->buffers[i][--cache->counts[i]], i);
+        }
+    }
+    cache->registered = false;
+}
+
+static void io_exit_key_init(void)
+{
+    pthread_key_create(&io_exit_key, io_thread_exit);
+}
+
+void io_buffer_atfork_prepare(void)
+{
+    lock_mutex(&pool.mutex);
+}
+
+void io_buffer_atfork_parent(void)
+{
+    unlock_mutex(&pool.mutex);
+}
+
+/* Buffers cached by threads that did not survive the fork are never reused */
+void io_buffer_atfork_child(void)
+{
+    pthread_mutex_init(&pool.mutex, NULL);
+}
+
+// cppcheck-suppress unusedFunction
+void *io_buffer_alloc(size_t size)
+{
+    if (size == 0 || size > IO_BUFFER_MAX_SIZE) {
+        last_error = ALLOC_ERROR_INVALID_SIZE;
+        return NULL;
+    }
+
+    int index = io_class_of(size);
+    io_cache_t *cache = &io_cache;
+    void *buf = LIKELY(cache->counts[index] > 0) ? cache->buffers[index][--cache->counts[index]]
+                                                  : take_shared(index);
+    if (buf) {
+        mark_live(buf, true);
+    }
+    return buf;
+}
+
+// cppcheck-suppress unusedFunction
+void io_buffer_free(void *buf)
+{
+    if (!buf)
+        return;
+
+    const io_chunk_t *chunk = chunk_of(buf);
+    int index = chunk ? (int)chunk->size_class : 0;
+    uintptr_t start = chunk ? atomic_load_explicit(&chunk->start, memory_order_relaxed) : 0;
+    if (!chunk || ((uintptr_t)buf - start) % class_buffer_size(index) != 0) {
+        last_error = ALLOC_ERROR_INVALID_POINTER;
+        return;
+    }
+    if (!mark_live(buf, false)) {
+        fprintf(stderr, "Double free detected at %p\n", buf);
+        abort();
+    }
+
+    io_cache_t *cache = &io_cache;
+    if (UNLIKELY(!cache->registered)) {
+        /* The exit hook gives cached buffers back to the shared lists */
+        cache->registered = true;
+        pthread_once(&io_exit_once, io_exit_key_init);
+        pthread_setspecific(io_exit_key, cache);
+    }
+
+    if (cache->counts[index] < class_cache_depth(index)) {
+        cache->buffers[index][cache->counts[index]++] = buf;
+        return;
+    }
+    give_shared(buf, index);
+}
+
+// cppcheck-suppress unusedFunction
+size_t io_buffer_size(const void *buf)
+{
+    const io_chunk_t *chunk = chunk_of(buf);
+    return chunk ? class_buffer_size((int)chunk->size_class) : 0;
+}
+
+// cppcheck-suppress unusedFunction
+int allocator_set_io_buffer_mlock(bool enabled)
+{
+    int result = 0;
+
+    lock_mutex(&pool.mutex);
+    int locked = 0;
+    for (int i = 0; i < IO_CHUNK_SLOTS && result == 0; i++) {
+        uintptr_t start = atomic_load_explicit(&pool.chunks[i].start, memory_order_relaxed);
+        if (start) {
+            result = lock_chunk(start, enabled);
+            locked = i;
+        }
+    }
+    if (enabled && result != 0) {
+        /* All or nothing: unlock the chunks locked so far */
+        int saved = errno;
+        for (int i = 0; i < locked; i++) {
+            uintptr_t start = atomic_load_explicit(&pool.chunks[i].start, memory_order_relaxed);
+            if (start) {
+                lock_chunk(start, false);
+            }
+        }
+        errno = saved;
+    }
+    pool.locked = enabled && result == 0;
+    unlock_mutex(&pool.mutex);
+    return result;
+}
+
+// cppcheck-suppress unusedFunction
+void allocator_io_buffer_stats(io_buffer_stats_t *stats)
+{
+    if (!stats)
+        return;
+
+    lock_mutex(&pool.mutex);
+    *stats = pool.stats;
+    stats->bytes_locked = pool.locked ? pool.stats.chunks * IO_BUFFER_CHUNK_SIZE : 0;
+    unlock_mutex(&pool.mutex);
+}
+
+void io_buffer_print_stats(void)
+{
+    io_buffer_stats_t stats;
+    allocator_io_buffer_stats(&stats);
+
+    if (stats.chunks == 0)
+        return;
+    printf("I/O buffer chunks/bytes locked: %zu/%zu\n", stats.chunks, stats.bytes_locked);
+    printf("I/O buffers carved/reused from shared lists: %zu/%zu\n",
+           stats.carved,
+           stats.shared_reuses);
+}
@@ -0,0 +1,266 @@
+/*
+ * Memory Allocator - Allocation-Site Lifetime Prediction
+ *
+ * Not every caller can pass ALLOC_HINT_SHORT_LIVED, so when prediction is
+ * enabled malloc() learns lifetimes per call site instead. One allocation
+ * in LIFETIME_SAMPLE_INTERVAL per thread is sampled: the return address
+ * identifies its site, and the block is flagged so that free() reports how
+ * many allocations the process made in between. A site whose sampled
+ * objects nearly all die within LIFETIME_SHORT_ALLOCATIONS is predicted
+ * short-lived, and its allocations go to the nursery - the arena behind
+ * ALLOC_HINT_SHORT_LIVED - where they no longer pin heap pages between
+ * long-lived neighbours.
+ *
+ * The allocation clock only advances when a thread takes a sample, by the
+ * sampling interval, so it costs one relaxed atomic add per sample rather
+ * than per allocation. Per-site counts are halved every
+ * LIFETIME_SITE_WINDOW samples so a site that changes behaviour is
+ * re-learned. Accuracy is measured on the sampled objects themselves.
+ */
+
+#define _GNU_SOURCE
+
+#include "allocator_internal.h"
+
+#include <stdio.h>
+
+#define LIFETIME_SITES 1024       /* Call sites tracked, power of two */
+#define LIFETIME_SAMPLES 4096     /* Sampled objects tracked at once, power of two */
+#define LIFETIME_SAMPLE_PROBES 16 /* Slots searched for a sampled object */
+#define LIFETIME_MIN_SAMPLES 4    /* Samples before a site gets a prediction */
+#define LIFETIME_SITE_WINDOW 64   /* Samples after which a site's counts decay */
+
+enum { PREDICT_NONE, PREDICT_SHORT, PREDICT_LONG };
+
+typedef struct site {
+    atomic_uintptr_t address; /* Return address, 0 while unused */
+    atomic_uchar prediction;  /* PREDICT_*, read without the lock */
+    uint32_t samples;
+    uint32_t short_lived;
+} site_t;
+
+typedef struct sample {
+    const block_t *block; /* NULL while unused */
+    size_t born;          /* Allocation clock at allocation */
+    uint32_t site;
+    uint8_t prediction; /* What the site predicted when the object was allocated */
+} sample_t;
+
+static struct {
+    pthread_mutex_t mutex;
+    site_t sites[LIFETIME_SITES];
+    sample_t samples[LIFETIME_SAMPLES];
+    lifetime_stats_t stats;
+} lifetime = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+atomic_bool lifetime_prediction_enabled = false;
+static atomic_size_t lifetime_clock;
+static atomic_size_t nursery_allocations;
+static __thread unsigned sample_countdown;
+
+static inline uint32_t hash_address(uintptr_t address)
+{
+    uint64_t x = (uint64_t)address;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return (uint32_t)x;
+}
+
+/* Lock-free: sites are only ever added, and a key never changes once set */
+static const site_t *lookup_site(uintptr_t address)
+{
+    uint32_t slot = hash_address(address);
+    for (uint32_t probe = 0; probe < LIFETIME_SITES; probe++) {
+        const site_t *site = &lifetime.sites[(slot + probe) & (LIFETIME_SITES - 1)];
+        uintptr_t key = atomic_load_explicit(&site->address, memory_order_acquire);
+        if (key == address)
+            return site;
+        if (key == 0)
+            return NULL;
+    }
+    return NULL;
+}
+
+/* Caller holds lifetime.mutex; returns the site's index or -1 when full */
+static int insert_site(uintptr_t address)
+{
+    uint32_t slot = hash_address(address);
+    for (uint32_t probe = 0; probe < LIFETIME_SITES; probe++) {
+        uint32_t index = (slot + probe) & (LIFETIME_SITES - 1);
+        site_t *site = &lifetime.sites[index];
+        uintptr_t key = atomic_load_explicit(&site->address, memory_order_relaxed);
+        if (key == address)
+            return (int)index;
+        if (key == 0) {
+            atomic_store_explicit(&site->address, address, memory_order_release);
+            lifetime.stats.sites++;
+            return (int)index;
+        }
+    }
+    return -1;
+}
+
+static void record_sample(block_t *block, uintptr_t address, uint8_t prediction)
+{
+    uint32_t slot = hash_address((uintptr_t)block);
+
+    lock_mutex(&lifetime.mutex);
+    int site = insert_site(address);
+    for (uint32_t probe = 0; site >= 0 && probe < LIFETIME_SAMPLE_PROBES; probe++) {
+        sample_t *sample = &lifetime.samples[(slot + probe) & (LIFETIME_SAMPLES - 1)];
+        if (!sample->block) {
+            sample->block = block;
+            sample->born = atomic_load_explicit(&lifetime_clock, memory_order_relaxed);
+            sample->site = (uint32_t)site;
+            sample->prediction = prediction;
+            block->flags |= BLOCK_FLAG_SAMPLED;
+            lifetime.stats.sampled++;
+            break;
+        }
+    }
+    unlock_mutex(&lifetime.mutex);
+}
+
+void lifetime_record_free(block_t *block)
+{
+    uint32_t slot = hash_address((uintptr_t)block);
+    size_t now = atomic_load_explicit(&lifetime_clock, memory_order_relaxed);
+
+    block->flags &= (uint8_t)~BLOCK_FLAG_SAMPLED;
+
+    lock_mutex(&lifetime.mutex);
+    for (uint32_t probe = 0; probe < LIFETIME_SAMPLE_PROBES; probe++) {
+        sample_t *sample = &lifetime.samples[(slot + probe) & (LIFETIME_SAMPLES - 1)];
+        if (sample->block != block)
+            continue;
+
+        bool short_lived = now - sample->born < LIFETIME_SHORT_ALLOCATIONS;
+        site_t *site = &lifetime.sites[sample->site];
+        site->samples++;
+        site->short_lived += short_lived;
+        if (site->samples >= LIFETIME_SITE_WINDOW) {
+            site->samples /= 2;
+            site->short_lived /= 2;
+        }
+        if (site->samples >= LIFETIME_MIN_SAMPLES) {
+            /* Only sites that are short-lived nine times in ten qualify */
+            bool predict_short = site->short_lived * 10 >= site->samples * 9;
+            atomic_store_explicit(&site->prediction,
+                                  predict_short ? PREDICT_SHORT : PREDICT_LONG,
+                                  memory_order_relaxed);
+        }
+
+        if (sample->prediction != PREDICT_NONE) {
+            lifetime.stats.predictions++;
+            lifetime.stats.correct += (sample->prediction == PREDICT_SHORT) == short_lived;
+        }
+        sample->block = NULL;
+        break;
+    }
+    unlock_mutex(&lifetime.mutex);
+}
+
+void lifetime_atfork_prepare(void)
+{
+    lock_mutex(&lifetime.mutex);
+}
+
+void lifetime_atfork_parent(void)
+{
+    unlock_mutex(&lifetime.mutex);
+}
+
+void lifetime_atfork_child(void)
+{
+    pthread_mutex_init(&lifetime.mutex, NULL);
+}
+
+void *lifetime_malloc(size_t size, const void *caller)
+{
+    if (size == 0)
+        return NULL;
+
+    uintptr_t address = (uintptr_t)caller;
+    const site_t *site = lookup_site(address);
+    uint8_t prediction =
+        site ? atomic_load_explicit(&site->prediction, memory_order_relaxed) : PREDICT_NONE;
+
+    bool sampled = sample_countdown == 0;
+    if (sampled) {
+        sample_countdown = LIFETIME_SAMPLE_INTERVAL - 1;
+        atomic_fetch_add_explicit(&lifetime_clock, LIFETIME_SAMPLE_INTERVAL, memory_order_relaxed);
+    } else {
+        sample_countdown--;
+    }
+
+    block_t *block = NULL;
+    if (prediction == PREDICT_SHORT) {
+        int nursery = allocator_hint_arena(ALLOC_HINT_SHORT_LIVED);
+        if (nursery > 0) {
+            block = arena_allocate_block((unsigned)nursery, size, ALIGNMENT);
+        }
+        if (block) {
+            atomic_fetch_add_explicit(&nursery_allocations, 1, memory_order_relaxed);
+        }
+    }
+
+    if (!block) {
+        /* Sampled objects need a header to carry the flag */
+        if (!sampled) {
+            void *ptr = headerless_alloc(size);
+            if (ptr)
+                return ptr;
+        }
+        block = allocate_block(size);
+        if (!block)
+            return NULL;
+    }
+
+    if (sampled) {
+        record_sample(block, address, prediction);
+    }
+    return get_ptr_from_block(block);
+}
+
+// cppcheck-suppress unusedFunction
+int allocator_set_lifetime_prediction(bool enabled)
+{
+    atomic_store_explicit(&lifetime_prediction_enabled, enabled, memory_order_relaxed);
+    return 0;
+}
+
+// cppcheck-suppress unusedFunction
+void allocator_lifetime_stats(lifetime_stats_t *stats)
+{
+    if (!stats)
+        return;
+
+    lock_mutex(&lifetime.mutex);
+    *stats = lifetime.stats;
+    stats->short_lived_sites = 0;
+    for (int i = 0; i < LIFETIME_SITES; i++) {
+        if (atomic_load_explicit(&lifetime.sites[i].prediction, memory_order_relaxed) ==
+            PREDICT_SHORT) {
+            stats->short_lived_sites++;
+        }
+    }
+    unlock_mutex(&lifetime.mutex);
+
+    stats->nursery_allocations = atomic_load_explicit(&nursery_allocations, memory_order_relaxed);
+}
+
+void lifetime_print_stats(void)
+{
+    lifetime_stats_t stats;
+    allocator_lifetime_stats(&stats);
+
+    printf("Lifetime prediction: %s\n",
+           atomic_load_explicit(&lifetime_prediction_enabled, memory_order_relaxed) ? "ON"
+                                                                                   : "OFF");
+    printf("Lifetime sites/short-lived/nursery allocations: %zu/%zu/%zu\n",
+           stats.sites,
+           stats.short_lived_sites,
+           stats.nursery_allocations);
+    printf("Lifetime predictions correct: %zu/%zu\n", stats.correct, stats.predictions);
+}
@@ -0,0 +1,241 @@
+/*
+ * Memory Allocator - Copy and Zero Kernels
+ *
+ * realloc() and calloc() move and clear whole blocks, and for large blocks
+ * that work dominates the call. The kernels here pick a strategy by size:
+ * - below MEMOPS_REP_THRESHOLD: libc memcpy()/memset(), which inline well
+ * - medium sizes: rep movsb / rep stosb when the CPU advertises fast string
+ *   instructions (ERMS), which the microcode turns into full-line writes
+ * - from MEMOPS_NONTEMPORAL_THRESHOLD up: AVX2 or SSE2 streaming stores,
+ *   which bypass the cache so a huge copy does not evict the caller's
+ *   working set (and the data being written is rarely read back soon)
+ *
+ * CPU features are read with cpuid once at load time. Until then, and on
+ * CPUs or compilers without the needed features, libc does all the work.
+ */
+
+#define _GNU_SOURCE
+
+#include "allocator_internal.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+    #define HAVE_X86_KERNELS 1
+    #include <cpuid.h>
+    #include <immintrin.h>
+
+    #ifndef bit_ERMS
+        #define bit_ERMS (1 << 9) /* CPUID.(EAX=7,ECX=0):EBX, missing from older cpuid.h */
+    #endif
+#endif
+
+static struct {
+    bool erms; /* Enhanced rep movsb/stosb */
+    bool avx2; /* AVX2 usable: CPU support and OS-enabled YMM state */
+    const char *name;
+} cpu = {.name = "libc"};
+
+static atomic_int memops_mode = MEMOPS_TUNED;
+
+#ifdef HAVE_X86_KERNELS
+
+static bool os_saves_ymm_state(void)
+{
+    uint32_t lo;
+    uint32_t hi;
+
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return (lo & 0x6) == 0x6; /* XMM and YMM state enabled in XCR0 */
+}
+
+__attribute__((constructor)) static void detect_cpu_features(void)
+{
+    unsigned int eax;
+    unsigned int ebx;
+    unsigned int ecx;
+    unsigned int edx;
+    bool osxsave = false;
+
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        osxsave = (ecx & bit_OSXSAVE) != 0;
+    }
+    if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+        cpu.erms = (ebx & bit_ERMS) != 0;
+        cpu.avx2 = (ebx & bit_AVX2) != 0 && osxsave && os_saves_ymm_state();
+    }
+
+    if (cpu.erms) {
+        cpu.name = cpu.avx2 ? "erms+avx2-nt" : "erms+sse2-nt";
+    } else {
+        cpu.name = cpu.avx2 ? "avx2-nt" : "sse2-nt";
+    }
+}
+
+static inline void rep_movsb(void *dst, const void *src, size_t size)
+{
+    __asm__ volatile("rep movsb" : "+D"(dst), "+S"(src), "+c"(size) : : "memory");
+}
+
+static inline void rep_stosb(void *dst, size_t size)
+{
+    __asm__ volatile("rep stosb" : "+D"(dst), "+c"(size) : "a"(0) : "memory");
+}
+
+/* Bytes to copy with plain stores before dst reaches the given alignment */
+static inline size_t head_bytes(const void *dst, size_t align, size_t size)
+{
+    size_t head = (align - ((uintptr_t)dst & (align - 1))) & (align - 1);
+    return head < size ? head : size;
+}
+
+__attribute__((target("avx2"))) static void copy_avx2_nt(char *dst, const char *src, size_t size)
+{
+    size_t head = head_bytes(dst, 32, size);
+    memcpy(dst, src, head);
+    dst += head;
+    src += head;
+    size -= head;
+
+    for (; size >= 128; size -= 128, dst += 128, src += 128) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)src);
+        __m256i b = _mm256_loadu_si256((const __m256i *)(src + 32));
+        __m256i c = _mm256_loadu_si256((const __m256i *)(src + 64));
+        __m256i d = _mm256_loadu_si256((const __m256i *)(src + 96));
+        _mm256_stream_si256((__m256i *)dst, a);
+        _mm256_stream_si256((__m256i *)(dst + 32), b);
+        _mm256_stream_si256((__m256i *)(dst + 64), c);
+        _mm256_stream_si256((__m256i *)(dst + 96), d);
+    }
+    _mm_sfence();
+    memcpy(dst, src, size);
+}
+
+__attribute__((target("avx2"))) static void zero_avx2_nt(char *dst, size_t size)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    size_t head = head_bytes(dst, 32, size);
+
+    memset(dst, 0, head);
+    dst += head;
+    size -= head;
+
+    for (; size >= 128; size -= 128, dst += 128) {
+        _mm256_stream_si256((__m256i *)dst, zero);
+        _mm256_stream_si256((__m256i *)(dst + 32), zero);
+        _mm256_stream_si256((__m256i *)(dst + 64), zero);
+        _mm256_stream_si256((__m256i *)(dst + 96), zero);
+    }
+    _mm_sfence();
+    memset(dst, 0, size);
+}
+
+static void copy_sse2_nt(char *dst, const char *src, size_t size)
+{
+    size_t head = head_bytes(dst, 16, size);
+    memcpy(dst, src, head);
+    dst += head;
+    src += head;
+    size -= head;
+
+    for (; size >= 64; size -= 64, dst += 64, src += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i *)src);
+        __m128i b = _mm_loadu_si128((const __m128i *)(src + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(src + 32));
+        __m128i d = _mm_loadu_si128((const __m128i *)(src + 48));
+        _mm_stream_si128((__m128i *)dst, a);
+        _mm_stream_si128((__m128i *)(dst + 16), b);
+        _mm_stream_si128((__m128i *)(dst + 32), c);
+        _mm_stream_si128((__m128i *)(dst + 48), d);
+    }
+    _mm_sfence();
+    memcpy(dst, src, size);
+}
+
+static void zero_sse2_nt(char *dst, size_t size)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t head = head_bytes(dst, 16, size);
+
+    memset(dst, 0, head);
+    dst += head;
+    size -= head;
+
+    for (; size >= 64; size -= 64, dst += 64) {
+        _mm_stream_si128((__m128i *)dst, zero);
+        _mm_stream_si128((__m128i *)(dst + 16), zero);
+        _mm_stream_si128((__m128i *)(dst + 32), zero);
+        _mm_stream_si128((__m128i *)(dst + 48), zero);
+    }
+    _mm_sfence();
+    memset(dst, 0, size);
+}
+
+#endif /* HAVE_X86_KERNELS */
+
+void memops_zero_nontemporal(void *dst, size_t size)
+{
+#ifdef HAVE_X86_KERNELS
+    if (cpu.avx2) {
+        zero_avx2_nt(dst, size);
+    } else {
+        zero_sse2_nt(dst, size);
+    }
+#else
+    memset(dst, 0, size);
+#endif
+}
+
+// cppcheck-suppress unusedFunction
+void allocator_copy(void *dst, const void *src, size_t size)
+{
+#ifdef HAVE_X86_KERNELS
+    if (size >= MEMOPS_REP_THRESHOLD &&
+        atomic_load_explicit(&memops_mode, memory_order_relaxed) == MEMOPS_TUNED) {
+        if (size >= MEMOPS_NONTEMPORAL_THRESHOLD) {
+            if (cpu.avx2) {
+                copy_avx2_nt(dst, src, size);
+            } else {
+                copy_sse2_nt(dst, src, size);
+            }
+            return;
+        }
+        if (cpu.erms) {
+            rep_movsb(dst, src, size);
+            return;
+        }
+    }
+#endif
+    memcpy(dst, src, size);
+}
+
+// cppcheck-suppress unusedFunction
+void allocator_zero(void *dst, size_t size)
+{
+#ifdef HAVE_X86_KERNELS
+    if (size >= MEMOPS_REP_THRESHOLD &&
+        atomic_load_explicit(&memops_mode, memory_order_relaxed) == MEMOPS_TUNED) {
+        if (size >= MEMOPS_NONTEMPORAL_THRESHOLD) {
+            memops_zero_nontemporal(dst, size);
+            return;
+        }
+        if (cpu.erms) {
+            rep_stosb(dst, size);
+            return;
+        }
+    }
+#endif
+    memset(dst, 0, size);
+}
+
+// cppcheck-suppress unusedFunction
+void allocator_set_memops_mode(memops_mode_t mode)
+{
+    atomic_store_explicit(&memops_mode, mode, memory_order_relaxed);
+}
+
+// cppcheck-suppress unusedFunction
+const char *allocator_memops_kernels(void)
+{
+    return cpu.name;
+}
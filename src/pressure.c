@@ -0,0 +1,308 @@
+/*
+ * Memory Allocator - Memory Pressure Monitor
+ *
+ * The allocator only learns that memory is short when sbrk() or mmap()
+ * fails, long after the kernel has started reclaiming and the system has
+ * slowed down. With the monitor enabled the background reclaimer thread
+ * reads two earlier signals every PRESSURE_CHECK_MS:
+ * - /proc/pressure/memory (PSI): the "some" total of microseconds during
+ *   which tasks stalled on memory; growth of PRESSURE_STALL_US or more
+ *   since the last check is pressure
+ * - the memory.events file of the process's cgroup: any new "high",
+ *   "max", "oom" or "oom_kill" event is pressure
+ *
+ * On pressure the allocator gives back what it holds without needing it:
+ * the pre-zeroed pool is emptied into the heap, and then, as malloc_trim()
+ * does, the heap top is trimmed and the whole pages inside free heap
+ * blocks, pooled empty segment pages and empty arena chunks are purged.
+ * Only those purged bytes are reported. The pressure epoch is bumped, so
+ * every thread flushes its deferred frees on its next free() and drains
+ * its explicit thread cache on its next cache_alloc() or cache_free().
+ * Both are thread-local and unlocked, so this is best-effort: a thread
+ * that does not call into the allocator again keeps what it holds.
+ *
+ * The totals are read with pread() on descriptors opened once, rather than
+ * through PSI trigger descriptors, which need privileges for short windows
+ * and cannot share a wait with the reclaimer's job queue.
+ */
+
+#define _GNU_SOURCE
+
+#include "allocator_internal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PRESSURE_PATH_MAX 256
+#define PRESSURE_READ_MAX 1024
+
+static struct {
+    pthread_mutex_t mutex;
+    char psi_path[PRESSURE_PATH_MAX];    /* Empty for the default */
+    char events_path[PRESSURE_PATH_MAX]; /* Empty for the default */
+    bool psi_disabled;
+    bool events_disabled;
+    int psi_fd;
+    int events_fd;
+    uint64_t psi_total;    /* At the last check */
+    uint64_t events_total; /* At the last check */
+    pressure_stats_t stats;
+} monitor = {.mutex = PTHREAD_MUTEX_INITIALIZER, .psi_fd = -1, .events_fd = -1};
+
+atomic_uint pressure_epoch;
+
+/* Contents of fd from the start, NUL-terminated; false when unreadable */
+static bool read_source(int fd, char *buf, size_t size)
+{
+    ssize_t length = pread(fd, buf, size - 1, 0);
+    if (length < 0)
+        return false;
+    buf[length] = '\0';
+    return true;
+}
+
+/* The "some" line's total= field */
+static bool parse_psi_total(const char *text, uint64_t *total)
+{
+    const char *line = strstr(text, "some ");
+    const char *field = line ? strstr(line, "total=") : NULL;
+    if (!field)
+        return false;
+    *total = strtoull(field + strlen("total="), NULL, 10);
+    return true;
+}
+
+/* Sum of the event counters that mean the cgroup is short of memory */
+static uint64_t parse_events_total(const char *text)
+{
+    static const char *const keys[] = {"high ", "max ", "oom ", "oom_kill "};
+    uint64_t total = 0;
+
+    for (const char *line = text; line; line = strchr(line, '\n')) {
+        line += *line == '\n';
+        for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+            if (strncmp(line, keys[i], strlen(keys[i])) == 0) {
+                total += strtoull(line + strlen(keys[i]), NULL, 10);
+            }
+        }
+    }
+    return total;
+}
+
+/* memory.events of the cgroup v2 group the process belongs to */
+static bool default_events_path(char *path, size_t size)
+{
+    char text[PRESSURE_READ_MAX];
+    int fd = open("/proc/self/cgroup", O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    bool ok = read_source(fd, text, sizeof(text));
+    close(fd);
+
+    const char *line = ok ? strstr(text, "0::") : NULL;
+    if (!line)
+        return false;
+    line += strlen("0::");
+    size_t length = strcspn(line, "\n");
+    if (length == 1) {
+        length = 0; /* The root group: avoid a double slash */
+    }
+    int written = snprintf(path, size, "/sys/fs/cgroup%.*s/memory.events", (int)length, line);
+    return written > 0 && (size_t)written < size;
+}
+
+static int open_source(const char *path)
+{
+    return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+/* Open both sources and take their current totals; caller holds the mutex */
+static int open_sources_locked(void)
+{
+    char text[PRESSURE_READ_MAX];
+    char path[PRESSURE_PATH_MAX];
+
+    if (!monitor.psi_disabled) {
+        const char *psi = monitor.psi_path[0] ? monitor.psi_path : "/proc/pressure/memory";
+        monitor.psi_fd = open_source(psi);
+        if (monitor.psi_fd >= 0 &&
+            (!read_source(monitor.psi_fd, text, sizeof(text)) ||
+             !parse_psi_total(text, &monitor.psi_total))) {
+            close(monitor.psi_fd);
+            monitor.psi_fd = -1;
+        }
+    }
+
+    if (!monitor.events_disabled) {
+        const char *events = monitor.events_path;
+        if (!events[0]) {
+            events = default_events_path(path, sizeof(path)) ? path : NULL;
+        }
+        monitor.events_fd = events ? open_source(events) : -1;
+        if (monitor.events_fd >= 0) {
+            if (read_source(monitor.events_fd, text, sizeof(text))) {
+                monitor.events_total = parse_events_total(text);
+            } else {
+                close(monitor.events_fd);
+                monitor.events_fd = -1;
+            }
+        }
+    }
+
+    if (monitor.psi_fd < 0 && monitor.events_fd < 0) {
+        errno = ENOENT;
+        return -1;
+    }
+    return 0;
+}
+
+static void close_sources_locked(void)
+{
+    if (monitor.psi_fd >= 0) {
+        close(monitor.psi_fd);
+        monitor.psi_fd = -1;
+    }
+    if (monitor.events_fd >= 0) {
+        close(monitor.events_fd);
+        monitor.events_fd = -1;
+    }
+}
+
+/* Give back memory the allocator holds but does not need; returns bytes */
+static size_t relieve_pressure(void)
+{
+    atomic_fetch_add_explicit(&pressure_epoch, 1, memory_order_relaxed);
+
+    /* The pool's chunks reach the heap through this thread's deferred
+     * frees, which release_free_memory() flushes before purging */
+    zero_pool_release();
+    return release_free_memory(0);
+}
+
+void pressure_check(void)
+{
+    char text[PRESSURE_READ_MAX];
+    bool psi_pressure = false;
+    bool events_pressure = false;
+
+    lock_mutex(&monitor.mutex);
+    monitor.stats.checks++;
+
+    uint64_t total;
+    if (monitor.psi_fd >= 0 && read_source(monitor.psi_fd, text, sizeof(text)) &&
+        parse_psi_total(text, &total)) {
+        psi_pressure = total >= monitor.psi_total + PRESSURE_STALL_US;
+        monitor.psi_total = total;
+    }
+    if (monitor.events_fd >= 0 && read_source(monitor.events_fd, text, sizeof(text))) {
+        total = parse_events_total(text);
+        events_pressure = total > monitor.events_total;
+        monitor.events_total = total;
+    }
+    unlock_mutex(&monitor.mutex);
+
+    if (!psi_pressure && !events_pressure)
+        return;
+
+    size_t released = relieve_pressure();
+
+    /* Events are counted once handled, so a reader that sees one also sees
+     * what it released */
+    lock_mutex(&monitor.mutex);
+    monitor.stats.psi_events += psi_pressure;
+    monitor.stats.cgroup_events += events_pressure;
+    monitor.stats.bytes_released += released;
+    unlock_mutex(&monitor.mutex);
+}
+
+void pressure_atfork_prepare(void)
+{
+    lock_mutex(&monitor.mutex);
+}
+
+void pressure_atfork_parent(void)
+{
+    unlock_mutex(&monitor.mutex);
+}
+
+void pressure_atfork_child(void)
+{
+    pthread_mutex_init(&monitor.mutex, NULL);
+}
+
+static void copy_path(char *dst, bool *disabled, const char *src)
+{
+    *disabled = src && !src[0];
+    snprintf(dst, PRESSURE_PATH_MAX, "%s", src ? src : "");
+}
+
+// cppcheck-suppress unusedFunction
+int allocator_set_pressure_paths(const char *psi_path, const char *events_path)
+{
+    if ((psi_path && strlen(psi_path) >= PRESSURE_PATH_MAX) ||
+        (events_path && strlen(events_path) >= PRESSURE_PATH_MAX)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    lock_mutex(&monitor.mutex);
+    copy_path(monitor.psi_path, &monitor.psi_disabled, psi_path);
+    copy_path(monitor.events_path, &monitor.events_disabled, events_path);
+
+    /* A running monitor switches to the new sources */
+    int result = 0;
+    if (monitor.psi_fd >= 0 || monitor.events_fd >= 0) {
+        close_sources_locked();
+        result = open_sources_locked();
+    }
+    unlock_mutex(&monitor.mutex);
+    return result;
+}
+
+// cppcheck-suppress unusedFunction
+int allocator_set_pressure_monitor(bool enabled)
+{
+    lock_mutex(&monitor.mutex);
+    close_sources_locked();
+    int result = enabled ? open_sources_locked() : 0;
+    unlock_mutex(&monitor.mutex);
+
+    if (result != 0)
+        return -1;
+    if (reclaim_set_monitor(enabled) != 0) {
+        lock_mutex(&monitor.mutex);
+        close_sources_locked();
+        unlock_mutex(&monitor.mutex);
+        return -1;
+    }
+    return 0;
+}
+
+// cppcheck-suppress unusedFunction
+void allocator_pressure_stats(pressure_stats_t *stats)
+{
+    if (!stats)
+        return;
+
+    lock_mutex(&monitor.mutex);
+    *stats = monitor.stats;
+    unlock_mutex(&monitor.mutex);
+}
+
+void pressure_print_stats(void)
+{
+    pressure_stats_t stats;
+    allocator_pressure_stats(&stats);
+
+    if (stats.checks == 0)
+        return;
+    printf("Pressure checks/PSI events/cgroup events: %zu/%zu/%zu\n",
+           stats.checks,
+           stats.psi_events,
+           stats.cgroup_events);
+    printf("Pressure bytes released: %zu\n", stats.bytes_released);
+}
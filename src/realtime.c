@@ -0,0 +1,352 @@
+/*
+ * Memory Allocator - Real-Time Heap
+ *
+ * The main heap may call sbrk() or mmap(), touch fresh pages and walk a
+ * free list of any length, none of which a thread with a deadline can
+ * afford. allocator_realtime_init() maps one pool up front, faults it in and
+ * locks it into memory; rt_alloc() and rt_free() then work only inside it.
+ *
+ * The pool is managed as a two-level segregated fit (TLSF) heap. Free blocks
+ * sit on one list per size range: a first level per power of two, split
+ * into RT_SL_COUNT linear second-level ranges, with a bitmap per level
+ * marking the non-empty lists. Allocation rounds the request up to the
+ * start of the next range, so that any block on the list it picks fits,
+ * and finds that list with two find-first-set instructions; the block is
+ * split and the remainder listed again. Free merges with both physical
+ * neighbours, found through the size and a back pointer in each header,
+ * and lists the result. Neither operation loops over blocks, so each is
+ * a bounded number of steps whatever the pool's state: at most two bitmap
+ * searches, two list removals and one insertion to allocate, and three
+ * removals and one insertion to free. Rounding up wastes at most
+ * 1/RT_SL_COUNT of a request.
+ *
+ * The pool's lock uses priority inheritance, so a low-priority holder
+ * cannot stall a real-time waiter behind unrelated work. Only a contended
+ * lock enters the kernel; threads that share the pool rarely, or not at
+ * all, never do.
+ */
+
+#define _GNU_SOURCE
+
+#include "allocator_internal.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#define RT_SL_LOG2 4
+#define RT_SL_COUNT (1 << RT_SL_LOG2)           /* Second-level lists per power of two */
+#define RT_FL_SHIFT (RT_SL_LOG2 + 4)            /* log2(ALIGNMENT) below the first level */
+#define RT_SMALL_BLOCK ((size_t)1 << RT_FL_SHIFT) /* Below this, lists are ALIGNMENT apart */
+#define RT_FL_COUNT 32
+#define RT_MAX_POOL ((size_t)1 << (RT_FL_COUNT + RT_FL_SHIFT - 2))
+#define RT_BLOCK_FREE ((size_t)1) /* In rt_block_t.size */
+
+typedef struct rt_block {
+    struct rt_block *prev_phys; /* Block just below, NULL for the first */
+    size_t size;                /* Payload bytes | RT_BLOCK_FREE */
+    /* The payload starts here; free blocks keep their list links in it */
+    struct rt_block *next_free;
+    struct rt_block *prev_free;
+} rt_block_t;
+
+#define RT_HEADER offsetof(rt_block_t, next_free)
+#define RT_MIN_PAYLOAD (sizeof(rt_block_t) - RT_HEADER)
+
+static struct {
+    pthread_mutex_t mutex;
+    char *start;
+    size_t size;
+    uint32_t fl_bitmap;
+    uint32_t sl_bitmap[RT_FL_COUNT];
+    rt_block_t *lists[RT_FL_COUNT][RT_SL_COUNT];
+    realtime_stats_t stats;
+} rt = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+static atomic_bool rt_claimed; /* allocator_realtime_init() has started */
+static atomic_bool rt_ready;   /* ... and the pool is usable */
+
+static inline size_t block_size(const rt_block_t *block)
+{
+    return block->size & ~RT_BLOCK_FREE;
+}
+
+static inline bool block_is_free(const rt_block_t *block)
+{
+    return block->size & RT_BLOCK_FREE;
+}
+
+static inline rt_block_t *next_phys(const rt_block_t *block)
+{
+    return (rt_block_t *)((char *)block + RT_HEADER + block_size(block));
+}
+
+static inline int top_bit(size_t value)
+{
+    return (int)(sizeof(size_t) * 8 - 1) - __builtin_clzl(value);
+}
+
+/* List that a block of size bytes belongs to */
+static void mapping_insert(size_t size, int *fl, int *sl)
+{
+    if (size < RT_SMALL_BLOCK) {
+        *fl = 0;
+        *sl = (int)(size / ALIGNMENT);
+    } else {
+        int top = top_bit(size);
+        *sl = (int)(size >> (top - RT_SL_LOG2)) ^ RT_SL_COUNT;
+        *fl = top - RT_FL_SHIFT + 1;
+    }
+}
+
+/* First list whose every block holds size bytes, or NULL */
+static rt_block_t *find_suitable(size_t size, int *fl, int *sl)
+{
+    if (size >= RT_SMALL_BLOCK) {
+        size += ((size_t)1 << (top_bit(size) - RT_SL_LOG2)) - 1;
+    }
+    mapping_insert(size, fl, sl);
+    if (*fl >= RT_FL_COUNT)
+        return NULL;
+
+    uint32_t sl_map = rt.sl_bitmap[*fl] & (~0u << *sl);
+    if (!sl_map) {
+        uint32_t fl_map = *fl + 1 < RT_FL_COUNT ? rt.fl_bitmap & (~0u << (*fl + 1)) : 0;
+        if (!fl_map)
+            return NULL;
+        *fl = __builtin_ctz(fl_map);
+        sl_map = rt.sl_bitmap[*fl];
+    }
+    *sl = __builtin_ctz(sl_map);
+    return rt.lists[*fl][*sl];
+}
+
+static void insert_free(rt_block_t *block)
+{
+    int fl, sl;
+    mapping_insert(block_size(block), &fl, &sl);
+
+    block->size |= RT_BLOCK_FREE;
+    block->prev_free = NULL;
+    block->next_free = rt.lists[fl][sl];
+    if (block->next_free) {
+        block->next_free->prev_free = block;
+    }
+    rt.lists[fl][sl] = block;
+    rt.fl_bitmap |= 1u << fl;
+    rt.sl_bitmap[fl] |= 1u << sl;
+}
+
+static void remove_free(rt_block_t *block, int fl, int sl)
+{
+    if (block->prev_free) {
+        block->prev_free->next_free = block->next_free;
+    } else {
+        rt.lists[fl][sl] = block->next_free;
+        if (!rt.lists[fl][sl]) {
+            rt.sl_bitmap[fl] &= ~(1u << sl);
+            if (!rt.sl_bitmap[fl]) {
+                rt.fl_bitmap &= ~(1u << fl);
+            }
+        }
+    }
+    if (block->next_free) {
+        block->next_free->prev_free = block->prev_free;
+    }
+    block->size &= ~RT_BLOCK_FREE;
+}
+
+static void unlink_free(rt_block_t *block)
+{
+    int fl, sl;
+    mapping_insert(block_size(block), &fl, &sl);
+    remove_free(block, fl, sl);
+}
+
+/* Give the tail of a block beyond size bytes back to the free lists */
+static void split_tail(rt_block_t *block, size_t size)
+{
+    size_t available = block_size(block);
+    if (available < size + RT_HEADER + RT_MIN_PAYLOAD)
+        return;
+
+    rt_block_t *rest = (rt_block_t *)((char *)block + RT_HEADER + size);
+    rest->prev_phys = block;
+    rest->size = available - size - RT_HEADER;
+    next_phys(rest)->prev_phys = rest;
+    block->size = size;
+    insert_free(rest);
+}
+
+static void init_rt_mutex(void)
+{
+    pthread_mutexattr_t attributes;
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_setprotocol(&attributes, PTHREAD_PRIO_INHERIT);
+    pthread_mutex_init(&rt.mutex, &attributes);
+    pthread_mutexattr_destroy(&attributes);
+}
+
+void realtime_atfork_prepare(void)
+{
+    lock_mutex(&rt.mutex);
+}
+
+void realtime_atfork_parent(void)
+{
+    unlock_mutex(&rt.mutex);
+}
+
+void realtime_atfork_child(void)
+{
+    init_rt_mutex();
+}
+
+// cppcheck-suppress unusedFunction
+int allocator_realtime_init(size_t pool_size)
+{
+    pool_size = PAGE_ALIGN(pool_size);
+    if (pool_size < ALLOC_PAGE_SIZE || pool_size > RT_MAX_POOL) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (atomic_exchange(&rt_claimed, true)) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    char *start = mmap(NULL,
+                       pool_size,
+                       PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE,
+                       -1,
+                       0);
+    if (start == MAP_FAILED || mlock(start, pool_size) != 0) {
+        int saved = errno;
+        if (start != MAP_FAILED) {
+            munmap(start, pool_size);
+        }
+        atomic_store(&rt_claimed, false);
+        errno = saved;
+        return -1;
+    }
+
+    init_rt_mutex();
+
+    /* One free block spanning the pool, then a header that is never free
+     * so merging stops at the end */
+    rt_block_t *block = (rt_block_t *)start;
+    block->prev_phys = NULL;
+    block->size = pool_size - 2 * RT_HEADER;
+    rt_block_t *end = next_phys(block);
+    end->prev_phys = block;
+    end->size = 0;
+
+    rt.start = start;
+    rt.size = pool_size;
+    rt.stats.pool_size = pool_size;
+    insert_free(block);
+
+    atomic_store_explicit(&rt_ready, true, memory_order_release);
+    return 0;
+}
+
+// cppcheck-suppress unusedFunction
+void *rt_alloc(size_t size)
+{
+    if (size == 0 || size > RT_MAX_POOL || !atomic_load_explicit(&rt_ready, memory_order_acquire))
+        return NULL;
+
+    size = ALIGN_SIZE(size);
+    if (size < RT_MIN_PAYLOAD) {
+        size = RT_MIN_PAYLOAD;
+    }
+
+    lock_mutex(&rt.mutex);
+    int fl, sl;
+    rt_block_t *block = find_suitable(size, &fl, &sl);
+    if (!block) {
+        rt.stats.failures++;
+        unlock_mutex(&rt.mutex);
+        last_error = ALLOC_ERROR_OUT_OF_MEMORY;
+        return NULL;
+    }
+
+    remove_free(block, fl, sl);
+    split_tail(block, size);
+
+    rt.stats.allocations++;
+    rt.stats.used += RT_HEADER + block_size(block);
+    if (rt.stats.used > rt.stats.peak_used) {
+        rt.stats.peak_used = rt.stats.used;
+    }
+    unlock_mutex(&rt.mutex);
+
+    return (char *)block + RT_HEADER;
+}
+
+// cppcheck-suppress unusedFunction
+void rt_free(void *ptr)
+{
+    if (!ptr)
+        return;
+
+    char *address = ptr;
+    if (!atomic_load_explicit(&rt_ready, memory_order_acquire) || address < rt.start + RT_HEADER ||
+        address >= rt.start + rt.size || !IS_ALIGNED(address)) {
+        last_error = ALLOC_ERROR_INVALID_POINTER;
+        return;
+    }
+
+    rt_block_t *block = (rt_block_t *)(address - RT_HEADER);
+
+    lock_mutex(&rt.mutex);
+    if (block_is_free(block)) {
+        unlock_mutex(&rt.mutex);
+        fprintf(stderr, "Double free detected at %p\n", ptr);
+        abort();
+    }
+    rt.stats.used -= RT_HEADER + block_size(block);
+
+    rt_block_t *prev = block->prev_phys;
+    if (prev && block_is_free(prev)) {
+        unlink_free(prev);
+        prev->size += RT_HEADER + block_size(block);
+        block = prev;
+    }
+    rt_block_t *next = next_phys(block);
+    if (block_is_free(next)) {
+        unlink_free(next);
+        block->size += RT_HEADER + block_size(next);
+    }
+    next_phys(block)->prev_phys = block;
+    insert_free(block);
+    unlock_mutex(&rt.mutex);
+}
+
+// cppcheck-suppress unusedFunction
+void allocator_realtime_stats(realtime_stats_t *stats)
+{
+    if (!stats)
+        return;
+
+    lock_mutex(&rt.mutex);
+    *stats = rt.stats;
+    unlock_mutex(&rt.mutex);
+}
+
+void realtime_print_stats(void)
+{
+    realtime_stats_t stats;
+    allocator_realtime_stats(&stats);
+
+    if (stats.pool_size == 0)
+        return;
+    printf("Real-time pool used/peak/size: %zu/%zu/%zu bytes\n",
+           stats.used,
+           stats.peak_used,
+           stats.pool_size);
+    printf("Real-time allocations/failures: %zu/%zu\n", stats.allocations, stats.failures);
+}
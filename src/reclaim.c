@@ -0,0 +1,287 @@
+/*
+ * Memory Allocator - Background Reclaimer
+ *
+ * Moves the expensive kernel calls of free() off the calling thread:
+ * - munmap() of blocks that own a dedicated mapping
+ * - madvise(MADV_DONTNEED) of large coalesced free runs
+ *
+ * munmap() of a multi-megabyte block triggers TLB shootdowns and page-table
+ * teardown that show up as latency spikes in the freeing thread. With the
+ * reclaimer enabled, free() only appends a job to a bounded ring buffer and
+ * the reclaimer thread performs the system call.
+ *
+ * Back-pressure: the queue never holds more than RECLAIM_QUEUE_DEPTH jobs.
+ * When it is full an unmap is done inline by the freeing thread and a purge
+ * is skipped (the run goes straight to the free list), so memory waiting for
+ * the reclaimer cannot grow without bound.
+ *
+ * With the pressure monitor on, the thread also wakes every
+ * PRESSURE_CHECK_MS to run pressure_check(), between jobs if need be, so a
+ * steady stream of work cannot starve the checks.
+ */
+
+#define _GNU_SOURCE
+
+#include "allocator_internal.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+typedef enum { RECLAIM_UNMAP, RECLAIM_PURGE } reclaim_kind_t;
+
+typedef struct reclaim_job {
+    reclaim_kind_t kind;
+    void *start;
+    size_t length;
+} reclaim_job_t;
+
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t work_ready;
+    background_thread_t thread;
+    bool monitoring;     /* Run pressure_check() periodically */
+    uint64_t next_check; /* CLOCK_MONOTONIC nanoseconds */
+
+    reclaim_job_t jobs[RECLAIM_QUEUE_DEPTH];
+    size_t head;
+    size_t count;
+
+    reclaim_stats_t stats;
+} reclaimer = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .work_ready = PTHREAD_COND_INITIALIZER,
+    .thread = BACKGROUND_THREAD_INITIALIZER,
+};
+
+/* Release the pages of a free block but keep its header page, which holds
+ * the free-list links once the block is back on the list */
+static size_t purge_free_block(block_t *block)
+{
+    uintptr_t start = PAGE_ALIGN((uintptr_t)get_ptr_from_block(block));
+    uintptr_t end = ((uintptr_t)get_ptr_from_block(block) + block->size) & ~(ALLOC_PAGE_SIZE - 1);
+
+    if (end <= start)
+        return 0;
+
+    if (madvise((void *)start, end - start, MADV_DONTNEED) != 0)
+        return 0;
+
+    return end - start;
+}
+
+static void run_job(const reclaim_job_t *job, size_t *unmapped, size_t *purged)
+{
+    switch (job->kind) {
+        case RECLAIM_UNMAP:
+            if (release_memory_mmap(job->start, job->length) == 0) {
+                *unmapped += job->length;
+            }
+            break;
+        case RECLAIM_PURGE: {
+            block_t *block = (block_t *)job->start;
+            *purged += purge_free_block(block);
+            list_purged_free_blocks(&block, 1);
+            break;
+        }
+    }
+}
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+/* Caller holds reclaimer.mutex */
+static bool pressure_check_due(void)
+{
+    return reclaimer.monitoring && !reclaimer.thread.stopping &&
+           monotonic_ns() >= reclaimer.next_check;
+}
+
+/* Sleep until work arrives or, when monitoring, the next check is due */
+static void wait_for_work(void)
+{
+    if (!reclaimer.monitoring) {
+        pthread_cond_wait(&reclaimer.work_ready, &reclaimer.mutex);
+        return;
+    }
+
+    uint64_t now = monotonic_ns();
+    uint64_t delay = reclaimer.next_check > now ? reclaimer.next_check - now : 0;
+    background_thread_wait(&reclaimer.work_ready, &reclaimer.mutex, delay);
+}
+
+static void *reclaimer_main(void *arg)
+{
+    (void)arg;
+
+    pthread_mutex_lock(&reclaimer.mutex);
+    for (;;) {
+        while (reclaimer.count == 0 && !reclaimer.thread.stopping && !pressure_check_due()) {
+            wait_for_work();
+        }
+
+        if (pressure_check_due()) {
+            reclaimer.next_check = monotonic_ns() + PRESSURE_CHECK_MS * 1000000ull;
+            pthread_mutex_unlock(&reclaimer.mutex);
+            pressure_check();
+            pthread_mutex_lock(&reclaimer.mutex);
+            continue;
+        }
+
+        /* Drain everything that was queued before stopping */
+        if (reclaimer.count == 0)
+            break;
+
+        reclaim_job_t job = reclaimer.jobs[reclaimer.head];
+        reclaimer.head = (reclaimer.head + 1) % RECLAIM_QUEUE_DEPTH;
+        reclaimer.count--;
+        pthread_mutex_unlock(&reclaimer.mutex);
+
+        size_t unmapped = 0;
+        size_t purged = 0;
+        run_job(&job, &unmapped, &purged);
+
+        pthread_mutex_lock(&reclaimer.mutex);
+        reclaimer.stats.completed++;
+        reclaimer.stats.bytes_unmapped += unmapped;
+        reclaimer.stats.bytes_purged += purged;
+    }
+    pthread_mutex_unlock(&reclaimer.mutex);
+
+    return NULL;
+}
+
+/* Returns true if the job was queued for the reclaimer thread */
+static bool submit(reclaim_kind_t kind, void *start, size_t length)
+{
+    if (!atomic_load_explicit(&reclaimer.thread.running, memory_order_acquire))
+        return false;
+
+    pthread_mutex_lock(&reclaimer.mutex);
+
+    if (reclaimer.thread.stopping || reclaimer.count == RECLAIM_QUEUE_DEPTH) {
+        reclaimer.stats.inline_jobs += reclaimer.thread.stopping ? 0 : 1;
+        pthread_mutex_unlock(&reclaimer.mutex);
+        return false;
+    }
+
+    size_t tail = (reclaimer.head + reclaimer.count) % RECLAIM_QUEUE_DEPTH;
+    reclaimer.jobs[tail] = (reclaim_job_t){.kind = kind, .start = start, .length = length};
+    reclaimer.count++;
+    reclaimer.stats.queued++;
+
+    pthread_cond_signal(&reclaimer.work_ready);
+    pthread_mutex_unlock(&reclaimer.mutex);
+    return true;
+}
+
+void reclaim_atfork_prepare(void)
+{
+    pthread_mutex_lock(&reclaimer.mutex);
+}
+
+void reclaim_atfork_parent(void)
+{
+    pthread_mutex_unlock(&reclaimer.mutex);
+}
+
+/* The reclaimer thread did not survive the fork, so the child runs the
+ * jobs still queued itself; the queue is short */
+void reclaim_atfork_child(void)
+{
+    pthread_mutex_init(&reclaimer.mutex, NULL);
+    pthread_cond_init(&reclaimer.work_ready, NULL);
+    background_thread_atfork_child(&reclaimer.thread);
+
+    while (reclaimer.count > 0) {
+        reclaim_job_t job = reclaimer.jobs[reclaimer.head];
+        reclaimer.head = (reclaimer.head + 1) % RECLAIM_QUEUE_DEPTH;
+        reclaimer.count--;
+        run_job(&job, &reclaimer.stats.bytes_unmapped, &reclaimer.stats.bytes_purged);
+        reclaimer.stats.completed++;
+    }
+}
+
+bool reclaim_submit_unmap(void *start, size_t length)
+{
+    return submit(RECLAIM_UNMAP, start, length);
+}
+
+bool reclaim_submit_purge(block_t *block)
+{
+    return submit(RECLAIM_PURGE, block, block->size);
+}
+
+/* Blocks come off the free list HEAP_ITERATE_SLICE at a time and are
+ * purged without the heap lock; marked blocks are skipped, so an idle heap
+ * costs no system calls and releases nothing twice */
+size_t reclaim_purge_free_list(void)
+{
+    block_t *slice[HEAP_ITERATE_SLICE];
+    size_t purged = 0;
+    size_t count;
+
+    while ((count = take_unpurged_free_blocks(slice, HEAP_ITERATE_SLICE)) > 0) {
+        for (size_t i = 0; i < count; i++) {
+            purged += purge_free_block(slice[i]);
+        }
+        list_purged_free_blocks(slice, count);
+    }
+    return purged;
+}
+
+int reclaim_set_monitor(bool enabled)
+{
+    if (enabled && allocator_set_background_reclaim(true) != 0)
+        return -1;
+
+    pthread_mutex_lock(&reclaimer.mutex);
+    reclaimer.monitoring = enabled;
+    reclaimer.next_check = monotonic_ns() + PRESSURE_CHECK_MS * 1000000ull;
+    pthread_cond_signal(&reclaimer.work_ready);
+    pthread_mutex_unlock(&reclaimer.mutex);
+    return 0;
+}
+
+void reclaim_print_stats(void)
+{
+    reclaim_stats_t stats;
+    allocator_reclaim_stats(&stats);
+
+    printf("Background reclaim: %s\n",
+           atomic_load_explicit(&reclaimer.thread.running, memory_order_relaxed) ? "ON" : "OFF");
+    printf("Reclaim jobs queued/completed/inline: %zu/%zu/%zu\n",
+           stats.queued,
+           stats.completed,
+           stats.inline_jobs);
+    printf("Reclaimed bytes (unmapped/purged): %zu/%zu\n",
+           stats.bytes_unmapped,
+           stats.bytes_purged);
+}
+
+// cppcheck-suppress unusedFunction
+int allocator_set_background_reclaim(bool enabled)
+{
+    /* Once stopping, new work is refused; the thread drains what is queued */
+    return background_thread_toggle(&reclaimer.thread,
+                                    enabled,
+                                    reclaimer_main,
+                                    &reclaimer.mutex,
+                                    &reclaimer.work_ready);
+}
+
+// cppcheck-suppress unusedFunction
+void allocator_reclaim_stats(reclaim_stats_t *stats)
+{
+    if (!stats)
+        return;
+
+    pthread_mutex_lock(&reclaimer.mutex);
+    *stats = reclaimer.stats;
+    pthread_mutex_unlock(&reclaimer.mutex);
+}
@@ -0,0 +1,677 @@
+/*
+ * Memory Allocator - Small-Object Segments
+ *
+ * Objects up to SMALL_OBJECT_MAX bytes can be served from segments instead
+ * of the header-based heap. All segments are carved from one virtual range
+ * reserved up front, so "is this a segment pointer" is a single subtraction
+ * and compare. Segments are SEGMENT_SIZE aligned, and each is split into
+ * SEGMENT_PAGE_SIZE pages that each hold objects of a single size class:
+ *
+ *   segment = ptr & ~(SEGMENT_SIZE - 1)
+ *   page    = &segment->pages[(ptr - segment) / SEGMENT_PAGE_SIZE]
+ *
+ * free() therefore finds the object's size from a compact per-segment page
+ * table, never from a header in front of the object, and objects carry no
+ * header at all. The first page of every segment holds that table.
+ *
+ * Free-list sharding: every page belongs to one thread's heap and keeps
+ * three lists, as in mimalloc:
+ * - free_list:   objects malloc() pops from, touched only by the owner
+ * - local_free:  objects the owner freed, also owner-only
+ * - remote_free: objects other threads freed, pushed with a CAS
+ * malloc() only looks at local_free and remote_free once free_list runs
+ * dry, so the common paths take no lock and share no cache line with other
+ * threads. A page's used count only drops when the owner sees a free, so
+ * an empty page is always truly empty and can be released safely.
+ *
+ * When a thread exits its pages are abandoned, and the next thread short
+ * of a page of that class adopts them. Objects freed into an abandoned
+ * page wait on its remote list until then.
+ *
+ * Every page also holds objects of a single allocation tag, so tagged
+ * objects stay on this path and free() finds the tag next to the size. A
+ * thread's pages of one class may carry different tags; allocation uses
+ * the first page whose tag matches, and the fast path only checks the one
+ * at the head of the list.
+ *
+ * Class sizes are powers of two, so a page's objects are naturally aligned
+ * and free() rejects interior pointers with a mask. Unlike heap blocks,
+ * segment objects have no magic number and double frees are not detected.
+ * Pages that become empty return to a pool shared by all classes; beyond
+ * SEGMENT_DIRTY_PAGES_MAX of them, they are purged with madvise() first.
+ * Segments are disabled by default.
+ */
+
+#define _GNU_SOURCE
+
+#include "allocator_internal.h"
+
+#include <stdio.h>
+#include <sys/mman.h>
+
+#define SEGMENT_MAGIC 0x5E6D0001U
+#define SEGMENT_PAGES (SEGMENT_SIZE / SEGMENT_PAGE_SIZE)
+#define SMALL_CLASS_COUNT 7        /* 16, 32, ... 1024 bytes, as get_size_class() */
+#define SEGMENT_DIRTY_PAGES_MAX 16 /* Empty pages kept without madvise() */
+
+typedef struct seg_heap seg_heap_t;
+
+typedef struct seg_page {
+    char *start;                 /* First object in the page */
+    uint32_t block_size;         /* Object size, 0 while the page is unused */
+    uint32_t capacity;           /* Objects that fit in the page */
+    uint32_t used;               /* Objects allocated and not yet seen freed */
+    uint32_t carved;             /* Objects handed out at least once */
+    uint16_t tag;                /* Stored tag, as tag_for_allocation(), of every object */
+    bool dirty;                  /* Pooled without being purged */
+    bool in_full;                /* On the owner's list of full pages */
+    void *free_list;             /* Objects ready for malloc() */
+    void *local_free;            /* Objects freed by the owner */
+    _Atomic(void *) remote_free; /* Objects freed by other threads */
+    _Atomic(seg_heap_t *) owner; /* NULL while unused or abandoned */
+    struct seg_page *prev;       /* Neighbours in one of the owner's lists */
+    struct seg_page *next;       /* ... or in the free-page pool */
+} seg_page_t;
+
+typedef struct segment {
+    uint32_t magic;
+    seg_page_t pages[SEGMENT_PAGES]; /* pages[0] describes this metadata page */
+} segment_t;
+
+/* Per-thread heap; only its own thread touches the page lists */
+struct seg_heap {
+    seg_page_t *pages[SMALL_CLASS_COUNT]; /* Pages that may have room */
+    seg_page_t *full[SMALL_CLASS_COUNT];  /* Pages found full */
+    atomic_size_t allocated;              /* Objects this thread allocated */
+    atomic_size_t freed;                  /* Objects this thread freed */
+    bool registered;
+    struct seg_heap *prev_heap;
+    struct seg_heap *next_heap;
+};
+
+atomic_uintptr_t segment_arena_start;
+atomic_size_t segment_arena_size;
+
+static atomic_bool segments_enabled;
+static __thread seg_heap_t thread_heap;
+static seg_heap_t orphaned_heap; /* Owner of pages whose thread did not survive a fork */
+static pthread_key_t heap_exit_key;
+static pthread_once_t heap_exit_once = PTHREAD_ONCE_INIT;
+
+static struct {
+    pthread_mutex_t mutex;
+    char *next_segment; /* Next unused segment in the reservation */
+    char *end;
+    seg_page_t *free_pages;
+    size_t dirty_pages; /* Pooled pages still backed by memory */
+    seg_page_t *abandoned[SMALL_CLASS_COUNT];
+    seg_heap_t *heaps; /* Heaps of live threads, for statistics */
+    size_t retired_allocated;
+    size_t retired_freed;
+    size_t segments;
+    size_t pages_in_use;
+} arena = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static inline seg_page_t *page_of(const void *ptr)
+{
+    segment_t *segment = (segment_t *)((uintptr_t)ptr & ~(SEGMENT_SIZE - 1));
+    return &segment->pages[((uintptr_t)ptr & (SEGMENT_SIZE - 1)) / SEGMENT_PAGE_SIZE];
+}
+
+/* Counters have a single writer, so a plain load and store is enough */
+static inline void count_one(atomic_size_t *counter)
+{
+    atomic_store_explicit(counter,
+                          atomic_load_explicit(counter, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+}
+
+/* Reserve the address range all segments come from; caller holds arena.mutex */
+static int reserve_arena(void)
+{
+    if (arena.end)
+        return 0;
+
+    /* Over-reserve by one segment so the range can be aligned */
+    size_t length = SEGMENT_ARENA_SIZE + SEGMENT_SIZE;
+    char *raw = mmap(NULL, length, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (raw == MAP_FAILED)
+        return -1;
+
+    char *start = (char *)(((uintptr_t)raw + SEGMENT_SIZE - 1) & ~(SEGMENT_SIZE - 1));
+    size_t lead = (size_t)(start - raw);
+    if (lead > 0) {
+        munmap(raw, lead);
+    }
+    munmap(start + SEGMENT_ARENA_SIZE, SEGMENT_SIZE - lead);
+
+    arena.next_segment = start;
+    arena.end = start + SEGMENT_ARENA_SIZE;
+    atomic_store_explicit(&segment_arena_start, (uintptr_t)start, memory_order_relaxed);
+    atomic_store_explicit(&segment_arena_size, SEGMENT_ARENA_SIZE, memory_order_release);
+    return 0;
+}
+
+/* Commit the next segment and add its pages to the pool; caller holds arena.mutex */
+static bool map_segment(void)
+{
+    if (!arena.end || arena.next_segment == arena.end)
+        return false;
+
+    segment_t *segment = (segment_t *)arena.next_segment;
+    if (mprotect(segment, SEGMENT_SIZE, PROT_READ | PROT_WRITE) != 0)
+        return false;
+    arena.next_segment += SEGMENT_SIZE;
+    arena.segments++;
+
+    segment->magic = SEGMENT_MAGIC;
+    for (size_t i = SEGMENT_PAGES - 1; i > 0; i--) {
+        seg_page_t *page = &segment->pages[i];
+        page->start = (char *)segment + i * SEGMENT_PAGE_SIZE;
+        page->next = arena.free_pages;
+        arena.free_pages = page;
+    }
+    return true;
+}
+
+static seg_page_t *take_page(seg_heap_t *heap, uint32_t block_size, uint16_t tag)
+{
+    lock_mutex(&arena.mutex);
+    if (!arena.free_pages && !map_segment()) {
+        unlock_mutex(&arena.mutex);
+        return NULL;
+    }
+    seg_page_t *page = arena.free_pages;
+    arena.free_pages = page->next;
+    arena.pages_in_use++;
+    if (page->dirty) {
+        arena.dirty_pages--;
+    }
+    unlock_mutex(&arena.mutex);
+
+    page->block_size = block_size;
+    page->capacity = (uint32_t)(SEGMENT_PAGE_SIZE / block_size);
+    page->used = 0;
+    page->carved = 0;
+    page->tag = tag;
+    page->dirty = false;
+    page->in_full = false;
+    page->free_list = NULL;
+    page->local_free = NULL;
+    atomic_store_explicit(&page->remote_free, NULL, memory_order_relaxed);
+    atomic_store_explicit(&page->owner, heap, memory_order_relaxed);
+    page->prev = NULL;
+    page->next = NULL;
+    return page;
+}
+
+/* A few empty pages stay backed so a burst of frees followed by a burst of
+ * allocations does not pay for madvise() and fresh page faults */
+static void release_page(seg_page_t *page)
+{
+    page->block_size = 0;
+    atomic_store_explicit(&page->owner, NULL, memory_order_relaxed);
+
+    lock_mutex(&arena.mutex);
+    page->dirty = arena.dirty_pages < SEGMENT_DIRTY_PAGES_MAX;
+    if (page->dirty) {
+        arena.dirty_pages++;
+    } else {
+        /* Purge before the page is back in the pool and can be reused */
+        unlock_mutex(&arena.mutex);
+        madvise(page->start, SEGMENT_PAGE_SIZE, MADV_DONTNEED);
+        lock_mutex(&arena.mutex);
+    }
+    page->next = arena.free_pages;
+    arena.free_pages = page;
+    arena.pages_in_use--;
+    unlock_mutex(&arena.mutex);
+}
+
+static void link_page(seg_page_t **list, seg_page_t *page)
+{
+    page->prev = NULL;
+    page->next = *list;
+    if (*list) {
+        (*list)->prev = page;
+    }
+    *list = page;
+}
+
+static void unlink_page(seg_page_t **list, seg_page_t *page)
+{
+    if (page->prev) {
+        page->prev->next = page->next;
+    } else {
+        *list = page->next;
+    }
+    if (page->next) {
+        page->next->prev = page->prev;
+    }
+    page->prev = NULL;
+    page->next = NULL;
+}
+
+/* Refill an exhausted free_list from the owner's and other threads' frees */
+static void collect_page(seg_page_t *page)
+{
+    page->free_list = page->local_free;
+    page->local_free = NULL;
+
+    void *remote = atomic_exchange_explicit(&page->remote_free, NULL, memory_order_acquire);
+    if (!remote)
+        return;
+
+    uint32_t count = 1;
+    void *tail = remote;
+    while (*(void **)tail) {
+        tail = *(void **)tail;
+        count++;
+    }
+    *(void **)tail = page->free_list;
+    page->free_list = remote;
+    page->used -= count;
+}
+
+static inline void *page_pop(seg_page_t *page)
+{
+    void *ptr = page->free_list;
+    if (ptr) {
+        page->free_list = *(void **)ptr;
+    } else if (page->carved < page->capacity) {
+        ptr = page->start + (size_t)page->carved++ * page->block_size;
+    } else {
+        return NULL;
+    }
+    page->used++;
+    return ptr;
+}
+
+/* Abandon a page, or release it if nothing in it is live; caller owns it */
+static void abandon_page(seg_page_t *page, int index)
+{
+    if (page->used == 0) {
+        release_page(page);
+        return;
+    }
+
+    atomic_store_explicit(&page->owner, NULL, memory_order_relaxed);
+    page->in_full = false;
+
+    lock_mutex(&arena.mutex);
+    page->prev = NULL;
+    page->next = arena.abandoned[index];
+    arena.abandoned[index] = page;
+    unlock_mutex(&arena.mutex);
+}
+
+static void heap_thread_exit(void *arg)
+{
+    seg_heap_t *heap = (seg_heap_t *)arg;
+
+    for (int i = 0; i < SMALL_CLASS_COUNT; i++) {
+        seg_page_t *lists[2] = {heap->pages[i], heap->full[i]};
+        heap->pages[i] = NULL;
+        heap->full[i] = NULL;
+
+        for (int l = 0; l < 2; l++) {
+            seg_page_t *page = lists[l];
+            while (page) {
+                seg_page_t *next = page->next;
+                if (!page->free_list) {
+                    collect_page(page);
+                }
+                abandon_page(page, i);
+                page = next;
+            }
+        }
+    }
+
+    lock_mutex(&arena.mutex);
+    if (heap->prev_heap) {
+        heap->prev_heap->next_heap = heap->next_heap;
+    } else {
+        arena.heaps = heap->next_heap;
+    }
+    if (heap->next_heap) {
+        heap->next_heap->prev_heap = heap->prev_heap;
+    }
+    arena.retired_allocated += atomic_load_explicit(&heap->allocated, memory_order_relaxed);
+    arena.retired_freed += atomic_load_explicit(&heap->freed, memory_order_relaxed);
+    unlock_mutex(&arena.mutex);
+
+    /* A later destructor that allocates registers the heap again */
+    atomic_store_explicit(&heap->allocated, 0, memory_order_relaxed);
+    atomic_store_explicit(&heap->freed, 0, memory_order_relaxed);
+    heap->registered = false;
+}
+
+void segment_atfork_prepare(void)
+{
+    lock_mutex(&arena.mutex);
+}
+
+void segment_atfork_parent(void)
+{
+    unlock_mutex(&arena.mutex);
+}
+
+/* Only the forking thread survives in the child. The other threads' heaps
+ * are dropped without looking at their page lists, which a thread may have
+ * been halfway through changing: their objects stay valid and can be freed,
+ * but the child never allocates from those pages again. Their pages are
+ * handed to orphaned_heap, since glibc reuses the dead threads' TLS, heaps
+ * included, for threads the child creates: a page still naming its old
+ * owner would pass a new thread's owner check, and free() would then run
+ * that thread's list operations on it. */
+void segment_atfork_child(void)
+{
+    pthread_mutex_init(&arena.mutex, NULL);
+
+    seg_heap_t *self = &thread_heap;
+    char *start = (char *)atomic_load_explicit(&segment_arena_start, memory_order_relaxed);
+    for (char *segment = start; segment && segment < arena.next_segment; segment += SEGMENT_SIZE) {
+        seg_page_t *pages = ((segment_t *)segment)->pages;
+        for (size_t i = 1; i < SEGMENT_PAGES; i++) {
+            seg_heap_t *owner = atomic_load_explicit(&pages[i].owner, memory_order_relaxed);
+            if (owner && owner != self) {
+                atomic_store_explicit(&pages[i].owner, &orphaned_heap, memory_order_relaxed);
+            }
+        }
+    }
+
+    for (seg_heap_t *heap = arena.heaps; heap; heap = heap->next_heap) {
+        if (heap != self) {
+            arena.retired_allocated += atomic_load_explicit(&heap->allocated, memory_order_relaxed);
+            arena.retired_freed += atomic_load_explicit(&heap->freed, memory_order_relaxed);
+        }
+    }
+
+    arena.heaps = self->registered ? self : NULL;
+    self->prev_heap = NULL;
+    self->next_heap = NULL;
+}
+
+static void heap_exit_key_init(void)
+{
+    pthread_key_create(&heap_exit_key, heap_thread_exit);
+}
+
+static seg_heap_t *register_heap(seg_heap_t *heap)
+{
+    /* Set first: pthread_setspecific() may allocate and come back here */
+    heap->registered = true;
+
+    pthread_once(&heap_exit_once, heap_exit_key_init);
+    pthread_setspecific(heap_exit_key, heap);
+
+    lock_mutex(&arena.mutex);
+    heap->prev_heap = NULL;
+    heap->next_heap = arena.heaps;
+    if (arena.heaps) {
+        arena.heaps->prev_heap = heap;
+    }
+    arena.heaps = heap;
+    unlock_mutex(&arena.mutex);
+    return heap;
+}
+
+static inline seg_heap_t *current_heap(void)
+{
+    seg_heap_t *heap = &thread_heap;
+    return LIKELY(heap->registered) ? heap : register_heap(heap);
+}
+
+/* Find a page with room once the heap's own pages are exhausted */
+static seg_page_t *find_page(seg_heap_t *heap, int index, uint16_t tag)
+{
+    /* Full pages that other threads have since freed into */
+    for (seg_page_t *page = heap->full[index]; page; page = page->next) {
+        if (page->tag == tag && atomic_load_explicit(&page->remote_free, memory_order_relaxed)) {
+            unlink_page(&heap->full[index], page);
+            page->in_full = false;
+            collect_page(page);
+            return page;
+        }
+    }
+
+    /* Pages left behind by exited threads */
+    for (;;) {
+        lock_mutex(&arena.mutex);
+        seg_page_t **link = &arena.abandoned[index];
+        while (*link && (*link)->tag != tag) {
+            link = &(*link)->next;
+        }
+        seg_page_t *page = *link;
+        if (page) {
+            *link = page->next;
+        }
+        unlock_mutex(&arena.mutex);
+        if (!page)
+            break;
+
+        atomic_store_explicit(&page->owner, heap, memory_order_relaxed);
+        page->next = NULL;
+        if (!page->free_list) {
+            collect_page(page);
+        }
+        if (page->used == 0) {
+            release_page(page);
+        } else if (page->free_list || page->carved < page->capacity) {
+            return page;
+        } else {
+            page->in_full = true;
+            link_page(&heap->full[index], page);
+        }
+    }
+
+    return take_page(heap, (uint32_t)get_class_size(index), tag);
+}
+
+static void *alloc_slow(seg_heap_t *heap, int index, uint16_t tag)
+{
+    seg_page_t *page = heap->pages[index];
+
+    while (page) {
+        if (page->tag != tag) {
+            page = page->next;
+            continue;
+        }
+        if (!page->free_list) {
+            collect_page(page);
+        }
+        void *ptr = page_pop(page);
+        if (ptr) {
+            /* Move the page to the head, where the fast path looks */
+            if (page != heap->pages[index]) {
+                unlink_page(&heap->pages[index], page);
+                link_page(&heap->pages[index], page);
+            }
+            return ptr;
+        }
+
+        /* Park full pages so later allocations do not scan them */
+        seg_page_t *next = page->next;
+        unlink_page(&heap->pages[index], page);
+        page->in_full = true;
+        link_page(&heap->full[index], page);
+        page = next;
+    }
+
+    page = find_page(heap, index, tag);
+    if (!page)
+        return NULL;
+    link_page(&heap->pages[index], page);
+    return page_pop(page);
+}
+
+void *segment_alloc(size_t size, uint16_t tag)
+{
+    if (size == 0 || size > SMALL_OBJECT_MAX)
+        return NULL;
+    if (!atomic_load_explicit(&segments_enabled, memory_order_relaxed))
+        return NULL;
+
+    seg_heap_t *heap = current_heap();
+    int index = get_size_class(size);
+    seg_page_t *page = heap->pages[index];
+    void *ptr;
+
+    if (LIKELY(page && page->free_list && page->tag == tag)) {
+        ptr = page->free_list;
+        page->free_list = *(void **)ptr;
+        page->used++;
+    } else {
+        ptr = alloc_slow(heap, index, tag);
+        if (!ptr)
+            return NULL;
+    }
+
+    count_one(&heap->allocated);
+    return ptr;
+}
+
+static void free_local(seg_heap_t *heap, seg_page_t *page, void *ptr)
+{
+    int index = get_size_class(page->block_size);
+
+    *(void **)ptr = page->local_free;
+    page->local_free = ptr;
+
+    if (page->in_full) {
+        unlink_page(&heap->full[index], page);
+        page->in_full = false;
+        link_page(&heap->pages[index], page);
+    }
+
+    /* Keep one page per class so a lone object cannot thrash */
+    if (--page->used == 0 && (heap->pages[index] != page || page->next)) {
+        unlink_page(&heap->pages[index], page);
+        release_page(page);
+    }
+}
+
+void segment_free(void *ptr)
+{
+    seg_page_t *page = page_of(ptr);
+    uint32_t block_size = page->block_size;
+
+    if (UNLIKELY(block_size == 0 || ((uintptr_t)ptr & (block_size - 1)) != 0)) {
+        fprintf(stderr, "Invalid pointer passed to free: %p\n", ptr);
+        last_error = ALLOC_ERROR_INVALID_POINTER;
+        return;
+    }
+
+    seg_heap_t *heap = current_heap();
+    count_one(&heap->freed);
+
+    if (LIKELY(atomic_load_explicit(&page->owner, memory_order_relaxed) == heap)) {
+        free_local(heap, page, ptr);
+        return;
+    }
+
+    void *head = atomic_load_explicit(&page->remote_free, memory_order_relaxed);
+    do {
+        *(void **)ptr = head;
+    } while (!atomic_compare_exchange_weak_explicit(
+        &page->remote_free, &head, ptr, memory_order_release, memory_order_relaxed));
+}
+
+size_t segment_usable_size(const void *ptr)
+{
+    return page_of(ptr)->block_size;
+}
+
+uint16_t segment_tag(const void *ptr)
+{
+    return page_of(ptr)->tag;
+}
+
+// cppcheck-suppress unusedFunction
+int allocator_set_small_segments(bool enabled)
+{
+    if (enabled) {
+        lock_mutex(&arena.mutex);
+        int result = reserve_arena();
+        unlock_mutex(&arena.mutex);
+        if (result != 0)
+            return -1;
+    }
+
+    /* Objects already in segments stay valid and are freed there */
+    atomic_store_explicit(&segments_enabled, enabled, memory_order_relaxed);
+    return 0;
+}
+
+// cppcheck-suppress unusedFunction
+void allocator_small_stats(small_stats_t *stats)
+{
+    if (!stats)
+        return;
+
+    lock_mutex(&arena.mutex);
+    size_t allocated = arena.retired_allocated;
+    size_t freed = arena.retired_freed;
+    for (seg_heap_t *heap = arena.heaps; heap; heap = heap->next_heap) {
+        allocated += atomic_load_explicit(&heap->allocated, memory_order_relaxed);
+        freed += atomic_load_explicit(&heap->freed, memory_order_relaxed);
+    }
+    stats->live_objects = allocated - freed;
+    stats->segments = arena.segments;
+    stats->pages_in_use = arena.pages_in_use;
+    unlock_mutex(&arena.mutex);
+}
+
+/* Purge the empty pages the pool keeps backed. They leave the pool while
+ * madvise() runs, so no thread can take one and have it zeroed under it. */
+size_t segment_purge_dirty_pages(void)
+{
+    seg_page_t *dirty = NULL;
+
+    lock_mutex(&arena.mutex);
+    for (seg_page_t **link = &arena.free_pages; *link;) {
+        seg_page_t *page = *link;
+        if (page->dirty) {
+            *link = page->next;
+            page->next = dirty;
+            dirty = page;
+        } else {
+            link = &page->next;
+        }
+    }
+    arena.dirty_pages = 0;
+    unlock_mutex(&arena.mutex);
+
+    size_t purged = 0;
+    seg_page_t *last = NULL;
+    for (seg_page_t *page = dirty; page; page = page->next) {
+        if (madvise(page->start, SEGMENT_PAGE_SIZE, MADV_DONTNEED) == 0) {
+            purged += SEGMENT_PAGE_SIZE;
+        }
+        page->dirty = false;
+        last = page;
+    }
+
+    if (last) {
+        lock_mutex(&arena.mutex);
+        last->next = arena.free_pages;
+        arena.free_pages = dirty;
+        unlock_mutex(&arena.mutex);
+    }
+    return purged;
+}
+
+void segment_print_stats(void)
+{
+    small_stats_t stats;
+    allocator_small_stats(&stats);
+
+    printf("Small segments: %s\n",
+           atomic_load_explicit(&segments_enabled, memory_order_relaxed) ? "ON" : "OFF");
+    printf("Segments/pages in use/live objects: %zu/%zu/%zu\n",
+           stats.segments,
+           stats.pages_in_use,
+           stats.live_objects);
+}
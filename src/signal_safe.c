@@ -0,0 +1,287 @@
+/*
+ * Memory Allocator - Async-Signal-Safe Allocation
+ *
+ * malloc() takes locks and may call sbrk() or mmap(), so a signal handler
+ * that interrupts it and allocates again can deadlock or corrupt the heap.
+ * signal_safe_alloc() instead serves the calling thread from a reserve of
+ * SIGNAL_RESERVE_SIZE bytes mapped and populated beforehand by
+ * signal_safe_init(), so it never enters the kernel and never blocks.
+ *
+ * A reserve is carved by bumping an offset, and freed objects go on one
+ * lock-free list per size class. Each list head packs a generation tag with
+ * the object's offset in a single 64-bit word, so a pop that is interrupted
+ * by a handler popping and pushing the same object fails its
+ * compare-and-swap instead of installing a stale link. Any thread may free
+ * into any reserve: reserves are aligned to their size, so the owner is
+ * found by masking the pointer. When a thread exits its reserve is kept
+ * mapped, since its objects may still be in use, and handed to the next
+ * thread that calls signal_safe_init().
+ */
+
+#define _GNU_SOURCE
+
+#include "allocator_internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define SIGNAL_CLASSES 7 /* 16, 32, ... 1024 bytes, as for the thread cache */
+#define SIGNAL_OBJECT_LIVE 0x5AFEA110u
+#define SIGNAL_OBJECT_FREE 0x5AFEF4EEu
+
+_Static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "signal-safe lists need lock-free 64-bit atomics");
+
+typedef struct signal_object {
+    _Atomic uint32_t state; /* SIGNAL_OBJECT_LIVE or SIGNAL_OBJECT_FREE */
+    uint32_t size_class;
+    _Atomic uint32_t next; /* Offset / ALIGNMENT of the next free object, 0 ends */
+    uint32_t unused;
+} signal_object_t;
+
+typedef struct signal_reserve {
+    _Atomic uint64_t free_lists[SIGNAL_CLASSES]; /* Tag << 32 | offset / ALIGNMENT */
+    atomic_size_t top;                           /* Offset of the unused space */
+    struct signal_reserve *next_orphan;          /* Guarded by reserves.mutex */
+} signal_reserve_t;
+
+#define SIGNAL_RESERVE_HEADER ALIGN_SIZE(sizeof(signal_reserve_t))
+
+static struct {
+    pthread_mutex_t mutex;
+    signal_reserve_t *orphans; /* Reserves of exited threads */
+} reserves = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+static atomic_size_t reserves_mapped;
+static atomic_size_t signal_allocations;
+static atomic_size_t signal_failures;
+
+static pthread_key_t reserve_exit_key;
+static pthread_once_t reserve_exit_once = PTHREAD_ONCE_INIT;
+
+/* Initial-exec TLS is a fixed offset from the thread pointer; the default
+ * model in a shared object may allocate on first access in a thread */
+static __thread signal_reserve_t *thread_reserve __attribute__((tls_model("initial-exec")));
+
+static inline signal_object_t *object_at(signal_reserve_t *reserve, uint32_t index)
+{
+    return (signal_object_t *)((char *)reserve + (size_t)index * ALIGNMENT);
+}
+
+static inline uint32_t object_index(const signal_reserve_t *reserve, const signal_object_t *object)
+{
+    return (uint32_t)(((const char *)object - (const char *)reserve) / ALIGNMENT);
+}
+
+static signal_object_t *pop_object(signal_reserve_t *reserve, int size_class)
+{
+    _Atomic uint64_t *list = &reserve->free_lists[size_class];
+    uint64_t head = atomic_load_explicit(list, memory_order_acquire);
+
+    while ((uint32_t)head != 0) {
+        signal_object_t *object = object_at(reserve, (uint32_t)head);
+        /* May read a link that is already stale; the tag then fails the swap */
+        uint32_t next = atomic_load_explicit(&object->next, memory_order_relaxed);
+        uint64_t tag = (head >> 32) + 1;
+        if (atomic_compare_exchange_weak_explicit(list,
+                                                  &head,
+                                                  tag << 32 | next,
+                                                  memory_order_acquire,
+                                                  memory_order_acquire)) {
+            return object;
+        }
+    }
+    return NULL;
+}
+
+static void push_object(signal_reserve_t *reserve, signal_object_t *object)
+{
+    _Atomic uint64_t *list = &reserve->free_lists[object->size_class];
+    uint64_t index = object_index(reserve, object);
+    uint64_t head = atomic_load_explicit(list, memory_order_relaxed);
+    uint64_t tag;
+
+    do {
+        atomic_store_explicit(&object->next, (uint32_t)head, memory_order_relaxed);
+        tag = (head >> 32) + 1;
+    } while (!atomic_compare_exchange_weak_explicit(
+        list, &head, tag << 32 | index, memory_order_release, memory_order_relaxed));
+}
+
+static signal_object_t *carve_object(signal_reserve_t *reserve, int size_class)
+{
+    size_t length = sizeof(signal_object_t) + get_class_size(size_class);
+    size_t top = atomic_load_explicit(&reserve->top, memory_order_relaxed);
+
+    do {
+        if (top + length > SIGNAL_RESERVE_SIZE)
+            return NULL;
+    } while (!atomic_compare_exchange_weak_explicit(
+        &reserve->top, &top, top + length, memory_order_relaxed, memory_order_relaxed));
+
+    signal_object_t *object = (signal_object_t *)((char *)reserve + top);
+    object->size_class = (uint32_t)size_class;
+    return object;
+}
+
+/* Map a reserve aligned to its own size and fault in every page */
+static signal_reserve_t *map_reserve(void)
+{
+    size_t length = 2 * SIGNAL_RESERVE_SIZE;
+    char *raw = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) {
+        last_error = ALLOC_ERROR_OUT_OF_MEMORY;
+        return NULL;
+    }
+
+    char *start =
+        (char *)(((uintptr_t)raw + SIGNAL_RESERVE_SIZE - 1) & ~(SIGNAL_RESERVE_SIZE - 1));
+    size_t lead = (size_t)(start - raw);
+    if (lead > 0) {
+        munmap(raw, lead);
+    }
+    munmap(start + SIGNAL_RESERVE_SIZE, SIGNAL_RESERVE_SIZE - lead);
+
+    /* A handler must not be the one to find the system out of memory */
+    for (size_t offset = 0; offset < SIGNAL_RESERVE_SIZE; offset += ALLOC_PAGE_SIZE) {
+        ((volatile char *)start)[offset] = 0;
+    }
+
+    signal_reserve_t *reserve = (signal_reserve_t *)start;
+    atomic_init(&reserve->top, SIGNAL_RESERVE_HEADER);
+    atomic_fetch_add_explicit(&reserves_mapped, 1, memory_order_relaxed);
+    return reserve;
+}
+
+static void reserve_thread_exit(void *value)
+{
+    signal_reserve_t *reserve = value;
+
+    thread_reserve = NULL;
+    lock_mutex(&reserves.mutex);
+    reserve->next_orphan = reserves.orphans;
+    reserves.orphans = reserve;
+    unlock_mutex(&reserves.mutex);
+}
+
+static void reserve_exit_key_init(void)
+{
+    pthread_key_create(&reserve_exit_key, reserve_thread_exit);
+}
+
+void signal_safe_atfork_prepare(void)
+{
+    lock_mutex(&reserves.mutex);
+}
+
+void signal_safe_atfork_parent(void)
+{
+    unlock_mutex(&reserves.mutex);
+}
+
+/* Reserves of threads that did not survive the fork stay mapped, unused */
+void signal_safe_atfork_child(void)
+{
+    pthread_mutex_init(&reserves.mutex, NULL);
+}
+
+// cppcheck-suppress unusedFunction
+int signal_safe_init(void)
+{
+    if (thread_reserve)
+        return 0;
+
+    lock_mutex(&reserves.mutex);
+    signal_reserve_t *reserve = reserves.orphans;
+    if (reserve) {
+        reserves.orphans = reserve->next_orphan;
+    }
+    unlock_mutex(&reserves.mutex);
+
+    if (!reserve) {
+        reserve = map_reserve();
+        if (!reserve)
+            return -1;
+    }
+
+    pthread_once(&reserve_exit_once, reserve_exit_key_init);
+    pthread_setspecific(reserve_exit_key, reserve);
+    thread_reserve = reserve;
+    return 0;
+}
+
+// cppcheck-suppress unusedFunction
+void *signal_safe_alloc(size_t size)
+{
+    signal_reserve_t *reserve = thread_reserve;
+    if (!reserve || size == 0 || size > get_class_size(SIGNAL_CLASSES - 1)) {
+        atomic_fetch_add_explicit(&signal_failures, 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    int size_class = get_size_class(size);
+    signal_object_t *object = pop_object(reserve, size_class);
+    if (!object) {
+        object = carve_object(reserve, size_class);
+    }
+    /* Once the reserve is carved out, a larger free object will do */
+    for (int larger = size_class + 1; !object && larger < SIGNAL_CLASSES; larger++) {
+        object = pop_object(reserve, larger);
+    }
+    if (!object) {
+        atomic_fetch_add_explicit(&signal_failures, 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    atomic_store_explicit(&object->state, SIGNAL_OBJECT_LIVE, memory_order_relaxed);
+    atomic_fetch_add_explicit(&signal_allocations, 1, memory_order_relaxed);
+    return object + 1;
+}
+
+// cppcheck-suppress unusedFunction
+void signal_safe_free(void *ptr)
+{
+    if (!ptr)
+        return;
+
+    signal_object_t *object = (signal_object_t *)ptr - 1;
+    signal_reserve_t *reserve =
+        (signal_reserve_t *)((uintptr_t)ptr & ~(uintptr_t)(SIGNAL_RESERVE_SIZE - 1));
+
+    uint32_t state =
+        atomic_exchange_explicit(&object->state, SIGNAL_OBJECT_FREE, memory_order_relaxed);
+    if (state != SIGNAL_OBJECT_LIVE) {
+        /* stdio is not async-signal-safe; write() and abort() are */
+        static const char message[] = "signal_safe_free: double free or invalid pointer\n";
+        last_error = state == SIGNAL_OBJECT_FREE ? ALLOC_ERROR_DOUBLE_FREE
+                                                 : ALLOC_ERROR_INVALID_POINTER;
+        ssize_t written = write(STDERR_FILENO, message, sizeof(message) - 1);
+        (void)written;
+        abort();
+    }
+
+    push_object(reserve, object);
+}
+
+// cppcheck-suppress unusedFunction
+void allocator_signal_safe_stats(signal_safe_stats_t *stats)
+{
+    if (!stats)
+        return;
+
+    stats->reserves = atomic_load_explicit(&reserves_mapped, memory_order_relaxed);
+    stats->allocations = atomic_load_explicit(&signal_allocations, memory_order_relaxed);
+    stats->failures = atomic_load_explicit(&signal_failures, memory_order_relaxed);
+}
+
+void signal_safe_print_stats(void)
+{
+    signal_safe_stats_t stats;
+    allocator_signal_safe_stats(&stats);
+
+    printf("Signal-safe reserves/allocations/failures: %zu/%zu/%zu\n",
+           stats.reserves,
+           stats.allocations,
+           stats.failures);
+}
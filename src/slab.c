@@ -0,0 +1,735 @@
+/*
+ * Memory Allocator - Meshable Slabs
+ *
+ * Small objects freed in random order leave pages that are mostly empty yet
+ * cannot be released, because one live object pins each of them. Meshable
+ * slabs, after Mesh (Powers et al., PLDI 2019), get that memory back
+ * without changing the address of any object.
+ *
+ * The slab range is a MAP_SHARED mapping of a memfd, so any virtual page in
+ * it can be pointed at any physical page of the file. A slab is one page of
+ * a single size class with a bitmap of live slots. Two slabs of a class
+ * whose bitmaps do not overlap can be meshed: the second slab's objects are
+ * copied to the same offsets in the first slab's page, the second virtual
+ * page is remapped onto that physical page, and the second physical page is
+ * punched out of the file. Both virtual pages then share one bitmap, and
+ * new objects are handed out through the first one only.
+ *
+ * Partial slabs of a class sit in SLAB_FULLNESS_BUCKETS lists by how full
+ * they are, and allocation takes from the fullest, so sparse slabs are left
+ * to drain and go back to the page pool instead of every slab staying half
+ * full. allocator_slab_utilization() tells a program how full the slab
+ * behind an object is, so it can move objects out of sparse slabs.
+ *
+ * A slab holds objects of one allocation tag, which free() reads from the
+ * slab record. Allocation takes the fullest partial slab with the caller's
+ * tag, or else retags an empty one; only slabs of the same tag are meshed.
+ *
+ * A page being copied is write-protected. A thread that writes to it takes
+ * SIGSEGV, and the handler waits for the remap and returns, so the write is
+ * retried against the merged page. Faults outside the slab range are passed
+ * to the handler that was installed before.
+ *
+ * The file is shared with forked children, which copy the live pages into
+ * a file of their own. From the prepare handler until the child has made
+ * that copy, the parent keeps slabs.mutex, so nothing is meshed or punched,
+ * and keeps the used range write-protected, so the copy is the memory as
+ * it was at the fork.
+ *
+ * One mutex covers the slab heap; slabs trade malloc() throughput for a
+ * smaller footprint in long-running processes, and segments remain the
+ * fast path for small objects.
+ */
+
+#define _GNU_SOURCE
+
+#include "allocator_internal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SLAB_SPANS ((uint32_t)(SLAB_ARENA_SIZE / SLAB_SPAN_SIZE))
+#define SLAB_CLASS_COUNT 7 /* 16, 32, ... 1024 bytes, as get_size_class() */
+#define SLAB_BITMAP_WORDS ((int)(SLAB_SPAN_SIZE / 16 / 64))
+#define SLAB_MESH_MAX 4                       /* Virtual pages sharing one physical page */
+#define SLAB_EMPTY_RETAINED 4                 /* Empty slabs kept per class before release */
+#define SLAB_MESH_INTERVAL_MS 10              /* Period of the background meshing thread */
+#define SLAB_MESH_BUDGET 4096                 /* Slab pairs compared per background pass */
+#define SLAB_FULLNESS_BUCKETS 8               /* Lists of partial slabs per class, by fullness */
+#define SLAB_LIST_EMPTY SLAB_FULLNESS_BUCKETS /* List of retained empty slabs */
+#define SLAB_LIST_NONE 0xff                   /* Full slabs are on no list */
+
+/* One record per virtual page; the record of a slab's first page is the slab */
+typedef struct slab {
+    uint64_t live[SLAB_BITMAP_WORDS]; /* Allocated slots */
+    uint32_t block_size;              /* Object size, kept while the page is meshed */
+    uint32_t capacity;
+    uint32_t used;
+    uint32_t owner;                /* First page of the owning slab plus one, 0 if unused */
+    uint32_t pages[SLAB_MESH_MAX]; /* Virtual pages mapped onto pages[0]'s file page */
+    uint32_t page_count;
+    uint16_t tag; /* Stored tag, as tag_for_allocation(), of every object */
+    uint8_t list; /* Fullness bucket, SLAB_LIST_EMPTY or SLAB_LIST_NONE */
+    struct slab *prev;
+    struct slab *next; /* ... or the next unused page */
+} slab_t;
+
+atomic_uintptr_t slab_arena_start;
+atomic_size_t slab_arena_size;
+
+atomic_bool slabs_enabled;
+
+static struct {
+    pthread_mutex_t mutex;
+    int fd; /* memfd backing the range */
+    char *start;
+    slab_t *records;    /* SLAB_SPANS entries, indexed by page */
+    uint32_t next_page; /* Pages below this have been used at least once */
+    slab_t *free_pages;
+    slab_t *lists[SLAB_CLASS_COUNT][SLAB_FULLNESS_BUCKETS + 1];
+    uint32_t listed[SLAB_CLASS_COUNT]; /* Bit per list that is not empty */
+    uint32_t empty[SLAB_CLASS_COUNT];  /* Length of the SLAB_LIST_EMPTY list */
+    uint32_t mesh_cursor;             /* Page the next meshing pass starts from */
+    bool handler_installed;
+    slab_stats_t stats;
+} slabs = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .fd = -1,
+};
+
+static atomic_bool mesh_barrier; /* A page is write-protected for copying */
+static struct sigaction previous_segv_action;
+static int fork_gate[2] = {-1, -1}; /* Pipe the child closes once it has copied the slabs */
+static bool install_fault_handler(void);
+
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;
+    background_thread_t thread;
+} mesher = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .thread = BACKGROUND_THREAD_INITIALIZER,
+};
+
+static inline uint32_t page_index(const slab_t *record)
+{
+    return (uint32_t)(record - slabs.records);
+}
+
+static inline char *page_address(uint32_t page)
+{
+    return slabs.start + (size_t)page * SLAB_SPAN_SIZE;
+}
+
+static inline void punch_page(uint32_t page)
+{
+    fallocate(slabs.fd,
+              FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+              (off_t)page * (off_t)SLAB_SPAN_SIZE,
+              (off_t)SLAB_SPAN_SIZE);
+}
+
+/* Point a virtual page at the file page of another (or its own) */
+static inline bool map_page(uint32_t page, uint32_t file_page)
+{
+    void *address = mmap(page_address(page),
+                         SLAB_SPAN_SIZE,
+                         PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_FIXED,
+                         slabs.fd,
+                         (off_t)file_page * (off_t)SLAB_SPAN_SIZE);
+    return address != MAP_FAILED;
+}
+
+static unsigned fullness_list(const slab_t *slab)
+{
+    if (slab->used == 0)
+        return SLAB_LIST_EMPTY;
+    if (slab->used == slab->capacity)
+        return SLAB_LIST_NONE;
+    return slab->used * SLAB_FULLNESS_BUCKETS / slab->capacity;
+}
+
+static void unlink_slab(slab_t *slab, int index)
+{
+    if (slab->list == SLAB_LIST_NONE)
+        return;
+
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        slabs.lists[index][slab->list] = slab->next;
+        if (!slab->next) {
+            slabs.listed[index] &= ~(1u << slab->list);
+        }
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+    if (slab->list == SLAB_LIST_EMPTY) {
+        slabs.empty[index]--;
+    }
+    slab->prev = NULL;
+    slab->next = NULL;
+    slab->list = SLAB_LIST_NONE;
+}
+
+/* Move a slab to the list matching its fullness; caller holds slabs.mutex */
+static void file_slab(slab_t *slab, int index)
+{
+    unsigned list = fullness_list(slab);
+    if (list == slab->list)
+        return;
+
+    unlink_slab(slab, index);
+    if (list == SLAB_LIST_NONE)
+        return;
+
+    slab->prev = NULL;
+    slab->next = slabs.lists[index][list];
+    if (slab->next) {
+        slab->next->prev = slab;
+    }
+    slabs.lists[index][list] = slab;
+    slabs.listed[index] |= 1u << list;
+    if (list == SLAB_LIST_EMPTY) {
+        slabs.empty[index]++;
+    }
+    slab->list = (uint8_t)list;
+}
+
+static void protect_used_pages(int protection)
+{
+    mprotect(slabs.start, (size_t)slabs.next_page * SLAB_SPAN_SIZE, protection);
+}
+
+void slab_atfork_prepare(void)
+{
+    lock_mutex(&slabs.mutex);
+    if (!slabs.start || !install_fault_handler() || pipe2(fork_gate, O_CLOEXEC) != 0)
+        return;
+
+    /* Writers wait in mesh_fault_handler() until the child has its copy */
+    atomic_store_explicit(&mesh_barrier, true, memory_order_release);
+    protect_used_pages(PROT_READ);
+}
+
+/* Wait for the child to close its end of the gate, which it also does by
+ * exiting; if fork() failed, closing ours is enough */
+void slab_atfork_parent(void)
+{
+    if (fork_gate[0] >= 0) {
+        char byte;
+        close(fork_gate[1]);
+        while (read(fork_gate[0], &byte, 1) < 0 && errno == EINTR) {
+        }
+        close(fork_gate[0]);
+        fork_gate[0] = fork_gate[1] = -1;
+
+        protect_used_pages(PROT_READ | PROT_WRITE);
+        atomic_store_explicit(&mesh_barrier, false, memory_order_release);
+    }
+    unlock_mutex(&slabs.mutex);
+}
+
+/* A forked child would otherwise share every slab with its parent */
+void slab_atfork_child(void)
+{
+    pthread_mutex_init(&slabs.mutex, NULL);
+
+    /* The meshing thread did not survive the fork */
+    pthread_mutex_init(&mesher.mutex, NULL);
+    pthread_cond_init(&mesher.wake, NULL);
+    background_thread_atfork_child(&mesher.thread);
+
+    if (!slabs.start)
+        return;
+
+    /* Copy the live file pages into a file of the child's own */
+    int fd = memfd_create("allocator-slabs", MFD_CLOEXEC);
+    if (fd >= 0 && ftruncate(fd, (off_t)SLAB_ARENA_SIZE) == 0) {
+        for (uint32_t page = 0; page < slabs.next_page; page++) {
+            if (slabs.records[page].owner == page + 1) {
+                pwrite(fd,
+                       page_address(page),
+                       SLAB_SPAN_SIZE,
+                       (off_t)page * (off_t)SLAB_SPAN_SIZE);
+            }
+        }
+        close(slabs.fd);
+        slabs.fd = fd;
+        mmap(slabs.start, SLAB_ARENA_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+        for (uint32_t page = 0; page < slabs.next_page; page++) {
+            uint32_t owner = slabs.records[page].owner;
+            if (owner != 0 && owner != page + 1) {
+                map_page(page, owner - 1);
+            }
+        }
+    } else {
+        if (fd >= 0) {
+            close(fd);
+        }
+        protect_used_pages(PROT_READ | PROT_WRITE);
+    }
+    atomic_store_explicit(&mesh_barrier, false, memory_order_release);
+
+    if (fork_gate[0] >= 0) {
+        close(fork_gate[0]);
+        close(fork_gate[1]);
+        fork_gate[0] = fork_gate[1] = -1;
+    }
+}
+
+/* Create the memfd and map the range; caller holds slabs.mutex */
+static int reserve_slabs(void)
+{
+    if (slabs.start)
+        return 0;
+
+    int fd = memfd_create("allocator-slabs", MFD_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    if (ftruncate(fd, (off_t)SLAB_ARENA_SIZE) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    size_t records_size = SLAB_SPANS * sizeof(slab_t);
+    void *records = mmap(NULL,
+                         records_size,
+                         PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                         -1,
+                         0);
+    if (records == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+
+    void *start = mmap(NULL, SLAB_ARENA_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (start == MAP_FAILED) {
+        munmap(records, records_size);
+        close(fd);
+        return -1;
+    }
+
+    slabs.fd = fd;
+    slabs.start = start;
+    slabs.records = records;
+    atomic_store_explicit(&slab_arena_start, (uintptr_t)start, memory_order_relaxed);
+    atomic_store_explicit(&slab_arena_size, SLAB_ARENA_SIZE, memory_order_release);
+    return 0;
+}
+
+/* Caller holds slabs.mutex */
+static slab_t *create_slab(int index)
+{
+    slab_t *slab = slabs.free_pages;
+    if (slab) {
+        slabs.free_pages = slab->next;
+    } else if (slabs.next_page < SLAB_SPANS) {
+        slab = &slabs.records[slabs.next_page++];
+    } else {
+        return NULL;
+    }
+
+    uint32_t page = page_index(slab);
+    memset(slab, 0, sizeof(*slab));
+    slab->block_size = (uint32_t)16 << index;
+    slab->capacity = (uint32_t)(SLAB_SPAN_SIZE / slab->block_size);
+    slab->owner = page + 1;
+    slab->pages[0] = page;
+    slab->page_count = 1;
+    slab->list = SLAB_LIST_NONE;
+
+    file_slab(slab, index);
+    slabs.stats.virtual_pages++;
+    slabs.stats.physical_pages++;
+    return slab;
+}
+
+/* Give every page of an empty slab back; caller holds slabs.mutex */
+static void release_slab(slab_t *slab, int index)
+{
+    unlink_slab(slab, index);
+    punch_page(slab->pages[0]);
+
+    /* Meshed pages had their own file page punched when they were meshed */
+    for (uint32_t i = slab->page_count; i-- > 0;) {
+        uint32_t page = slab->pages[i];
+        if (i > 0) {
+            map_page(page, page);
+        }
+        slab_t *record = &slabs.records[page];
+        record->owner = 0;
+        record->next = slabs.free_pages;
+        slabs.free_pages = record;
+    }
+
+    slabs.stats.virtual_pages -= slab->page_count;
+    slabs.stats.physical_pages--;
+}
+
+static uint32_t take_slot(slab_t *slab)
+{
+    for (uint32_t word = 0; word * 64 < slab->capacity; word++) {
+        uint64_t free_slots = ~slab->live[word];
+        uint32_t remaining = slab->capacity - word * 64;
+        if (remaining < 64) {
+            free_slots &= ((uint64_t)1 << remaining) - 1;
+        }
+        if (free_slots) {
+            uint32_t bit = (uint32_t)__builtin_ctzll(free_slots);
+            slab->live[word] |= (uint64_t)1 << bit;
+            slab->used++;
+            return word * 64 + bit;
+        }
+    }
+    return UINT32_MAX; /* Not reached: partial slabs have room */
+}
+
+/* The fullest partial slab with the tag, then a retained empty one, which
+ * takes the tag; caller holds slabs.mutex */
+static slab_t *find_slab(int index, uint16_t tag)
+{
+    uint32_t partial = slabs.listed[index] & ((1u << SLAB_FULLNESS_BUCKETS) - 1);
+    while (partial) {
+        unsigned list = 31u - (unsigned)__builtin_clz(partial);
+        for (slab_t *slab = slabs.lists[index][list]; slab; slab = slab->next) {
+            if (slab->tag == tag)
+                return slab;
+        }
+        partial &= ~(1u << list);
+    }
+
+    slab_t *slab = slabs.lists[index][SLAB_LIST_EMPTY];
+    if (!slab) {
+        slab = create_slab(index);
+    }
+    if (slab) {
+        slab->tag = tag;
+    }
+    return slab;
+}
+
+void *slab_alloc(size_t size, uint16_t tag)
+{
+    if (size == 0 || size > SMALL_OBJECT_MAX)
+        return NULL;
+    if (!atomic_load_explicit(&slabs_enabled, memory_order_relaxed))
+        return NULL;
+
+    int index = get_size_class(size);
+
+    lock_mutex(&slabs.mutex);
+    slab_t *slab = find_slab(index, tag);
+    if (!slab) {
+        unlock_mutex(&slabs.mutex);
+        return NULL;
+    }
+
+    uint32_t slot = take_slot(slab);
+    file_slab(slab, index);
+    slabs.stats.live_objects++;
+    void *ptr = page_address(slab->pages[0]) + (size_t)slot * slab->block_size;
+    unlock_mutex(&slabs.mutex);
+
+    return ptr;
+}
+
+void slab_free(void *ptr)
+{
+    size_t offset = (uintptr_t)ptr - (uintptr_t)slabs.start;
+    uint32_t page = (uint32_t)(offset / SLAB_SPAN_SIZE);
+    size_t in_page = offset % SLAB_SPAN_SIZE;
+
+    lock_mutex(&slabs.mutex);
+
+    uint32_t owner = slabs.records[page].owner;
+    slab_t *slab = owner ? &slabs.records[owner - 1] : NULL;
+    uint32_t slot = slab ? (uint32_t)(in_page / slab->block_size) : 0;
+    uint64_t bit = (uint64_t)1 << (slot % 64);
+
+    if (!slab || in_page % slab->block_size != 0 || !(slab->live[slot / 64] & bit)) {
+        unlock_mutex(&slabs.mutex);
+        fprintf(stderr, "Double free detected at %p\n", ptr);
+        abort();
+    }
+
+    int index = get_size_class(slab->block_size);
+    slab->live[slot / 64] &= ~bit;
+    slab->used--;
+    slabs.stats.live_objects--;
+
+    if (slab->used == 0 && (slab->page_count > 1 || slabs.empty[index] >= SLAB_EMPTY_RETAINED)) {
+        release_slab(slab, index);
+    } else {
+        file_slab(slab, index);
+    }
+
+    unlock_mutex(&slabs.mutex);
+}
+
+size_t slab_usable_size(const void *ptr)
+{
+    size_t offset = (uintptr_t)ptr - (uintptr_t)slabs.start;
+    /* Meshing never changes a page's size class */
+    return slabs.records[offset / SLAB_SPAN_SIZE].block_size;
+}
+
+uint16_t slab_tag(const void *ptr)
+{
+    size_t offset = (uintptr_t)ptr - (uintptr_t)slabs.start;
+    /* Meshing only pairs slabs of one tag */
+    return slabs.records[offset / SLAB_SPAN_SIZE].tag;
+}
+
+/* Writers to a page being meshed wait here until it has been remapped */
+static void mesh_fault_handler(int sig, siginfo_t *info, void *context)
+{
+    if (slab_owns(info->si_addr)) {
+        struct timespec pause = {.tv_sec = 0, .tv_nsec = 10000};
+        while (atomic_load_explicit(&mesh_barrier, memory_order_acquire)) {
+            nanosleep(&pause, NULL);
+        }
+        return;
+    }
+
+    if (previous_segv_action.sa_flags & SA_SIGINFO) {
+        previous_segv_action.sa_sigaction(sig, info, context);
+    } else if (previous_segv_action.sa_handler != SIG_DFL &&
+               previous_segv_action.sa_handler != SIG_IGN) {
+        previous_segv_action.sa_handler(sig);
+    } else {
+        /* Returning re-executes the access under the default action */
+        sigaction(SIGSEGV, &previous_segv_action, NULL);
+    }
+}
+
+static bool install_fault_handler(void)
+{
+    if (slabs.handler_installed)
+        return true;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = mesh_fault_handler;
+    action.sa_flags = SA_SIGINFO | SA_RESTART | SA_ONSTACK;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGSEGV, &action, &previous_segv_action) != 0)
+        return false;
+
+    slabs.handler_installed = true;
+    return true;
+}
+
+static bool bitmaps_disjoint(const slab_t *a, const slab_t *b)
+{
+    for (int word = 0; word < SLAB_BITMAP_WORDS; word++) {
+        if (a->live[word] & b->live[word])
+            return false;
+    }
+    return true;
+}
+
+/* Move source's objects into target's page and map source's pages onto it;
+ * caller holds slabs.mutex and refiles target afterwards */
+static bool mesh_pair(slab_t *target, slab_t *source, int index)
+{
+    char *dst = page_address(target->pages[0]);
+    char *src = page_address(source->pages[0]);
+    size_t block_size = source->block_size;
+
+    atomic_store_explicit(&mesh_barrier, true, memory_order_release);
+    for (uint32_t i = 0; i < source->page_count; i++) {
+        mprotect(page_address(source->pages[i]), SLAB_SPAN_SIZE, PROT_READ);
+    }
+
+    for (int word = 0; word < SLAB_BITMAP_WORDS; word++) {
+        for (uint64_t bits = source->live[word]; bits; bits &= bits - 1) {
+            size_t offset = ((size_t)word * 64 + (size_t)__builtin_ctzll(bits)) * block_size;
+            memcpy(dst + offset, src + offset, block_size);
+        }
+    }
+
+    uint32_t remapped = 0;
+    while (remapped < source->page_count && map_page(source->pages[remapped], target->pages[0])) {
+        remapped++;
+    }
+    if (remapped < source->page_count) {
+        /* Out of mappings: put everything back the way it was */
+        for (uint32_t i = 0; i < source->page_count; i++) {
+            map_page(source->pages[i], source->pages[0]);
+        }
+        atomic_store_explicit(&mesh_barrier, false, memory_order_release);
+        return false;
+    }
+    atomic_store_explicit(&mesh_barrier, false, memory_order_release);
+
+    punch_page(source->pages[0]);
+
+    for (uint32_t i = 0; i < source->page_count; i++) {
+        uint32_t page = source->pages[i];
+        slabs.records[page].owner = target->pages[0] + 1;
+        target->pages[target->page_count++] = page;
+    }
+    for (int word = 0; word < SLAB_BITMAP_WORDS; word++) {
+        target->live[word] |= source->live[word];
+    }
+    target->used += source->used;
+
+    unlink_slab(source, index);
+
+    slabs.stats.physical_pages--;
+    slabs.stats.meshes++;
+    slabs.stats.bytes_released += SLAB_SPAN_SIZE;
+    return true;
+}
+
+// cppcheck-suppress unusedFunction
+size_t allocator_mesh_slabs(size_t budget)
+{
+    size_t released = 0;
+
+    lock_mutex(&slabs.mutex);
+    if (!slabs.start || !install_fault_handler()) {
+        unlock_mutex(&slabs.mutex);
+        return 0;
+    }
+
+    /* Targets are visited in page order from a cursor, so each pass resumes
+     * where the previous one stopped; sources are tried sparsest first */
+    for (uint32_t visited = 0; visited < slabs.next_page && budget > 0; visited++) {
+        slab_t *target = &slabs.records[slabs.mesh_cursor];
+        slabs.mesh_cursor = (slabs.mesh_cursor + 1) % slabs.next_page;
+        if (target->owner != page_index(target) + 1 || target->list >= SLAB_FULLNESS_BUCKETS)
+            continue;
+
+        int index = get_size_class(target->block_size);
+        for (unsigned list = 0; list < SLAB_FULLNESS_BUCKETS && budget > 0; list++) {
+            slab_t *source = slabs.lists[index][list];
+            while (source && budget > 0 && target->used < target->capacity &&
+                   target->page_count < SLAB_MESH_MAX) {
+                slab_t *next_source = source->next;
+                if (source != target && source->tag == target->tag &&
+                    target->page_count + source->page_count <= SLAB_MESH_MAX) {
+                    budget--;
+                    if (bitmaps_disjoint(target, source)) {
+                        if (!mesh_pair(target, source, index)) {
+                            budget = 0;
+                            break;
+                        }
+                        released += SLAB_SPAN_SIZE;
+                    }
+                }
+                source = next_source;
+            }
+        }
+        file_slab(target, index);
+    }
+
+    unlock_mutex(&slabs.mutex);
+    return released;
+}
+
+static void *mesher_main(void *arg)
+{
+    (void)arg;
+
+    background_thread_set_idle();
+
+    pthread_mutex_lock(&mesher.mutex);
+    while (!mesher.thread.stopping) {
+        background_thread_wait(&mesher.wake, &mesher.mutex, SLAB_MESH_INTERVAL_MS * 1000000ull);
+        if (mesher.thread.stopping)
+            break;
+
+        pthread_mutex_unlock(&mesher.mutex);
+        allocator_mesh_slabs(SLAB_MESH_BUDGET);
+        pthread_mutex_lock(&mesher.mutex);
+    }
+    pthread_mutex_unlock(&mesher.mutex);
+
+    return NULL;
+}
+
+// cppcheck-suppress unusedFunction
+int allocator_set_meshable_slabs(bool enabled)
+{
+    if (enabled) {
+        lock_mutex(&slabs.mutex);
+        int result = reserve_slabs();
+        unlock_mutex(&slabs.mutex);
+        if (result != 0)
+            return -1;
+    }
+
+    /* Objects already in slabs stay valid and are freed there */
+    atomic_store_explicit(&slabs_enabled, enabled, memory_order_relaxed);
+    return 0;
+}
+
+// cppcheck-suppress unusedFunction
+int allocator_set_background_meshing(bool enabled)
+{
+    return background_thread_toggle(&mesher.thread,
+                                    enabled,
+                                    mesher_main,
+                                    &mesher.mutex,
+                                    &mesher.wake);
+}
+
+// cppcheck-suppress unusedFunction
+int allocator_slab_utilization(const void *ptr, slab_utilization_t *utilization)
+{
+    if (!utilization || !slab_owns(ptr))
+        return -1;
+
+    size_t offset = (uintptr_t)ptr - (uintptr_t)slabs.start;
+
+    lock_mutex(&slabs.mutex);
+    uint32_t owner = slabs.records[offset / SLAB_SPAN_SIZE].owner;
+    if (owner == 0) {
+        unlock_mutex(&slabs.mutex);
+        return -1;
+    }
+    const slab_t *slab = &slabs.records[owner - 1];
+    utilization->used = slab->used;
+    utilization->capacity = slab->capacity;
+    utilization->block_size = slab->block_size;
+    unlock_mutex(&slabs.mutex);
+    return 0;
+}
+
+// cppcheck-suppress unusedFunction
+void allocator_slab_stats(slab_stats_t *stats)
+{
+    if (!stats)
+        return;
+
+    lock_mutex(&slabs.mutex);
+    *stats = slabs.stats;
+    unlock_mutex(&slabs.mutex);
+}
+
+void slab_print_stats(void)
+{
+    slab_stats_t stats;
+    allocator_slab_stats(&stats);
+    if (stats.virtual_pages == 0 && stats.meshes == 0)
+        return;
+
+    printf("Slab objects/virtual pages/physical pages: %zu/%zu/%zu\n",
+           stats.live_objects,
+           stats.virtual_pages,
+           stats.physical_pages);
+    printf("Slab meshes/bytes released: %zu/%zu\n", stats.meshes, stats.bytes_released);
+}
@@ -0,0 +1,107 @@
+/*
+ * Memory Allocator - Heap Snapshots
+ *
+ * A slow leak shows up as one size class, or one subsystem's tag, whose
+ * live memory keeps growing. heap_snapshot() copies the live counts per
+ * class and per tag out of the per-thread counters in tag.c, which
+ * allocation and free already update, so a snapshot is a fixed-size struct
+ * filled in time proportional to the number of threads, without touching
+ * the heap or its locks. heap_snapshot_diff() subtracts two snapshots and
+ * ranks what grew, so a daemon can take one a minute and log the top
+ * entries when the total keeps rising.
+ *
+ * The size-class counters cost every malloc() and free() a few stores, so
+ * they are only kept for objects allocated while heap_snapshots_enabled is
+ * set. Tag counters are kept regardless, as untagged objects skip them.
+ */
+
+#define _GNU_SOURCE
+
+#include "allocator_internal.h"
+
+#include <string.h>
+#include <time.h>
+
+atomic_bool heap_snapshots_enabled = false;
+
+// cppcheck-suppress unusedFunction
+void allocator_set_heap_snapshots(bool enabled)
+{
+    atomic_store_explicit(&heap_snapshots_enabled, enabled, memory_order_relaxed);
+}
+
+// cppcheck-suppress unusedFunction
+void heap_snapshot(heap_snapshot_t *snapshot)
+{
+    if (!snapshot)
+        return;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    snapshot->timestamp_ns = (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+
+    tag_collect(snapshot);
+
+    snapshot->live_bytes = 0;
+    snapshot->live_objects = 0;
+    for (int class = 0; class < HEAP_SNAPSHOT_CLASSES; class++) {
+        snapshot->live_bytes += snapshot->class_bytes[class];
+        snapshot->live_objects += snapshot->class_objects[class];
+    }
+}
+
+/* Insert entry into growth[0..*count), kept largest first and at most max long */
+static void rank_growth(heap_growth_t *growth, size_t *count, size_t max, heap_growth_t entry)
+{
+    size_t position = *count;
+    while (position > 0 && growth[position - 1].bytes < entry.bytes) {
+        position--;
+    }
+    if (position == max)
+        return;
+
+    size_t moved = (*count < max ? *count : max - 1) - position;
+    memmove(&growth[position + 1], &growth[position], moved * sizeof(heap_growth_t));
+    growth[position] = entry;
+    if (*count < max) {
+        (*count)++;
+    }
+}
+
+// cppcheck-suppress unusedFunction
+size_t heap_snapshot_diff(const heap_snapshot_t *a,
+                          const heap_snapshot_t *b,
+                          heap_growth_t *growth,
+                          size_t max_entries)
+{
+    size_t count = 0;
+    if (!a || !b || !growth)
+        return 0;
+
+    for (unsigned class = 0; class < HEAP_SNAPSHOT_CLASSES; class++) {
+        int64_t bytes = (int64_t)b->class_bytes[class] - (int64_t)a->class_bytes[class];
+        if (bytes > 0) {
+            heap_growth_t entry = {
+                HEAP_GROWTH_SIZE_CLASS,
+                class,
+                bytes,
+                (int64_t)b->class_objects[class] - (int64_t)a->class_objects[class],
+            };
+            rank_growth(growth, &count, max_entries, entry);
+        }
+    }
+
+    for (unsigned tag = 1; tag < ALLOC_TAG_MAX; tag++) {
+        int64_t bytes = (int64_t)b->tag_bytes[tag] - (int64_t)a->tag_bytes[tag];
+        if (bytes > 0) {
+            heap_growth_t entry = {
+                HEAP_GROWTH_TAG,
+                tag,
+                bytes,
+                (int64_t)b->tag_objects[tag] - (int64_t)a->tag_objects[tag],
+            };
+            rank_growth(growth, &count, max_entries, entry);
+        }
+    }
+    return count;
+}
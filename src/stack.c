@@ -0,0 +1,335 @@
+/*
+ * Memory Allocator - Coroutine Stacks
+ *
+ * A stack made with mmap() and mprotect() costs two system calls to create
+ * and one to destroy, and leaves a separate mapping behind each coroutine.
+ * stack_alloc() carves stacks out of one reservation per size class
+ * instead, each stack sitting just above a PROT_NONE guard page that
+ * faults on overflow. Size classes are powers of two from STACK_MIN_SIZE
+ * to STACK_MAX_SIZE; a class reserves STACK_CLASS_RESERVE bytes of address
+ * space the first time it is used, and only carving a new stack calls
+ * mprotect() to make it writable.
+ *
+ * Freed stacks go to a per-thread cache first, up to STACK_CACHE_BYTES per
+ * class, and are handed out again as they are: no system call, no lock,
+ * and the pages a coroutine touched stay resident for the next one. A
+ * stack pushed out of a full cache, or left in the cache of an exiting
+ * thread, is released with madvise(MADV_DONTNEED) and joins the class's
+ * shared pool, so memory is only given back once the stack is cold.
+ * stack_free() finds the class from the address, as every class has its
+ * own range, and a bit per slot, set while the stack is handed out, catches
+ * double frees. The bitmap is reserved with the class and its pages are
+ * only touched as slots are carved.
+ */
+
+#define _GNU_SOURCE
+
+#include "allocator_internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#define STACK_CLASSES 10 /* STACK_MIN_SIZE << 0 ... STACK_MIN_SIZE << 9 */
+#define STACK_CACHE_DEPTH (STACK_CACHE_BYTES / STACK_MIN_SIZE)
+
+_Static_assert(STACK_MIN_SIZE << (STACK_CLASSES - 1) == STACK_MAX_SIZE, "stack classes");
+
+/* Pooled stacks are linked through their lowest word */
+typedef struct pooled_stack {
+    struct pooled_stack *next;
+} pooled_stack_t;
+
+typedef struct stack_class {
+    _Atomic(char *) start; /* Reservation, NULL until the class is first used */
+    atomic_ullong *live;   /* Bit per slot, set while handed out; before start */
+    atomic_size_t carved;  /* Slots made writable so far */
+    pooled_stack_t *pool;  /* Released stacks; guarded by stacks.mutex */
+} stack_class_t;
+
+typedef struct stack_cache {
+    void *stacks[STACK_CLASSES][STACK_CACHE_DEPTH];
+    unsigned counts[STACK_CLASSES];
+    bool registered;
+} stack_cache_t;
+
+static struct {
+    pthread_mutex_t mutex;
+    stack_class_t classes[STACK_CLASSES];
+} stacks = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+static atomic_size_t stacks_carved;
+static atomic_size_t pool_reuses;
+static atomic_size_t bytes_released;
+
+static __thread stack_cache_t stack_cache;
+static pthread_key_t stack_exit_key;
+static pthread_once_t stack_exit_once = PTHREAD_ONCE_INIT;
+
+static inline size_t class_stack_size(int index)
+{
+    return STACK_MIN_SIZE << index;
+}
+
+static inline size_t class_slot_size(int index)
+{
+    return class_stack_size(index) + ALLOC_PAGE_SIZE;
+}
+
+static inline unsigned class_cache_depth(int index)
+{
+    return (unsigned)(STACK_CACHE_BYTES / class_stack_size(index));
+}
+
+static int stack_class_of(size_t size)
+{
+    int index = 0;
+    while (index < STACK_CLASSES && class_stack_size(index) < size) {
+        index++;
+    }
+    return index;
+}
+
+/* Class whose range holds stack, or -1 */
+static int class_of_stack(const void *stack)
+{
+    for (int i = 0; i < STACK_CLASSES; i++) {
+        const char *start = atomic_load_explicit(&stacks.classes[i].start, memory_order_acquire);
+        if (start && (const char *)stack >= start &&
+            (const char *)stack < start + STACK_CLASS_RESERVE) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static inline size_t class_slots(int index)
+{
+    return STACK_CLASS_RESERVE / class_slot_size(index);
+}
+
+static char *reserve_class(stack_class_t *class, int index)
+{
+    char *start = atomic_load_explicit(&class->start, memory_order_acquire);
+    if (start)
+        return start;
+
+    lock_mutex(&stacks.mutex);
+    start = atomic_load_explicit(&class->start, memory_order_relaxed);
+    if (!start) {
+        size_t map_size = (class_slots(index) + 63) / 64 * sizeof(atomic_ullong);
+        void *live = mmap(NULL,
+                          map_size,
+                          PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                          -1,
+                          0);
+        start = live == MAP_FAILED ? MAP_FAILED
+                                   : mmap(NULL,
+                                          STACK_CLASS_RESERVE,
+                                          PROT_NONE,
+                                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                                          -1,
+                                          0);
+        if (start == MAP_FAILED) {
+            if (live != MAP_FAILED) {
+                munmap(live, map_size);
+            }
+            start = NULL;
+            last_error = ALLOC_ERROR_OUT_OF_MEMORY;
+        } else {
+            class->live = live;
+            atomic_store_explicit(&class->start, start, memory_order_release);
+        }
+    }
+    unlock_mutex(&stacks.mutex);
+    return start;
+}
+
+/* Make the next slot's stack writable; its guard page stays PROT_NONE */
+static void *carve_stack(int index)
+{
+    stack_class_t *class = &stacks.classes[index];
+    char *start = reserve_class(class, index);
+    if (!start)
+        return NULL;
+
+    size_t slot = atomic_fetch_add_explicit(&class->carved, 1, memory_order_relaxed);
+    if (slot >= class_slots(index)) {
+        last_error = ALLOC_ERROR_OUT_OF_MEMORY;
+        return NULL;
+    }
+
+    char *stack = start + slot * class_slot_size(index) + ALLOC_PAGE_SIZE;
+    if (mprotect(stack, class_stack_size(index), PROT_READ | PROT_WRITE) != 0) {
+        last_error = ALLOC_ERROR_OUT_OF_MEMORY;
+        return NULL;
+    }
+    atomic_fetch_add_explicit(&stacks_carved, 1, memory_order_relaxed);
+    return stack;
+}
+
+/* Set or clear stack's bit in its class's live map; returns the old state */
+static bool mark_live(const void *stack, int index, bool live)
+{
+    const stack_class_t *class = &stacks.classes[index];
+    size_t slot = (size_t)((const char *)stack - class->start) / class_slot_size(index);
+    atomic_ullong *word = &class->live[slot / 64];
+    unsigned long long bit = 1ULL << (slot % 64);
+
+    unsigned long long old = live ? atomic_fetch_or_explicit(word, bit, memory_order_relaxed)
+                                  : atomic_fetch_and_explicit(word, ~bit, memory_order_relaxed);
+    return (old & bit) != 0;
+}
+
+static void *take_pooled(int index)
+{
+    stack_class_t *class = &stacks.classes[index];
+
+    lock_mutex(&stacks.mutex);
+    pooled_stack_t *stack = class->pool;
+    if (stack) {
+        class->pool = stack->next;
+    }
+    unlock_mutex(&stacks.mutex);
+
+    if (stack) {
+        atomic_fetch_add_explicit(&pool_reuses, 1, memory_order_relaxed);
+    }
+    return stack;
+}
+
+/* Release a cold stack's pages and pool it for any thread */
+static void release_stack(void *stack, int index)
+{
+    size_t size = class_stack_size(index);
+    madvise(stack, size, MADV_DONTNEED);
+    atomic_fetch_add_explicit(&bytes_released, size, memory_order_relaxed);
+
+    pooled_stack_t *pooled = stack;
+    lock_mutex(&stacks.mutex);
+    pooled->next = stacks.classes[index].pool;
+    stacks.classes[index].pool = pooled;
+    unlock_mutex(&stacks.mutex);
+}
+
+static void stack_thread_exit(void *arg)
+{
+    stack_cache_t *cache = arg;
+
+    for (int i = 0; i < STACK_CLASSES; i++) {
+        while (cache->counts[i] > 0) {
+            release_stack(cache->stacks[i][--cache->counts[i]], i);
+        }
+    }
+    cache->registered = false;
+}
+
+static void stack_exit_key_init(void)
+{
+    pthread_key_create(&stack_exit_key, stack_thread_exit);
+}
+
+void stack_atfork_prepare(void)
+{
+    lock_mutex(&stacks.mutex);
+}
+
+void stack_atfork_parent(void)
+{
+    unlock_mutex(&stacks.mutex);
+}
+
+/* Stacks cached by threads that did not survive the fork are never reused */
+void stack_atfork_child(void)
+{
+    pthread_mutex_init(&stacks.mutex, NULL);
+}
+
+// cppcheck-suppress unusedFunction
+void *stack_alloc(size_t size)
+{
+    if (size == 0 || size > STACK_MAX_SIZE)
+        return NULL;
+
+    int index = stack_class_of(size);
+    stack_cache_t *cache = &stack_cache;
+    void *stack = NULL;
+    if (LIKELY(cache->counts[index] > 0)) {
+        stack = cache->stacks[index][--cache->counts[index]];
+    } else if (!(stack = take_pooled(index))) {
+        stack = carve_stack(index);
+    }
+
+    if (stack) {
+        mark_live(stack, index, true);
+    }
+    return stack;
+}
+
+// cppcheck-suppress unusedFunction
+void stack_free(void *stack)
+{
+    if (!stack)
+        return;
+
+    int index = class_of_stack(stack);
+    if (index < 0 ||
+        ((char *)stack - stacks.classes[index].start) % class_slot_size(index) != ALLOC_PAGE_SIZE) {
+        last_error = ALLOC_ERROR_INVALID_POINTER;
+        return;
+    }
+    if (!mark_live(stack, index, false)) {
+        fprintf(stderr, "Double free detected at %p\n", stack);
+        abort();
+    }
+
+    stack_cache_t *cache = &stack_cache;
+    if (UNLIKELY(!cache->registered)) {
+        /* The exit hook gives cached stacks back to the pool */
+        cache->registered = true;
+        pthread_once(&stack_exit_once, stack_exit_key_init);
+        pthread_setspecific(stack_exit_key, cache);
+    }
+
+    if (cache->counts[index] < class_cache_depth(index)) {
+        cache->stacks[index][cache->counts[index]++] = stack;
+        return;
+    }
+    release_stack(stack, index);
+}
+
+// cppcheck-suppress unusedFunction
+size_t stack_usable_size(const void *stack)
+{
+    int index = class_of_stack(stack);
+    return index < 0 ? 0 : class_stack_size(index);
+}
+
+// cppcheck-suppress unusedFunction
+void allocator_stack_stats(stack_stats_t *stats)
+{
+    if (!stats)
+        return;
+
+    stats->reserved = 0;
+    for (int i = 0; i < STACK_CLASSES; i++) {
+        if (atomic_load_explicit(&stacks.classes[i].start, memory_order_acquire)) {
+            stats->reserved += STACK_CLASS_RESERVE;
+        }
+    }
+    stats->carved = atomic_load_explicit(&stacks_carved, memory_order_relaxed);
+    stats->pool_reuses = atomic_load_explicit(&pool_reuses, memory_order_relaxed);
+    stats->bytes_released = atomic_load_explicit(&bytes_released, memory_order_relaxed);
+}
+
+void stack_print_stats(void)
+{
+    stack_stats_t stats;
+    allocator_stack_stats(&stats);
+
+    if (stats.reserved == 0)
+        return;
+    printf("Stacks carved/reused from pool: %zu/%zu\n", stats.carved, stats.pool_reuses);
+    printf("Stack bytes released: %zu\n", stats.bytes_released);
+}
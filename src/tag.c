@@ -0,0 +1,255 @@
+/*
+ * Memory Allocator - Allocation Tags
+ *
+ * Attributes live heap memory to the subsystem that allocated it. A thread
+ * names its current subsystem with alloc_tag_push() and alloc_tag_pop(), and
+ * every object allocated meanwhile carries that tag, so free() finds the tag
+ * to charge where it finds the size, without a lookup table: heap blocks in
+ * their header, segment and slab objects in the page or slab that holds
+ * them, which only ever holds objects of one tag.
+ *
+ * The same counters track live memory per power-of-two size class for
+ * every object allocated while heap snapshots are enabled, tagged or not,
+ * which is what heap_snapshot() reads. Such objects carry TAG_COUNTED in
+ * their stored tag.
+ *
+ * Counters are sharded per thread: a thread updates only its own shard,
+ * with plain loads and stores, and a reader sums every shard. A block freed
+ * by another thread is taken off that thread's shard, which may then go
+ * negative; only the sum means anything. Shards are mapped directly rather
+ * than allocated, since the first malloc() of a thread needs one. When a
+ * thread exits its shard is folded into the retired totals and kept for the
+ * next thread.
+ */
+
+#define _GNU_SOURCE
+
+#include "allocator_internal.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+static struct {
+    pthread_mutex_t mutex;
+    tag_shard_t *shards;             /* Owned by live threads */
+    tag_shard_t *spare;              /* Left by exited threads, zeroed */
+    long long retired[TAG_COUNTERS]; /* Folded in from exited threads */
+} tags = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+__thread uint16_t alloc_tag_current __attribute__((tls_model("initial-exec")));
+static __thread uint16_t tag_stack[ALLOC_TAG_DEPTH];
+static __thread unsigned tag_depth;
+__thread tag_shard_t *tag_thread_shard __attribute__((tls_model("initial-exec")));
+static __thread bool shard_retired; /* The exit hook has run */
+
+static pthread_key_t shard_exit_key;
+static pthread_once_t shard_exit_once = PTHREAD_ONCE_INIT;
+
+/* Without a shard, as when libc frees after the exit hook, the retired
+ * totals are updated under the lock instead */
+void tag_count_retired(int index, long long delta)
+{
+    lock_mutex(&tags.mutex);
+    tags.retired[index] += delta;
+    unlock_mutex(&tags.mutex);
+}
+
+static void shard_thread_exit(void *arg)
+{
+    tag_shard_t *shard = arg;
+
+    tag_thread_shard = NULL;
+    shard_retired = true;
+
+    lock_mutex(&tags.mutex);
+    tag_shard_t **link = &tags.shards;
+    while (*link != shard) {
+        link = &(*link)->next;
+    }
+    *link = shard->next;
+
+    for (int i = 0; i < TAG_COUNTERS; i++) {
+        tags.retired[i] += atomic_load_explicit(&shard->counters[i], memory_order_relaxed);
+    }
+    memset(shard->counters, 0, sizeof(shard->counters));
+    shard->next = tags.spare;
+    tags.spare = shard;
+    unlock_mutex(&tags.mutex);
+}
+
+static void shard_exit_key_init(void)
+{
+    pthread_key_create(&shard_exit_key, shard_thread_exit);
+}
+
+tag_shard_t *tag_shard_acquire(void)
+{
+    tag_shard_t *shard = tag_thread_shard;
+    if (shard || shard_retired)
+        return shard;
+
+    lock_mutex(&tags.mutex);
+    shard = tags.spare;
+    if (shard) {
+        tags.spare = shard->next;
+    }
+    unlock_mutex(&tags.mutex);
+
+    if (!shard) {
+        shard = mmap(NULL,
+                     sizeof(tag_shard_t),
+                     PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS,
+                     -1,
+                     0);
+        if (shard == MAP_FAILED)
+            return NULL;
+    }
+
+    lock_mutex(&tags.mutex);
+    shard->next = tags.shards;
+    tags.shards = shard;
+    unlock_mutex(&tags.mutex);
+
+    /* Installed before registering the exit hook, which may allocate */
+    tag_thread_shard = shard;
+    pthread_once(&shard_exit_once, shard_exit_key_init);
+    pthread_setspecific(shard_exit_key, shard);
+    return shard;
+}
+
+void tag_record_resize(const block_t *block, size_t old_size)
+{
+    uint16_t tag = block->tag;
+    if (tag == 0)
+        return;
+
+    tag_shard_t *shard = tag_shard();
+    if (tag & TAG_COUNTED) {
+        int old_class = tag_size_class(old_size);
+        int new_class = tag_size_class(block->size);
+        tag_count(shard, CLASS_BYTES(old_class), -(long long)old_size);
+        tag_count(shard, CLASS_OBJECTS(old_class), -1);
+        tag_count(shard, CLASS_BYTES(new_class), (long long)block->size);
+        tag_count(shard, CLASS_OBJECTS(new_class), 1);
+        tag &= ~TAG_COUNTED;
+    }
+
+    if (tag != 0) {
+        tag_count(shard, TAG_BYTES(tag), (long long)block->size - (long long)old_size);
+    }
+}
+
+/* Sum of one counter over every shard; caller holds tags.mutex */
+static long long sum_locked(int index)
+{
+    long long sum = tags.retired[index];
+    for (const tag_shard_t *shard = tags.shards; shard; shard = shard->next) {
+        sum += atomic_load_explicit(&shard->counters[index], memory_order_relaxed);
+    }
+    return sum;
+}
+
+/* Shards are read one after another, so a sum can briefly dip below 0 */
+static inline size_t clamp(long long value)
+{
+    return value > 0 ? (size_t)value : 0;
+}
+
+void tag_collect(heap_snapshot_t *snapshot)
+{
+    lock_mutex(&tags.mutex);
+    for (int class = 0; class < HEAP_SNAPSHOT_CLASSES; class++) {
+        snapshot->class_bytes[class] = clamp(sum_locked(CLASS_BYTES(class)));
+        snapshot->class_objects[class] = clamp(sum_locked(CLASS_OBJECTS(class)));
+    }
+    for (int tag = 0; tag < ALLOC_TAG_MAX; tag++) {
+        snapshot->tag_bytes[tag] = clamp(sum_locked(TAG_BYTES(tag)));
+        snapshot->tag_objects[tag] = clamp(sum_locked(TAG_OBJECTS(tag)));
+    }
+    unlock_mutex(&tags.mutex);
+}
+
+void tag_atfork_prepare(void)
+{
+    lock_mutex(&tags.mutex);
+}
+
+void tag_atfork_parent(void)
+{
+    unlock_mutex(&tags.mutex);
+}
+
+/* Shards of threads that did not survive the fork stay listed: the blocks
+ * they count are still live in the child */
+void tag_atfork_child(void)
+{
+    pthread_mutex_init(&tags.mutex, NULL);
+}
+
+// cppcheck-suppress unusedFunction
+int alloc_tag_push(uint16_t tag)
+{
+    if (tag >= ALLOC_TAG_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (tag_depth == ALLOC_TAG_DEPTH) {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    tag_stack[tag_depth++] = alloc_tag_current;
+    alloc_tag_current = tag;
+    return 0;
+}
+
+// cppcheck-suppress unusedFunction
+void alloc_tag_pop(void)
+{
+    if (tag_depth > 0) {
+        alloc_tag_current = tag_stack[--tag_depth];
+    }
+}
+
+// cppcheck-suppress unusedFunction
+uint16_t alloc_tag_get(void)
+{
+    return alloc_tag_current;
+}
+
+// cppcheck-suppress unusedFunction
+int allocator_tag_stats(uint16_t tag, alloc_tag_stats_t *stats)
+{
+    if (tag >= ALLOC_TAG_MAX || !stats) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    lock_mutex(&tags.mutex);
+    stats->live_bytes = clamp(sum_locked(TAG_BYTES(tag)));
+    stats->live_objects = clamp(sum_locked(TAG_OBJECTS(tag)));
+    stats->allocations = clamp(sum_locked(TAG_ALLOCATIONS(tag)));
+    unlock_mutex(&tags.mutex);
+    return 0;
+}
+
+void tag_print_stats(void)
+{
+    size_t used = 0, live_bytes = 0;
+
+    for (uint16_t tag = 1; tag < ALLOC_TAG_MAX; tag++) {
+        alloc_tag_stats_t stats;
+        allocator_tag_stats(tag, &stats);
+        if (stats.allocations > 0) {
+            used++;
+            live_bytes += stats.live_bytes;
+        }
+    }
+
+    if (used == 0)
+        return;
+    printf("Allocation tags used/live tagged bytes: %zu/%zu\n", used, live_bytes);
+}
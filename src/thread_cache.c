@@ -0,0 +1,128 @@
+/*
+ * Memory Allocator - Thread-Local Cache
+ *
+ * An explicit per-thread cache in front of malloc()/free(): cache_free()
+ * keeps up to MAX_THREAD_CACHE_SIZE bytes of small objects on per-class
+ * lists of the calling thread, and cache_alloc() reuses them before going
+ * to the heap. Objects stay with whichever thread freed them, so in
+ * producer/consumer patterns the consumer's cache fills up and everything
+ * beyond it goes back through the global heap lock.
+ *
+ * A cached object holds its own cache_entry_t, so cache_alloc() never hands
+ * out less than sizeof(cache_entry_t) bytes. Only pointers returned by
+ * cache_alloc() may be passed to cache_free(), with the same size.
+ */
+
+#define _GNU_SOURCE
+
+#include "allocator_internal.h"
+
+#define THREAD_CACHE_CLASSES 7 /* 16, 32, ... 1024 bytes, as get_size_class() */
+
+static size_t cache_object_size(int class)
+{
+    size_t size = get_class_size(class);
+    return size < sizeof(cache_entry_t) ? ALIGN_SIZE(sizeof(cache_entry_t)) : size;
+}
+
+// cppcheck-suppress unusedFunction
+int init_thread_cache(void)
+{
+    if (thread_cache)
+        return 0;
+
+    thread_cache_t *cache = calloc(1, sizeof(thread_cache_t));
+    if (!cache)
+        return -1;
+
+    cache->enabled = true;
+    thread_cache = cache;
+    return 0;
+}
+
+static void drain_thread_cache(thread_cache_t *cache)
+{
+    for (int i = 0; i < THREAD_CACHE_CLASSES; i++) {
+        cache_entry_t *entry = cache->free_lists[i];
+        while (entry) {
+            cache_entry_t *next = entry->next;
+            free(entry->ptr);
+            entry = next;
+        }
+        cache->free_lists[i] = NULL;
+    }
+    cache->cache_size = 0;
+}
+
+/* Under memory pressure, the cache starts over empty */
+static void drain_on_pressure(thread_cache_t *cache)
+{
+    unsigned epoch = atomic_load_explicit(&pressure_epoch, memory_order_relaxed);
+    if (UNLIKELY(epoch != cache->pressure_epoch)) {
+        cache->pressure_epoch = epoch;
+        drain_thread_cache(cache);
+    }
+}
+
+// cppcheck-suppress unusedFunction
+void cleanup_thread_cache(void)
+{
+    thread_cache_t *cache = thread_cache;
+    if (!cache)
+        return;
+
+    thread_cache = NULL;
+    drain_thread_cache(cache);
+    free(cache);
+}
+
+// cppcheck-suppress unusedFunction
+void *cache_alloc(size_t size)
+{
+    thread_cache_t *cache = thread_cache;
+    int class = get_size_class(size);
+
+    if (!cache || !cache->enabled || class >= THREAD_CACHE_CLASSES || size == 0)
+        return malloc(size);
+
+    drain_on_pressure(cache);
+
+    cache_entry_t *entry = cache->free_lists[class];
+    if (entry) {
+        cache->free_lists[class] = entry->next;
+        cache->cache_size -= entry->size;
+        return entry->ptr;
+    }
+
+    return malloc(cache_object_size(class));
+}
+
+// cppcheck-suppress unusedFunction
+void cache_free(void *ptr, size_t size)
+{
+    thread_cache_t *cache = thread_cache;
+    int class = get_size_class(size);
+
+    if (!ptr)
+        return;
+
+    if (!cache || !cache->enabled || class >= THREAD_CACHE_CLASSES || size == 0) {
+        free(ptr);
+        return;
+    }
+
+    drain_on_pressure(cache);
+
+    size_t object_size = cache_object_size(class);
+    if (cache->cache_size + object_size > MAX_THREAD_CACHE_SIZE) {
+        free(ptr);
+        return;
+    }
+
+    cache_entry_t *entry = (cache_entry_t *)ptr;
+    entry->ptr = ptr;
+    entry->size = object_size;
+    entry->next = cache->free_lists[class];
+    cache->free_lists[class] = entry;
+    cache->cache_size += object_size;
+}
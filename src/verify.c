@@ -0,0 +1,95 @@
+/*
+ * Memory Allocator - Background Heap Verifier
+ *
+ * A full heap_consistency_check() holds up the program for as long as the
+ * walk takes, which rules it out on large heaps. The background verifier
+ * instead calls heap_verify_step() from an idle-priority thread, a few
+ * blocks per tick, so corruption is caught within a few passes while each
+ * tick holds the allocator's locks for no longer than one heap_iterate()
+ * slice at a time. The rate is set with allocator_set_verify_rate().
+ */
+
+#define _GNU_SOURCE
+
+#include "allocator_internal.h"
+
+#include <stdio.h>
+
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;
+    background_thread_t thread;
+} verifier_thread = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .thread = BACKGROUND_THREAD_INITIALIZER,
+};
+
+static atomic_size_t tick_blocks = VERIFY_TICK_BLOCKS;
+static atomic_uint tick_interval_ms = VERIFY_INTERVAL_MS;
+
+static void *verifier_main(void *arg)
+{
+    (void)arg;
+
+    background_thread_set_idle();
+
+    pthread_mutex_lock(&verifier_thread.mutex);
+    while (!verifier_thread.thread.stopping) {
+        unsigned interval = atomic_load_explicit(&tick_interval_ms, memory_order_relaxed);
+        background_thread_wait(&verifier_thread.wake,
+                               &verifier_thread.mutex,
+                               (uint64_t)interval * 1000000u);
+        if (verifier_thread.thread.stopping)
+            break;
+
+        pthread_mutex_unlock(&verifier_thread.mutex);
+        heap_verify_step(atomic_load_explicit(&tick_blocks, memory_order_relaxed));
+        pthread_mutex_lock(&verifier_thread.mutex);
+    }
+    pthread_mutex_unlock(&verifier_thread.mutex);
+
+    return NULL;
+}
+
+/* The verifier thread did not survive the fork */
+void verify_atfork_child(void)
+{
+    pthread_mutex_init(&verifier_thread.mutex, NULL);
+    pthread_cond_init(&verifier_thread.wake, NULL);
+    background_thread_atfork_child(&verifier_thread.thread);
+}
+
+// cppcheck-suppress unusedFunction
+int allocator_set_background_verify(bool enabled)
+{
+    return background_thread_toggle(&verifier_thread.thread,
+                                    enabled,
+                                    verifier_main,
+                                    &verifier_thread.mutex,
+                                    &verifier_thread.wake);
+}
+
+// cppcheck-suppress unusedFunction
+void allocator_set_verify_rate(size_t blocks_per_tick, unsigned interval_ms)
+{
+    atomic_store_explicit(&tick_blocks,
+                          blocks_per_tick ? blocks_per_tick : VERIFY_TICK_BLOCKS,
+                          memory_order_relaxed);
+    atomic_store_explicit(&tick_interval_ms,
+                          interval_ms ? interval_ms : VERIFY_INTERVAL_MS,
+                          memory_order_relaxed);
+}
+
+void verify_print_stats(void)
+{
+    verify_stats_t stats;
+    allocator_verify_stats(&stats);
+    if (stats.blocks_checked == 0)
+        return;
+
+    printf("Verifier passes/blocks checked/errors: %zu/%zu/%zu\n",
+           stats.passes,
+           stats.blocks_checked,
+           stats.errors);
+}
@@ -0,0 +1,226 @@
+/*
+ * Memory Allocator - Pre-Zeroed Pool for calloc
+ *
+ * A large calloc() served from a reused heap block has to clear it on the
+ * caller's critical path. When the pool is enabled, a low-priority thread
+ * keeps a few blocks per size class allocated and already cleared, and
+ * calloc() takes one of those before falling back to malloc() + memset().
+ *
+ * Size classes are powers of two from ZERO_POOL_MIN_SIZE to
+ * ZERO_POOL_MAX_SIZE. A class is only refilled after calloc() has asked for
+ * it, so idle classes never pin memory. The thread sleeps until calloc()
+ * misses or drains a class below half its depth, so an idle pool costs no
+ * wakeups.
+ * The refill thread clears blocks with non-temporal stores at every size so
+ * the work does not evict the application's working set from the cache.
+ */
+
+#define _GNU_SOURCE
+
+#include "allocator_internal.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define ZERO_POOL_CLASSES 7 /* 16KB, 32KB, ... 1MB */
+
+typedef struct zero_class {
+    void *chunks[ZERO_POOL_DEPTH];
+    int count;
+    bool wanted; /* calloc() has asked for this class */
+} zero_class_t;
+
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t refill_needed;
+    background_thread_t thread;
+
+    zero_class_t classes[ZERO_POOL_CLASSES];
+    zero_pool_stats_t stats;
+} pool = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .refill_needed = PTHREAD_COND_INITIALIZER,
+    .thread = BACKGROUND_THREAD_INITIALIZER,
+};
+
+static int zero_class_index(size_t size)
+{
+    int index = 0;
+    size_t class_size = ZERO_POOL_MIN_SIZE;
+
+    while (class_size < size) {
+        class_size <<= 1;
+        index++;
+    }
+    return index;
+}
+
+static size_t zero_class_size(int index)
+{
+    return ZERO_POOL_MIN_SIZE << index;
+}
+
+/* Pick a class that calloc() wants and that is below its target depth */
+static int next_refill_class(void)
+{
+    for (int i = 0; i < ZERO_POOL_CLASSES; i++) {
+        if (pool.classes[i].wanted && pool.classes[i].count < ZERO_POOL_DEPTH)
+            return i;
+    }
+    return -1;
+}
+
+static void *zero_pool_main(void *arg)
+{
+    (void)arg;
+
+    background_thread_set_idle();
+
+    pthread_mutex_lock(&pool.mutex);
+    while (!pool.thread.stopping) {
+        int index = next_refill_class();
+        if (index < 0) {
+            pthread_cond_wait(&pool.refill_needed, &pool.mutex);
+            continue;
+        }
+        pthread_mutex_unlock(&pool.mutex);
+
+        size_t size = zero_class_size(index);
+        block_t *block = allocate_block(size);
+        void *chunk = get_ptr_from_block(block);
+        if (block && block->mapped_size == 0) {
+            /* Fresh mappings come zero-filled; heap blocks must be cleared */
+            memops_zero_nontemporal(chunk, size);
+        }
+
+        pthread_mutex_lock(&pool.mutex);
+        if (!chunk) {
+            /* Out of memory: stop refilling until calloc() asks again */
+            pool.classes[index].wanted = false;
+            continue;
+        }
+
+        zero_class_t *class = &pool.classes[index];
+        if (pool.thread.stopping || class->count == ZERO_POOL_DEPTH) {
+            pthread_mutex_unlock(&pool.mutex);
+            free_uncounted(chunk);
+            pthread_mutex_lock(&pool.mutex);
+            continue;
+        }
+        class->chunks[class->count++] = chunk;
+        pool.stats.refills++;
+        pool.stats.bytes_zeroed += size;
+    }
+    pthread_mutex_unlock(&pool.mutex);
+
+    return NULL;
+}
+
+void zero_pool_atfork_prepare(void)
+{
+    pthread_mutex_lock(&pool.mutex);
+}
+
+void zero_pool_atfork_parent(void)
+{
+    pthread_mutex_unlock(&pool.mutex);
+}
+
+/* The refill thread did not survive the fork; the chunks it left in the
+ * pool are used again if the child enables the pool */
+void zero_pool_atfork_child(void)
+{
+    pthread_mutex_init(&pool.mutex, NULL);
+    pthread_cond_init(&pool.refill_needed, NULL);
+    background_thread_atfork_child(&pool.thread);
+}
+
+void *zero_pool_take(size_t size)
+{
+    if (size < ZERO_POOL_MIN_SIZE || size > ZERO_POOL_MAX_SIZE)
+        return NULL;
+    if (!atomic_load_explicit(&pool.thread.running, memory_order_acquire))
+        return NULL;
+
+    int index = zero_class_index(size);
+    zero_class_t *class = &pool.classes[index];
+    void *chunk = NULL;
+
+    pthread_mutex_lock(&pool.mutex);
+    if (class->count > 0) {
+        chunk = class->chunks[--class->count];
+        pool.stats.hits++;
+    } else {
+        pool.stats.misses++;
+    }
+
+    /* Waking the thread costs a syscall, so hits only wake it once, as the
+     * class drops below half its depth */
+    class->wanted = true;
+    if (!chunk || class->count == ZERO_POOL_DEPTH / 2 - 1) {
+        pthread_cond_signal(&pool.refill_needed);
+    }
+    pthread_mutex_unlock(&pool.mutex);
+
+    return chunk;
+}
+
+/* Give the pooled chunks back to the heap. Classes are refilled again only
+ * once calloc() asks for them. */
+void zero_pool_release(void)
+{
+    for (int i = 0; i < ZERO_POOL_CLASSES; i++) {
+        zero_class_t *class = &pool.classes[i];
+        void *chunks[ZERO_POOL_DEPTH];
+
+        pthread_mutex_lock(&pool.mutex);
+        int count = class->count;
+        memcpy(chunks, class->chunks, (size_t)count * sizeof(void *));
+        class->count = 0;
+        class->wanted = false;
+        pthread_mutex_unlock(&pool.mutex);
+
+        while (count > 0) {
+            free_uncounted(chunks[--count]);
+        }
+    }
+}
+
+// cppcheck-suppress unusedFunction
+int allocator_set_zero_pool(bool enabled)
+{
+    int result = background_thread_toggle(&pool.thread,
+                                          enabled,
+                                          zero_pool_main,
+                                          &pool.mutex,
+                                          &pool.refill_needed);
+    if (!enabled) {
+        zero_pool_release();
+    }
+    return result;
+}
+
+// cppcheck-suppress unusedFunction
+void allocator_zero_pool_stats(zero_pool_stats_t *stats)
+{
+    if (!stats)
+        return;
+
+    pthread_mutex_lock(&pool.mutex);
+    *stats = pool.stats;
+    pthread_mutex_unlock(&pool.mutex);
+}
+
+void zero_pool_print_stats(void)
+{
+    zero_pool_stats_t stats;
+    allocator_zero_pool_stats(&stats);
+
+    size_t lookups = stats.hits + stats.misses;
+    printf("Zero pool: %s\n",
+           atomic_load_explicit(&pool.thread.running, memory_order_relaxed) ? "ON" : "OFF");
+    printf("Zero pool hits/misses: %zu/%zu (%.1f%% hit rate)\n",
+           stats.hits,
+           stats.misses,
+           lookups ? 100.0 * (double)stats.hits / (double)lookups : 0.0);
+}
@@ -0,0 +1,487 @@
+/*
+ * heapview - Offline Analysis of heap_dump() Files
+ *
+ * Reads a dump written by heap_dump() and reports:
+ * - per-region utilization
+ * - a fragmentation map of the sbrk regions
+ * - a size histogram of allocated and free blocks
+ * - the distribution of free runs (physically adjacent free blocks)
+ * - the state of the free list
+ *
+ * The file is mapped and read in a single pass, with one binary search per
+ * block to find its region, so multi-gigabyte heaps take seconds.
+ *
+ * Usage: heapview [-a] [-w width] dump
+ *   -a        list every region, not only the sbrk heap
+ *   -w width  cells per region in the fragmentation map (default 64)
+ */
+
+#define _GNU_SOURCE
+
+#include "allocator.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define HISTOGRAM_BUCKETS 48 /* Power-of-two size classes */
+#define MAP_WIDTH 64         /* Default cells per region in the map */
+#define MAP_WIDTH_MAX 1024
+#define SIZE_TEXT 24 /* Room for a formatted size */
+
+typedef struct region {
+    uint64_t start;
+    uint64_t size;
+    bool mapped;
+    size_t blocks;
+    uint64_t allocated;
+    uint64_t free;
+    double *cells; /* Free bytes per map cell, sbrk regions only */
+} region_t;
+
+typedef struct histogram {
+    size_t allocated[HISTOGRAM_BUCKETS];
+    size_t free[HISTOGRAM_BUCKETS];
+    uint64_t allocated_bytes[HISTOGRAM_BUCKETS];
+    uint64_t free_bytes[HISTOGRAM_BUCKETS];
+} histogram_t;
+
+typedef struct analysis {
+    region_t *regions;
+    size_t region_count;
+    int width;
+
+    size_t blocks;
+    size_t free_blocks;
+    size_t corrupt;
+    size_t orphans; /* Blocks outside every region */
+    uint64_t allocated_bytes;
+    uint64_t free_bytes;
+    histogram_t sizes;
+
+    /* Free runs, merged while the blocks go by in address order */
+    uint64_t run_end;
+    uint64_t run_bytes;
+    size_t runs[HISTOGRAM_BUCKETS];
+    uint64_t run_total[HISTOGRAM_BUCKETS];
+    size_t run_count;
+    uint64_t largest_run;
+
+    size_t listed;
+    uint64_t listed_bytes;
+} analysis_t;
+
+static int size_bucket(uint64_t size)
+{
+    int bucket = 0;
+    while (bucket < HISTOGRAM_BUCKETS - 1 && ((uint64_t)1 << (bucket + 1)) <= size) {
+        bucket++;
+    }
+    return bucket;
+}
+
+static void format_size(char *out, size_t length, uint64_t bytes)
+{
+    static const char *units[] = {"B", "KB", "MB", "GB", "TB"};
+    double value = (double)bytes;
+    int unit = 0;
+    while (value >= 1024.0 && unit < 4) {
+        value /= 1024.0;
+        unit++;
+    }
+    if (unit == 0) {
+        snprintf(out, length, "%llu B", (unsigned long long)bytes);
+    } else {
+        snprintf(out, length, "%.1f %s", value, units[unit]);
+    }
+}
+
+static int compare_regions(const void *a, const void *b)
+{
+    const region_t *left = a;
+    const region_t *right = b;
+    return (left->start > right->start) - (left->start < right->start);
+}
+
+static region_t *find_region(analysis_t *analysis, uint64_t address)
+{
+    size_t lo = 0;
+    size_t hi = analysis->region_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        region_t *region = &analysis->regions[mid];
+        if (address < region->start) {
+            hi = mid;
+        } else if (address >= region->start + region->size) {
+            lo = mid + 1;
+        } else {
+            return region;
+        }
+    }
+    return NULL;
+}
+
+/* Spread the free bytes of [start, end) over the region's map cells */
+static void mark_free(const analysis_t *analysis, region_t *region, uint64_t start, uint64_t end)
+{
+    double cell_size = (double)region->size / analysis->width;
+    int first = (int)((double)(start - region->start) / cell_size);
+    for (int cell = first; cell < analysis->width; cell++) {
+        double cell_start = region->start + cell * cell_size;
+        double cell_end = cell_start + cell_size;
+        double from = (double)start > cell_start ? (double)start : cell_start;
+        double to = (double)end < cell_end ? (double)end : cell_end;
+        if (to <= from)
+            break;
+        region->cells[cell] += to - from;
+    }
+}
+
+static void end_run(analysis_t *analysis)
+{
+    if (analysis->run_bytes == 0)
+        return;
+
+    int bucket = size_bucket(analysis->run_bytes);
+    analysis->runs[bucket]++;
+    analysis->run_total[bucket] += analysis->run_bytes;
+    analysis->run_count++;
+    if (analysis->run_bytes > analysis->largest_run) {
+        analysis->largest_run = analysis->run_bytes;
+    }
+    analysis->run_bytes = 0;
+}
+
+static void add_block(analysis_t *analysis, const heap_dump_record_t *record)
+{
+    analysis->blocks++;
+    if (record->flags & HEAP_DUMP_FLAG_CORRUPT) {
+        analysis->corrupt++;
+        end_run(analysis);
+        return;
+    }
+
+    /* The header sits right in front of the user pointer */
+    uint64_t start = record->address - HEADER_SIZE;
+    uint64_t end = record->address + record->size;
+    bool is_free = record->flags & HEAP_DUMP_FLAG_FREE;
+    int bucket = size_bucket(record->size);
+
+    region_t *region = find_region(analysis, record->address);
+    if (!region) {
+        analysis->orphans++;
+    } else {
+        region->blocks++;
+        if (is_free) {
+            region->free += record->size;
+            if (region->cells) {
+                mark_free(analysis, region, record->address, end);
+            }
+        } else {
+            region->allocated += record->size;
+        }
+    }
+
+    if (is_free) {
+        analysis->free_blocks++;
+        analysis->free_bytes += record->size;
+        analysis->sizes.free[bucket]++;
+        analysis->sizes.free_bytes[bucket] += record->size;
+
+        /* A free run spans headers between its blocks but counts payload */
+        if (analysis->run_bytes == 0 || start != analysis->run_end) {
+            end_run(analysis);
+        }
+        analysis->run_bytes += record->size;
+        analysis->run_end = end;
+    } else {
+        analysis->allocated_bytes += record->size;
+        analysis->sizes.allocated[bucket]++;
+        analysis->sizes.allocated_bytes[bucket] += record->size;
+        end_run(analysis);
+    }
+}
+
+static void print_regions(const analysis_t *analysis, bool all)
+{
+    size_t mapped = 0;
+    uint64_t mapped_size = 0;
+    uint64_t mapped_used = 0;
+
+    printf("\n=== Regions ===\n");
+    printf("%-18s %12s %6s %10s %12s %12s %6s\n",
+           "start",
+           "size",
+           "kind",
+           "blocks",
+           "allocated",
+           "free",
+           "used");
+    for (size_t i = 0; i < analysis->region_count; i++) {
+        const region_t *region = &analysis->regions[i];
+        if (region->mapped) {
+            mapped++;
+            mapped_size += region->size;
+            mapped_used += region->allocated;
+            if (!all)
+                continue;
+        }
+
+        char size[SIZE_TEXT];
+        char allocated[SIZE_TEXT];
+        char free_bytes[SIZE_TEXT];
+        format_size(size, sizeof(size), region->size);
+        format_size(allocated, sizeof(allocated), region->allocated);
+        format_size(free_bytes, sizeof(free_bytes), region->free);
+        printf("0x%016llx %12s %6s %10zu %12s %12s %5.1f%%\n",
+               (unsigned long long)region->start,
+               size,
+               region->mapped ? "mmap" : "sbrk",
+               region->blocks,
+               allocated,
+               free_bytes,
+               region->size ? 100.0 * (double)region->allocated / (double)region->size : 0.0);
+    }
+
+    if (!all && mapped > 0) {
+        char size[SIZE_TEXT];
+        format_size(size, sizeof(size), mapped_size);
+        printf("%zu dedicated mappings, %s, %.1f%% used (-a lists them)\n",
+               mapped,
+               size,
+               mapped_size ? 100.0 * (double)mapped_used / (double)mapped_size : 0.0);
+    }
+}
+
+static void print_map(const analysis_t *analysis)
+{
+    static const char shades[] = "#%+-. "; /* From fully allocated to fully free */
+
+    printf("\n=== Fragmentation Map (sbrk heap) ===\n");
+    printf("Each cell is 1/%d of its region: '#' allocated ... '.' mostly free, ' ' free\n",
+           analysis->width);
+    for (size_t i = 0; i < analysis->region_count; i++) {
+        const region_t *region = &analysis->regions[i];
+        if (!region->cells)
+            continue;
+
+        double cell_size = (double)region->size / analysis->width;
+        printf("0x%016llx |", (unsigned long long)region->start);
+        for (int cell = 0; cell < analysis->width; cell++) {
+            double share = cell_size > 0 ? region->cells[cell] / cell_size : 0;
+            int shade = (int)(share * (sizeof(shades) - 2) + 0.5);
+            putchar(shades[shade]);
+        }
+        printf("|\n");
+    }
+}
+
+static void print_histogram(const analysis_t *analysis)
+{
+    printf("\n=== Block Sizes ===\n");
+    printf("%-12s %12s %12s %12s %12s\n", "size", "allocated", "bytes", "free", "bytes");
+    for (int bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++) {
+        const histogram_t *sizes = &analysis->sizes;
+        if (sizes->allocated[bucket] == 0 && sizes->free[bucket] == 0)
+            continue;
+
+        char floor[SIZE_TEXT];
+        char allocated[SIZE_TEXT];
+        char free_bytes[SIZE_TEXT];
+        format_size(floor, sizeof(floor), (uint64_t)1 << bucket);
+        format_size(allocated, sizeof(allocated), sizes->allocated_bytes[bucket]);
+        format_size(free_bytes, sizeof(free_bytes), sizes->free_bytes[bucket]);
+        printf(">= %-9s %12zu %12s %12zu %12s\n",
+               floor,
+               sizes->allocated[bucket],
+               allocated,
+               sizes->free[bucket],
+               free_bytes);
+    }
+}
+
+static void print_runs(const analysis_t *analysis)
+{
+    printf("\n=== Free Runs ===\n");
+    printf("%-12s %12s %12s\n", "run size", "runs", "bytes");
+    for (int bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++) {
+        if (analysis->runs[bucket] == 0)
+            continue;
+
+        char floor[SIZE_TEXT];
+        char bytes[SIZE_TEXT];
+        format_size(floor, sizeof(floor), (uint64_t)1 << bucket);
+        format_size(bytes, sizeof(bytes), analysis->run_total[bucket]);
+        printf(">= %-9s %12zu %12s\n", floor, analysis->runs[bucket], bytes);
+    }
+
+    char largest[SIZE_TEXT];
+    format_size(largest, sizeof(largest), analysis->largest_run);
+    printf("%zu runs, largest %s, external fragmentation %.1f%%\n",
+           analysis->run_count,
+           largest,
+           analysis->free_bytes
+               ? 100.0 * (1.0 - (double)analysis->largest_run / (double)analysis->free_bytes)
+               : 0.0);
+}
+
+static int analyze(const char *data, size_t length, analysis_t *analysis, bool all)
+{
+    const heap_dump_header_t *header = (const heap_dump_header_t *)data;
+    if (length < sizeof(*header) || memcmp(header->magic, HEAP_DUMP_MAGIC, 8) != 0) {
+        fprintf(stderr, "heapview: not a heap dump\n");
+        return -1;
+    }
+    if (header->version != HEAP_DUMP_VERSION ||
+        header->record_size != sizeof(heap_dump_record_t)) {
+        fprintf(stderr, "heapview: unsupported dump version %u\n", header->version);
+        return -1;
+    }
+
+    const heap_dump_record_t *records = (const heap_dump_record_t *)(data + sizeof(*header));
+    size_t count = (length - sizeof(*header)) / sizeof(heap_dump_record_t);
+
+    /* Regions come first; everything else needs them sorted */
+    size_t regions = 0;
+    while (regions < count && records[regions].type == HEAP_DUMP_REGION) {
+        regions++;
+    }
+    analysis->regions = calloc(regions ? regions : 1, sizeof(region_t));
+    if (!analysis->regions) {
+        perror("heapview");
+        return -1;
+    }
+    for (size_t i = 0; i < regions; i++) {
+        region_t *region = &analysis->regions[i];
+        region->start = records[i].address;
+        region->size = records[i].size;
+        region->mapped = records[i].flags & HEAP_DUMP_FLAG_MAPPED;
+        if (!region->mapped) {
+            region->cells = calloc((size_t)analysis->width, sizeof(double));
+            if (!region->cells) {
+                perror("heapview");
+                return -1;
+            }
+        }
+    }
+    analysis->region_count = regions;
+    qsort(analysis->regions, regions, sizeof(region_t), compare_regions);
+
+    size_t index = regions;
+    bool complete = false;
+    for (; index < count && !complete; index++) {
+        const heap_dump_record_t *record = &records[index];
+        switch (record->type) {
+            case HEAP_DUMP_BLOCK:
+                add_block(analysis, record);
+                break;
+            case HEAP_DUMP_FREE_LIST:
+                end_run(analysis);
+                analysis->listed++;
+                analysis->listed_bytes += record->size;
+                break;
+            case HEAP_DUMP_END:
+                complete = record->size == index;
+                break;
+            default:
+                break;
+        }
+    }
+    end_run(analysis);
+
+    char when[32];
+    time_t timestamp = (time_t)header->timestamp;
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&timestamp));
+    printf("Heap dump taken %s: %zu regions, %zu blocks, %zu on the free list%s\n",
+           when,
+           analysis->region_count,
+           analysis->blocks,
+           analysis->listed,
+           complete ? "" : " (truncated)");
+
+    char allocated[SIZE_TEXT];
+    char free_bytes[SIZE_TEXT];
+    format_size(allocated, sizeof(allocated), analysis->allocated_bytes);
+    format_size(free_bytes, sizeof(free_bytes), analysis->free_bytes);
+    printf("Blocks: %s allocated, %s free in %zu blocks",
+           allocated,
+           free_bytes,
+           analysis->free_blocks);
+    if (analysis->corrupt + analysis->orphans > 0) {
+        printf(", %zu corrupt, %zu outside any region", analysis->corrupt, analysis->orphans);
+    }
+    printf("\n");
+
+    print_regions(analysis, all);
+    print_map(analysis);
+    print_histogram(analysis);
+    print_runs(analysis);
+
+    char listed[SIZE_TEXT];
+    format_size(listed, sizeof(listed), analysis->listed_bytes);
+    printf("\n=== Free List ===\n");
+    printf("%zu blocks, %s listed; %zu free blocks not yet listed\n",
+           analysis->listed,
+           listed,
+           analysis->free_blocks > analysis->listed ? analysis->free_blocks - analysis->listed
+                                                    : 0);
+    return complete ? 0 : 1;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: heapview [-a] [-w width] dump\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    analysis_t analysis = {.width = MAP_WIDTH};
+    bool all = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "aw:")) != -1) {
+        switch (opt) {
+            case 'a':
+                all = true;
+                break;
+            case 'w':
+                analysis.width = atoi(optarg);
+                if (analysis.width < 1 || analysis.width > MAP_WIDTH_MAX)
+                    usage();
+                break;
+            default:
+                usage();
+        }
+    }
+    if (optind != argc - 1)
+        usage();
+
+    int fd = open(argv[optind], O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "heapview: %s: %s\n", argv[optind], strerror(errno));
+        return 1;
+    }
+    if (st.st_size == 0) {
+        fprintf(stderr, "heapview: %s: empty file\n", argv[optind]);
+        return 1;
+    }
+
+    const char *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "heapview: %s: %s\n", argv[optind], strerror(errno));
+        return 1;
+    }
+    madvise((void *)data, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    int result = analyze(data, (size_t)st.st_size, &analysis, all);
+    return result < 0 ? 1 : result;
+}
@@ -0,0 +1,175 @@
+/*
+ * rtbench - Worst-Case Latency of the Real-Time Heap
+ *
+ * Churns a table of live objects with random sizes through rt_alloc() and
+ * rt_free(), timing every call, and reports the maximum latency along with
+ * a histogram, so that rare slow operations are seen rather than averaged
+ * away. Mapped memory is locked with mlockall() first when the limits allow,
+ * and the timer's own overhead is measured and reported alongside.
+ *
+ * Usage: rtbench [-m] [-n operations] [-p pool_mb]
+ *   -m               also run the same churn through malloc() and free(),
+ *                    best with a smaller -n: the main heap is far slower here
+ *   -n operations    timed calls (default 100000000)
+ *   -p pool_mb       real-time pool size in megabytes (default 64)
+ */
+
+#define _GNU_SOURCE
+
+#include "allocator.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LATENCY_BUCKETS 32 /* Power-of-two nanosecond buckets */
+#define SLOTS 4096         /* Live objects at once */
+#define MAX_OBJECT 4096
+
+typedef struct result {
+    uint64_t operations;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t buckets[LATENCY_BUCKETS];
+} result_t;
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void record(result_t *result, uint64_t ns)
+{
+    int bucket = ns ? 64 - __builtin_clzll(ns) : 0;
+    if (bucket >= LATENCY_BUCKETS) {
+        bucket = LATENCY_BUCKETS - 1;
+    }
+    result->buckets[bucket]++;
+    result->operations++;
+    result->total_ns += ns;
+    if (ns > result->max_ns) {
+        result->max_ns = ns;
+    }
+}
+
+static int churn(void *(*alloc_fn)(size_t),
+                 void (*free_fn)(void *),
+                 uint64_t operations,
+                 result_t *result)
+{
+    static void *slots[SLOTS];
+    unsigned seed = 12345;
+
+    memset(result, 0, sizeof(*result));
+    while (result->operations < operations) {
+        int slot = (int)(rand_r(&seed) % SLOTS);
+        uint64_t start;
+        if (slots[slot]) {
+            start = now_ns();
+            free_fn(slots[slot]);
+            record(result, now_ns() - start);
+            slots[slot] = NULL;
+        } else {
+            size_t size = 16 + (size_t)(rand_r(&seed) % (MAX_OBJECT - 16));
+            start = now_ns();
+            slots[slot] = alloc_fn(size);
+            record(result, now_ns() - start);
+            if (!slots[slot]) {
+                fprintf(stderr, "rtbench: allocation of %zu bytes failed\n", size);
+                return -1;
+            }
+            *(volatile char *)slots[slot] = 1;
+        }
+    }
+
+    for (int i = 0; i < SLOTS; i++) {
+        free_fn(slots[i]);
+        slots[i] = NULL;
+    }
+    return 0;
+}
+
+static void report(const char *name, const result_t *result)
+{
+    printf("%s: %llu ops, mean %.1f ns, max %llu ns\n",
+           name,
+           (unsigned long long)result->operations,
+           (double)result->total_ns / (double)result->operations,
+           (unsigned long long)result->max_ns);
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        if (result->buckets[i] == 0)
+            continue;
+        printf("  < %10llu ns  %12llu\n", 1ULL << i, (unsigned long long)result->buckets[i]);
+    }
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: rtbench [-m] [-n operations] [-p pool_mb]\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t operations = 100000000;
+    size_t pool_mb = 64;
+    bool compare = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "mn:p:")) != -1) {
+        switch (opt) {
+            case 'm':
+                compare = true;
+                break;
+            case 'n':
+                operations = strtoull(optarg, NULL, 10);
+                if (operations == 0)
+                    usage();
+                break;
+            case 'p':
+                pool_mb = strtoul(optarg, NULL, 10);
+                if (pool_mb == 0)
+                    usage();
+                break;
+            default:
+                usage();
+        }
+    }
+    if (optind != argc)
+        usage();
+
+    if (allocator_realtime_init(pool_mb * 1024 * 1024) != 0) {
+        fprintf(stderr, "rtbench: real-time pool: %s\n", strerror(errno));
+        return 1;
+    }
+    bool locked = mlockall(MCL_CURRENT) == 0;
+    printf("Pool %zu MB, memory %s\n", pool_mb, locked ? "locked" : "not locked (mlockall failed)");
+
+    /* The floor under every measurement */
+    result_t timer = {0};
+    for (int i = 0; i < 1000000; i++) {
+        uint64_t start = now_ns();
+        record(&timer, now_ns() - start);
+    }
+    printf("Timer overhead: mean %.1f ns, max %llu ns\n",
+           (double)timer.total_ns / (double)timer.operations,
+           (unsigned long long)timer.max_ns);
+
+    result_t result;
+    if (churn(rt_alloc, rt_free, operations, &result) != 0)
+        return 1;
+    report("rt_alloc/rt_free", &result);
+
+    if (compare) {
+        if (churn(malloc, free, operations, &result) != 0)
+            return 1;
+        report("malloc/free", &result);
+    }
+    return 0;
+}